@@ -24,6 +24,7 @@
 #include <imsg.h>
 #include <limits.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -34,9 +35,13 @@
 #include "amused.h"
 #include "control.h"
 #include "ev.h"
+#include "library.h"
 #include "log.h"
 #include "player.h"
 #include "playlist.h"
+#include "seekidx.h"
+#include "state.h"
+#include "watch.h"
 #include "xmalloc.h"
 
 char		*csock = NULL;
@@ -49,6 +54,13 @@ pid_t		 player_pid;
 
 struct player_status current_status;
 
+static uint32_t	 current_id;	/* of the track being played */
+static uint32_t	 preload_id;
+static char	*preload_path;
+
+/* where to resume the current track, from the state file */
+static int64_t	 resume_at = -1;
+
 enum amused_process {
 	PROC_MAIN,
 	PROC_PLAYER,
@@ -60,6 +72,8 @@ main_shutdown(void)
 	pid_t	pid;
 	int	status;
 
+	state_save();
+
 	/* close pipes. */
 	close(iev_player->imsgbuf.fd);
 	imsgbuf_clear(&iev_player->imsgbuf);
@@ -107,8 +121,10 @@ main_dispatch_player(int sig, int event, void *d)
 	struct imsg	 imsg;
 	struct ibuf	 ibuf;
 	struct player_status ps;
+	struct seekidx	 idx;
 	size_t		 datalen;
 	ssize_t		 n;
+	uint32_t	 next;
 	int		 shut = 0;
 
 	if (event & EV_READ) {
@@ -145,6 +161,13 @@ main_dispatch_player(int sig, int event, void *d)
 			current_status.info.chan = ps.info.chan;
 			break;
 		case IMSG_ERR:
+			/* as for IMSG_EOF, don't drop the track jumped to */
+			if (imsg_get_id(&imsg) != current_id) {
+				log_debug("ignoring stale error for track %u",
+				    imsg_get_id(&imsg));
+				break;
+			}
+
 			if (imsg_get_ibuf(&imsg, &ibuf) == -1 ||
 			    (datalen = ibuf_size(&ibuf)) == 0)
 				errstr = "unknown error";
@@ -153,18 +176,50 @@ main_dispatch_player(int sig, int event, void *d)
 				errstr[datalen-1] = '\0';
 			}
 			log_warnx("%s; skipping %s", errstr, current_song);
-			playlist_dropcurrent();
+			main_dropcurrent();
 			main_playlist_advance();
 			if (play_state == STATE_PLAYING)
 				control_notify(IMSG_CTL_NEXT);
 			else
 				control_notify(IMSG_CTL_STOP);
 			break;
+		case IMSG_INDEX:
+			if (imsg_get_ibuf(&imsg, &ibuf) == -1 ||
+			    (datalen = ibuf_size(&ibuf)) > sizeof(idx))
+				fatalx("IMSG_INDEX: got wrong size");
+			memcpy(&idx, ibuf_data(&ibuf), datalen);
+			if (!seekidx_valid(&idx, datalen))
+				fatalx("IMSG_INDEX: got an invalid index");
+			seekidx_store(&idx);
+			break;
 		case IMSG_EOF:
+			if (imsg_get_data(&imsg, &next, sizeof(next)) == -1)
+				fatalx("IMSG_EOF: got wrong size");
+
+			/* about a track that was already replaced or stopped */
+			if (imsg_get_id(&imsg) != current_id) {
+				log_debug("ignoring stale EOF for track %u",
+				    imsg_get_id(&imsg));
+				break;
+			}
+
+			if (next != 0 && next == preload_id) {
+				main_playlist_follow();
+				break;
+			}
+
+			/*
+			 * The player moved on to a track that was taken
+			 * back, the IMSG_UNQUEUE came too late: replace it
+			 * with the right one.
+			 */
+			if (next != 0)
+				log_debug("player moved to unqueued track %u",
+				    next);
 			if (repeat_one && main_play_song(current_song))
 				break;
 			else if (repeat_one || consume)
-				playlist_dropcurrent();
+				main_dropcurrent();
 			main_playlist_advance();
 			if (play_state == STATE_PLAYING)
 				control_notify(IMSG_CTL_NEXT);
@@ -236,12 +291,56 @@ exec:
 	fatal("execvp %s", argv0);
 }
 
+/*
+ * Open a file in the cache directory, creating both if needed.  It
+ * has to be done before pledge(2).
+ */
+static int
+main_open_cache(const char *name)
+{
+	char		 dir[PATH_MAX], path[PATH_MAX];
+	const char	*base;
+	int		 fd, r;
+
+	if ((base = getenv("XDG_CACHE_HOME")) != NULL && *base != '\0')
+		r = snprintf(dir, sizeof(dir), "%s", base);
+	else if ((base = getenv("HOME")) != NULL && *base != '\0')
+		r = snprintf(dir, sizeof(dir), "%s/.cache", base);
+	else
+		return -1;
+	if (r < 0 || (size_t)r >= sizeof(dir))
+		return -1;
+
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		log_warn("mkdir %s", dir);
+		return -1;
+	}
+
+	if (strlcat(dir, "/amused", sizeof(dir)) >= sizeof(dir))
+		return -1;
+
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+		log_warn("mkdir %s", dir);
+		return -1;
+	}
+
+	r = snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (r < 0 || (size_t)r >= sizeof(path))
+		return -1;
+
+	if ((fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0600)) == -1) {
+		log_warn("open %s", path);
+		return -1;
+	}
+	return fd;
+}
+
 /* daemon main routine */
 static __dead void
 amused_main(void)
 {
 	int	 pipe_main2player[2];
-	int	 control_fd, flags;
+	int	 control_fd, cache_fd, state_fd, flags;
 
 	log_init(debug, LOG_DAEMON);
 	log_setverbose(verbose);
@@ -288,7 +387,19 @@ amused_main(void)
 		fatal("control socket setup failed %s", csock);
 	control_listen(control_fd);
 
-	if (pledge("stdio rpath unix sendfd", NULL) == -1)
+	if ((cache_fd = main_open_cache("seekidx")) != -1)
+		seekidx_init(cache_fd);
+	if ((cache_fd = main_open_cache("state.0")) != -1) {
+		if ((state_fd = main_open_cache("state.1")) != -1)
+			state_init(cache_fd, state_fd, &resume_at);
+		else
+			close(cache_fd);
+	}
+	watch_init(main_open_cache("watch"));
+	if ((cache_fd = main_open_cache("library")) != -1)
+		library_init(cache_fd);
+
+	if (pledge("stdio rpath unix sendfd recvfd", NULL) == -1)
 		fatal("pledge");
 
 	log_info("startup");
@@ -372,7 +483,7 @@ imsg_event_add(struct imsgev *iev)
 	if (imsgbuf_queuelen(&iev->imsgbuf))
 		iev->events |= EV_WRITE;
 
-	ev_add(iev->imsgbuf.fd, iev->events, iev->handler, iev);
+	ev_mod(iev->imsgbuf.fd, iev->events);
 }
 
 int
@@ -391,50 +502,169 @@ imsg_compose_event(struct imsgev *iev, uint16_t type, uint32_t peerid,
 int
 main_send_player(uint16_t type, int fd, const void *data, size_t len)
 {
+	/* what the player says about the old track is stale now */
+	if (type == IMSG_STOP)
+		current_id = 0;
+
 	return imsg_compose_event(iev_player, type, 0, 0, fd, data, len);
 }
 
-int
-main_play_song(const char *path)
+static int
+main_open_song(const char *path, struct stat *sb)
 {
-	struct stat sb;
 	int fd;
 
 	if ((fd = open(path, O_RDONLY)) == -1) {
 		log_warn("open %s", path);
-		return 0;
+		return -1;
 	}
 
-	if (fstat(fd, &sb) == -1) {
+	if (fstat(fd, sb) == -1) {
 		log_warn("failed to stat %s", path);
 		close(fd);
-		return 0;
+		return -1;
 	}
 
-	if (!S_ISREG(sb.st_mode)) {
+	if (!S_ISREG(sb->st_mode)) {
 		log_info("skipping non-regular file: %s", path);
 		close(fd);
-		return 0;
+		return -1;
 	}
 
+	return fd;
+}
+
+/* send the song along with its seek index, if any */
+static void
+main_send_song(int type, uint32_t id, int fd, const struct stat *sb)
+{
+	const struct seekidx	*idx;
+	size_t			 len = 0;
+
+	if ((idx = seekidx_lookup(sb)) != NULL)
+		len = SEEKIDX_SIZE(idx->nent);
+	imsg_compose_event(iev_player, type, id, 0, fd, idx, len);
+}
+
+/* ids tell apart the tracks handed to the player; 0 is never used */
+static uint32_t
+main_newid(void)
+{
+	static uint32_t	 id;
+
+	if (++id == 0)
+		id = 1;
+	return id;
+}
+
+int
+main_play_song(const char *path)
+{
+	struct stat sb;
+	int fd;
+
+	if ((fd = main_open_song(path, &sb)) == -1)
+		return 0;
+
 	play_state = STATE_PLAYING;
-	main_send_player(IMSG_PLAY, fd, NULL, 0);
+	current_id = main_newid();
+	main_send_song(IMSG_PLAY, current_id, fd, &sb);
+	resume_at = -1;
+
+	/* the player forgets what was queued */
+	free(preload_path);
+	preload_path = NULL;
+	preload_id = 0;
+	main_preload();
 	return 1;
 }
 
+/*
+ * Give the player the track that comes after the current one so that
+ * it can start decoding it before the current one ends.  If the next
+ * track changed since the last call, the old one is taken back.
+ */
 void
-main_playlist_jump(struct imsgev *iev, struct imsg *imsg)
+main_preload(void)
 {
-	char arg[PATH_MAX];
-	const char *song;
+	struct stat	 sb;
+	const char	*song = NULL;
+	char		 path[PATH_MAX];
+	int		 fd;
 
-	if (imsg_get_data(imsg, arg, sizeof(arg)) == -1) {
-		main_senderr(iev, "wrong size");
+	if (play_state != STATE_STOPPED && current_song != NULL)
+		song = repeat_one ? current_song :
+		    playlist_peek(path, sizeof(path));
+
+	if (preload_path != NULL) {
+		if (song != NULL && !strcmp(song, preload_path))
+			return;
+		if (play_state != STATE_STOPPED)
+			main_send_player(IMSG_UNQUEUE, -1, NULL, 0);
+		free(preload_path);
+		preload_path = NULL;
+		preload_id = 0;
+	}
+
+	if (song == NULL || (fd = main_open_song(song, &sb)) == -1)
 		return;
+
+	preload_id = main_newid();
+	preload_path = xstrdup(song);
+	main_send_song(IMSG_QUEUE, preload_id, fd, &sb);
+}
+
+/*
+ * The player moved on its own to the track that was preloaded: bring
+ * the playlist in sync.
+ */
+void
+main_playlist_follow(void)
+{
+	current_id = preload_id;
+	free(preload_path);
+	preload_path = NULL;
+	preload_id = 0;
+
+	if (!repeat_one) {
+		if (consume)
+			main_dropcurrent();
+		if (playlist_advance() == NULL) {
+			main_send_player(IMSG_STOP, -1, NULL, 0);
+			control_notify(IMSG_CTL_STOP);
+			return;
+		}
+		control_notify(IMSG_CTL_NEXT);
 	}
 
-	if (arg[sizeof(arg)-1] != '\0') {
-		main_senderr(iev, "data corrupted");
+	main_preload();
+}
+
+/*
+ * Copy the path sent with IMSG_CTL_ADD or IMSG_CTL_JUMP in the given
+ * PATH_MAX-sized buffer.  Returns its length, or -1 if it's malformed.
+ */
+static ssize_t
+main_get_path(struct imsg *imsg, char *path)
+{
+	size_t	 len;
+
+	len = imsg_get_len(imsg);
+	if (len == 0 || len > PATH_MAX ||
+	    imsg_get_data(imsg, path, len) == -1 ||
+	    path[len - 1] != '\0')
+		return -1;
+	return strlen(path);
+}
+
+void
+main_playlist_jump(struct imsgev *iev, struct imsg *imsg)
+{
+	char arg[PATH_MAX];
+	const char *song;
+
+	if (main_get_path(imsg, arg) == -1) {
+		main_senderr(iev, "malformed data");
 		return;
 	}
 
@@ -449,7 +679,7 @@ main_playlist_jump(struct imsgev *iev, struct imsg *imsg)
 	main_send_player(IMSG_STOP, -1, NULL, 0);
 	if (!main_play_song(song)) {
 		main_senderr(iev, "can't play");
-		playlist_dropcurrent();
+		main_dropcurrent();
 		main_playlist_advance();
 		return;
 	}
@@ -460,16 +690,27 @@ main_playlist_jump(struct imsgev *iev, struct imsg *imsg)
 void
 main_playlist_resume(void)
 {
+	struct player_seek s;
 	const char *song;
 
-	if ((song = current_song) == NULL)
+	memset(&s, 0, sizeof(s));
+	s.offset = resume_at;
+
+	if ((song = current_song) == NULL) {
+		s.offset = 0;
 		song = playlist_advance();
+	}
 
 	for (; song != NULL; song = playlist_advance()) {
-		if (main_play_song(song))
+		if (main_play_song(song)) {
+			if (s.offset > 0)
+				main_send_player(IMSG_CTL_SEEK, -1, &s,
+				    sizeof(s));
 			return;
+		}
 
-		playlist_dropcurrent();
+		main_dropcurrent();
+		s.offset = 0;
 	}
 }
 
@@ -486,7 +727,7 @@ main_playlist_advance(void)
 		if (main_play_song(song))
 			break;
 
-		playlist_dropcurrent();
+		main_dropcurrent();
 	}
 }
 
@@ -503,10 +744,23 @@ main_playlist_previous(void)
 		if (main_play_song(song))
 			break;
 
-		playlist_dropcurrent();
+		main_dropcurrent();
 	}
 }
 
+/*
+ * Remove the current song, keeping the state file in sync.
+ */
+void
+main_dropcurrent(void)
+{
+	if (play_off == -1 || playlist_isdead(&playlist, play_off))
+		return;
+
+	state_drop(playlist_pos(&playlist, play_off));
+	playlist_dropcurrent();
+}
+
 void
 main_senderr(struct imsgev *iev, const char *msg)
 {
@@ -514,43 +768,221 @@ main_senderr(struct imsgev *iev, const char *msg)
 	    msg, strlen(msg)+1);
 }
 
-void
-main_enqueue(int tx, struct playlist *px, struct imsgev *iev,
+/*
+ * Add the path to the playlist, or to px if in a transaction.  With
+ * unique, it's skipped if already there.  Returns 1 if it was added.
+ */
+int
+main_enqueue(int tx, int unique, struct playlist *px, struct imsgev *iev,
     struct imsg *imsg)
 {
 	char path[PATH_MAX];
-	const char *err = NULL;
+	ssize_t len;
 
-	if (imsg_get_data(imsg, path, sizeof(path)) == -1) {
-		err = "data size mismatch";
-		goto err;
+	if ((len = main_get_path(imsg, path)) == -1) {
+		main_senderr(iev, "malformed data");
+		return 0;
 	}
 
-	if (path[sizeof(path)-1] != '\0') {
-		err = "malformed data";
-		goto err;
+	if (unique && playlist_find(tx ? px : &playlist, path) != -1) {
+		imsg_compose_event(iev, IMSG_CTL_ADD, 0, 0, -1, NULL, 0);
+		return 0;
 	}
 
 	if (tx)
 		playlist_push(px, path);
 	else
 		playlist_enqueue(path);
-	imsg_compose_event(iev, IMSG_CTL_ADD, 0, 0, -1, path, sizeof(path));
-	return;
-err:
-	main_senderr(iev, err);
+	imsg_compose_event(iev, IMSG_CTL_ADD, 0, 0, -1, path, len + 1);
+	return 1;
+}
+
+/*
+ * Read the whole content of the file sent with IMSG_CTL_LOAD.  Doesn't
+ * use mmap(2) since the client could truncate it under our feet.
+ */
+static char *
+main_read_fd(int fd, size_t *len)
+{
+	struct stat	 sb;
+	char		*buf;
+	size_t		 off = 0;
+	ssize_t		 r;
+
+	if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) ||
+	    (uintmax_t)sb.st_size >= SIZE_MAX)
+		return NULL;
+
+	*len = sb.st_size;
+	if ((buf = malloc(*len + 1)) == NULL)
+		return NULL;
+
+	while (off < *len) {
+		if ((r = pread(fd, buf + off, *len - off, off)) == -1) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return NULL;
+		}
+		if (r == 0)
+			break;
+		off += r;
+	}
+
+	*len = off;
+	return buf;
+}
+
+int
+main_load(struct imsgev *iev, struct imsg *imsg)
+{
+	struct playlist	 pl;
+	char		*buf;
+	size_t		 len;
+	ssize_t		 off;
+	int		 fd;
+
+	if (imsg_get_data(imsg, &off, sizeof(off)) == -1) {
+		main_senderr(iev, "wrong size");
+		return -1;
+	}
+
+	if ((fd = imsg_get_fd(imsg)) == -1) {
+		main_senderr(iev, "missing fd");
+		return -1;
+	}
+
+	buf = main_read_fd(fd, &len);
+	close(fd);
+	if (buf == NULL) {
+		log_warn("%s: can't read the playlist", __func__);
+		main_senderr(iev, "can't read the playlist");
+		return -1;
+	}
+
+	if (playlist_decode(&pl, buf, len) == -1) {
+		free(buf);
+		main_senderr(iev, "malformed data");
+		return -1;
+	}
+	free(buf);
+
+	playlist_swap(&pl, off);
+	main_preload();
+	imsg_compose_event(iev, IMSG_CTL_COMMIT, 0, 0, -1, NULL, 0);
+	return 0;
+}
+
+int
+main_loadfile(struct imsgev *iev, struct imsg *imsg)
+{
+	struct playlist	 pl;
+	struct stat	 sb;
+	char		 path[PATH_MAX], dir[PATH_MAX], msg[128];
+	char		*s;
+	ssize_t		 curr;
+	int		 fd;
+
+	if (main_get_path(imsg, path) == -1 || *path != '/') {
+		main_senderr(iev, "malformed data");
+		return -1;
+	}
+
+	if (isfdpath(path)) {
+		main_senderr(iev, "not a regular file");
+		return -1;
+	}
+
+	/* don't hang on a fifo nobody writes to */
+	if ((fd = open(path, O_RDONLY|O_NONBLOCK|O_CLOEXEC)) == -1) {
+		log_warn("open %s", path);
+		(void)snprintf(msg, sizeof(msg), "can't open the playlist: %s",
+		    strerror(errno));
+		main_senderr(iev, msg);
+		return -1;
+	}
+
+	if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+		close(fd);
+		main_senderr(iev, "not a regular file");
+		return -1;
+	}
+
+	/* relative entries are relative to the playlist */
+	memcpy(dir, path, sizeof(dir));
+	s = strrchr(dir, '/');
+	*s = '\0';
+
+	if (playlist_parse(&pl, fd, dir, &curr) == -1) {
+		log_warn("read %s", path);
+		close(fd);
+		main_senderr(iev, "can't read the playlist");
+		return -1;
+	}
+	close(fd);
+
+	playlist_swap(&pl, curr);
+	main_preload();
+	imsg_compose_event(iev, IMSG_CTL_COMMIT, 0, 0, -1, NULL, 0);
+	return 0;
+}
+
+static void
+main_send_entry(struct imsgev *iev, const char *path, int status)
+{
+	struct player_entry e;
+	struct ibuf *wbuf;
+	size_t len;
+
+	len = strlen(path) + 1;
+	if (len > PATH_MAX)
+		len = PATH_MAX;
+
+	memset(&e, 0, sizeof(e));
+	e.status = status;
+
+	/* imsg_add frees wbuf on failure */
+	wbuf = imsg_create(&iev->imsgbuf, IMSG_CTL_SHOW, 0, 0,
+	    sizeof(e) + len);
+	if (wbuf == NULL ||
+	    imsg_add(wbuf, &e, sizeof(e)) == -1 ||
+	    imsg_add(wbuf, path, len - 1) == -1 ||
+	    imsg_add(wbuf, "", 1) == -1) {
+		log_warn("%s", __func__);
+		return;
+	}
+	imsg_close(&iev->imsgbuf, wbuf);
 }
 
 void
-main_send_playlist(struct imsgev *iev)
+main_send_playlist(struct imsgev *iev, int flags)
 {
 	struct player_status s;
 	size_t i;
+	int fd, status;
+	char path[PATH_MAX];
+
+	if ((flags & SHOW_SNAPSHOT) && (fd = playlist_snapshot()) != -1) {
+		imsg_compose_event(iev, IMSG_CTL_SHOW, 0, 0, fd, NULL, 0);
+		imsg_compose_event(iev, IMSG_CTL_SHOW, 0, 0, -1, NULL, 0);
+		return;
+	}
 
 	for (i = 0; i < playlist.len; ++i) {
+		if (playlist_isdead(&playlist, i))
+			continue;
+		status = play_off == i ? STATE_PLAYING : STATE_STOPPED;
+		if (flags & SHOW_VARLEN) {
+			if (playlist_get(&playlist, i, path,
+			    sizeof(path)) != NULL)
+				main_send_entry(iev, path, status);
+			continue;
+		}
+
 		memset(&s, 0, sizeof(s));
-		strlcpy(s.path, playlist.songs[i], sizeof(s.path));
-		s.status = play_off == i ? STATE_PLAYING : STATE_STOPPED;
+		if (playlist_get(&playlist, i, s.path, sizeof(s.path)) == NULL)
+			continue;
+		s.status = status;
 		imsg_compose_event(iev, IMSG_CTL_SHOW, 0, 0, -1, &s,
 		    sizeof(s));
 	}
@@ -558,6 +990,56 @@ main_send_playlist(struct imsgev *iev)
 	imsg_compose_event(iev, IMSG_CTL_SHOW, 0, 0, -1, NULL, 0);
 }
 
+void
+main_search(struct imsgev *iev, struct imsg *imsg)
+{
+	struct player_search	 q;
+	struct player_match	 pm;
+	struct plmatch		*m;
+	struct ibuf		 ibuf, *wbuf;
+	char			 pat[PATH_MAX], path[PATH_MAX];
+	size_t			 i, n, len;
+
+	if (imsg_get_ibuf(imsg, &ibuf) == -1 ||
+	    ibuf_get(&ibuf, &q, sizeof(q)) == -1 ||
+	    (len = ibuf_size(&ibuf)) == 0 || len > sizeof(pat) ||
+	    ibuf_get(&ibuf, pat, len) == -1 || pat[len - 1] != '\0' ||
+	    q.count <= 0) {
+		main_senderr(iev, "malformed data");
+		return;
+	}
+
+	if (q.count > SEARCH_MAX)
+		q.count = SEARCH_MAX;
+	m = xcalloc(q.count, sizeof(*m));
+	n = playlist_search(&playlist, pat, m, q.count);
+
+	for (i = 0; i < n; ++i) {
+		if (playlist_get(&playlist, m[i].off, path,
+		    sizeof(path)) == NULL)
+			continue;
+		len = strlen(path) + 1;
+
+		memset(&pm, 0, sizeof(pm));
+		pm.offset = m[i].pos;
+		pm.score = m[i].score;
+
+		/* imsg_add frees wbuf on failure */
+		wbuf = imsg_create(&iev->imsgbuf, IMSG_CTL_SEARCH, 0, 0,
+		    sizeof(pm) + len);
+		if (wbuf == NULL ||
+		    imsg_add(wbuf, &pm, sizeof(pm)) == -1 ||
+		    imsg_add(wbuf, path, len) == -1) {
+			log_warn("%s", __func__);
+			break;
+		}
+		imsg_close(&iev->imsgbuf, wbuf);
+	}
+	free(m);
+
+	imsg_compose_event(iev, IMSG_CTL_SEARCH, 0, 0, -1, NULL, 0);
+}
+
 void
 main_send_status(struct imsgev *iev)
 {
@@ -573,6 +1055,7 @@ main_send_status(struct imsgev *iev)
 	s.mode.repeat_all = repeat_all;
 	s.mode.repeat_one = repeat_one;
 	s.mode.consume = consume;
+	s.mode.random = random_mode;
 	s.info.bits = current_status.info.bits;
 	s.info.rate = current_status.info.rate;
 	s.info.chan = current_status.info.chan;
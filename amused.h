@@ -31,7 +31,7 @@ enum imsg_type {
 	IMSG_PAUSE,
 	IMSG_STOP,
 	IMSG_META,
-	IMSG_EOF,
+	IMSG_EOF,		/* uint32_t id of the next track */
 	IMSG_ERR,		/* error string */
 
 	IMSG_CTL_PLAY,		/* with optional filename */
@@ -39,11 +39,11 @@ enum imsg_type {
 	IMSG_CTL_PAUSE,
 	IMSG_CTL_STOP,
 	IMSG_CTL_FLUSH,
-	IMSG_CTL_SHOW,
+	IMSG_CTL_SHOW,		/* optional int flags */
 	IMSG_CTL_STATUS,
 	IMSG_CTL_NEXT,
 	IMSG_CTL_PREV,
-	IMSG_CTL_JUMP,
+	IMSG_CTL_JUMP,		/* path */
 	IMSG_CTL_MODE,		/* struct player_mode */
 	IMSG_CTL_SEEK,		/* struct player_seek */
 	IMSG_CTL_SHUFFLE,	/* int all */
@@ -55,6 +55,17 @@ enum imsg_type {
 	IMSG_CTL_MONITOR,	/* struct player_event */
 
 	IMSG_CTL_ERR,
+	IMSG_CTL_LOAD,		/* fd + offset of the track to jump to */
+	IMSG_CTL_SEARCH,	/* struct player_search + pattern */
+	IMSG_CTL_ADD_UNIQUE,	/* path, unless already enqueued */
+	IMSG_CTL_LOADFILE,	/* path of a playlist file */
+	IMSG_CTL_SCAN,		/* directories to index */
+	IMSG_CTL_FIND,		/* struct player_find + terms */
+	IMSG_CTL_WATCH,		/* struct player_watch + folders */
+
+	IMSG_QUEUE,		/* fd of the track to play next */
+	IMSG_UNQUEUE,
+	IMSG_INDEX,		/* struct seekidx */
 	IMSG__LAST,
 };
 
@@ -83,6 +94,10 @@ enum actions {
 	MONITOR,
 	SEEK,
 	SHUFFLE,
+	SEARCH,
+	SCAN,
+	FIND,
+	WATCH,
 };
 
 struct player_seek {
@@ -101,6 +116,7 @@ struct player_mode {
 	int	repeat_one;
 	int	repeat_all;
 	int	consume;
+	int	random;
 };
 
 struct player_info {
@@ -118,6 +134,85 @@ struct player_status {
 	struct player_info	info;
 };
 
+/*
+ * The paths in IMSG_CTL_ADD and IMSG_CTL_JUMP are NUL-terminated and
+ * at most PATH_MAX bytes long, including the NUL.  Older clients send
+ * exactly PATH_MAX bytes padded with NULs, which is still accepted.
+ *
+ * Clients that pass SHOW_VARLEN with IMSG_CTL_SHOW get every entry as
+ * a struct player_entry followed by the NUL-terminated path, instead
+ * of a whole struct player_status.  With SHOW_SNAPSHOT the daemon may
+ * instead reply with a single IMSG_CTL_SHOW carrying the fd of a read
+ * only struct playlist_snapshot.  In both cases, an empty message ends
+ * the reply.
+ *
+ * IMSG_CTL_LOAD replaces the playlist in one go: the fd holds all the
+ * paths, each one NUL-terminated, and is read from the start.
+ *
+ * IMSG_CTL_LOADFILE makes the daemon read the playlist file itself,
+ * then it's answered like IMSG_CTL_LOAD.
+ *
+ * IMSG_CTL_ADD_UNIQUE is like IMSG_CTL_ADD, but the path is skipped if
+ * it's already in the playlist.  The reply is an IMSG_CTL_ADD with the
+ * path, or an empty one if it was skipped.
+ *
+ * IMSG_CTL_SEARCH is answered with up to count matches, best first,
+ * each one as a struct player_match followed by the NUL-terminated
+ * path, and then an empty message.
+ *
+ * IMSG_CTL_SCAN carries the NUL-terminated absolute paths of the
+ * directories to index, or nothing to scan again the previous ones.
+ * It's answered once the scan is done with an IMSG_CTL_SCAN with the
+ * number of tracks in the library as uint64_t.
+ *
+ * IMSG_CTL_FIND is a struct player_find followed by the NUL-terminated
+ * terms of the query, all of which have to match: "field=value" for
+ * an exact match, "field~value" for a substring, both ignoring case,
+ * or just a word to look for in the path, title, artist and album.
+ * The matching tracks are enqueued or, with list set, sent back each
+ * one in an IMSG_CTL_FIND as a struct player_track followed by the
+ * path, title, artist, album and codec, all NUL-terminated.  The last
+ * IMSG_CTL_FIND carries the number of matches as uint64_t.
+ *
+ * IMSG_CTL_WATCH is a struct player_watch followed by the absolute
+ * paths of the watch folders to add, NUL-terminated, after removing
+ * all the previous ones if clear is set.  The new tracks found in the
+ * watch folders while updating the library are enqueued.  The reply
+ * is an IMSG_CTL_WATCH with all the current watch folders.
+ */
+#define SHOW_VARLEN	0x1
+#define SHOW_SNAPSHOT	0x2
+
+#define SEARCH_MAX	1000
+
+struct player_search {
+	int			count;
+};
+
+struct player_match {
+	int64_t			offset;	/* position in the playlist */
+	int			score;
+};
+
+struct player_entry {
+	int			status;
+};
+
+struct player_find {
+	int			list;
+};
+
+struct player_watch {
+	int			clear;
+};
+
+struct player_track {
+	uint32_t		track;
+	uint32_t		duration;	/* seconds */
+	uint32_t		rate;
+	uint32_t		pad;
+};
+
 struct player_event {
 	int			 event;
 	int64_t			 position;
@@ -136,13 +231,20 @@ int		imsg_compose_event(struct imsgev *, uint16_t, uint32_t,
 		    pid_t, int, const void *, uint16_t);
 int		main_send_player(uint16_t, int, const void *, size_t);
 int		main_play_song(const char *);
+void		main_preload(void);
 void		main_playlist_jump(struct imsgev *, struct imsg *);
 void		main_playlist_resume(void);
 void		main_playlist_advance(void);
+void		main_playlist_follow(void);
 void		main_playlist_previous(void);
+void		main_dropcurrent(void);
 void		main_senderr(struct imsgev *, const char *);
-void		main_enqueue(int, struct playlist *, struct imsgev *, struct imsg *);
-void		main_send_playlist(struct imsgev *);
+int		main_enqueue(int, int, struct playlist *, struct imsgev *,
+		    struct imsg *);
+int		main_load(struct imsgev *, struct imsg *);
+int		main_loadfile(struct imsgev *, struct imsg *);
+void		main_search(struct imsgev *, struct imsg *);
+void		main_send_playlist(struct imsgev *, int);
 void		main_send_status(struct imsgev *);
 void		main_seek(struct player_seek *);
 
@@ -157,6 +157,13 @@ audio_flush(void)
 		return -1;
 	}
 
+	/* be ready to accept new frames right away */
+	err = snd_pcm_prepare(pcm);
+	if (err < 0) {
+		log_warnx("snd_pcm_prepare: %s", snd_strerror(err));
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A backend that throws the samples away, useful to measure the
+ * decoders and to run amused where there's no sound card.  By default
+ * it accepts everything as fast as it can; if AMUSED_NULL is set to
+ * "realtime" it emulates a device that plays at the given rate, with
+ * a small buffer, and calls onmove as the samples are "played".
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "audio.h"
+#include "log.h"
+
+/* the emulated device buffer and clock resolution, in ms */
+#define NULL_BUFMS	100
+#define NULL_TICKMS	10
+
+static void		(*onmove_cb)(void *, int);
+static int		 realtime;
+static int		 pipefd[2] = { -1, -1 };
+static pthread_t	 ticker;
+
+static unsigned int	 rate;
+static size_t		 bpf;
+
+/* emulated device clock */
+static int		 running;
+static struct timespec	 t0;
+static int64_t		 written;	/* frames since t0 */
+static int64_t		 moved;		/* frames reported to onmove */
+
+/* statistics */
+static struct timespec	 ts_start;
+static uint64_t		 consumed;
+
+static int64_t
+elapsed_ns(struct timespec *since)
+{
+	struct timespec	 now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000000LL +
+	    (now.tv_nsec - since->tv_nsec);
+}
+
+static void
+null_report(void)
+{
+	double	 sec;
+
+	if (consumed == 0)
+		return;
+
+	sec = elapsed_ns(&ts_start) / 1e9;
+	log_info("null: %llu bytes in %.3fs, %.0f bytes/sec",
+	    (unsigned long long)consumed, sec, sec > 0 ? consumed / sec : 0);
+	consumed = 0;
+}
+
+/* wake up the output thread at every clock tick */
+static void *
+tick(void *arg)
+{
+	struct timespec	 ts = { 0, NULL_TICKMS * 1000000L };
+	char		 ch = 1;
+
+	for (;;) {
+		nanosleep(&ts, NULL);
+		if (write(pipefd[1], &ch, 1) == -1 && errno != EAGAIN)
+			break;
+	}
+	return NULL;
+}
+
+/* advance the emulated device clock and report the played frames */
+static void
+null_move(void)
+{
+	int64_t	 ns, pos;
+
+	if (!running)
+		return;
+
+	ns = elapsed_ns(&t0);
+	pos = ns / 1000000000LL * rate +
+	    ns % 1000000000LL * rate / 1000000000LL;
+
+	/* underrun: the clock stops until more samples arrive */
+	if (pos >= written) {
+		pos = written;
+		running = 0;
+	}
+
+	if (pos > moved) {
+		onmove_cb(NULL, pos - moved);
+		moved = pos;
+	}
+}
+
+int
+audio_open(void (*cb)(void *, int))
+{
+	const char	*mode;
+	char		 ch = 1;
+	int		 fl;
+
+	onmove_cb = cb;
+
+	if ((mode = getenv("AMUSED_NULL")) != NULL &&
+	    !strcmp(mode, "realtime"))
+		realtime = 1;
+
+	if (pipe(pipefd) == -1)
+		return -1;
+
+	if ((fl = fcntl(pipefd[0], F_GETFL)) == -1 ||
+	    fcntl(pipefd[0], F_SETFL, fl | O_NONBLOCK) == -1 ||
+	    (fl = fcntl(pipefd[1], F_GETFL)) == -1 ||
+	    fcntl(pipefd[1], F_SETFL, fl | O_NONBLOCK) == -1)
+		return -1;
+
+	if (!realtime) {
+		/* never drained: the fd is always ready */
+		if (write(pipefd[1], &ch, 1) == -1)
+			return -1;
+	} else if ((errno = pthread_create(&ticker, NULL, tick, NULL)) != 0)
+		return -1;
+
+	atexit(null_report);
+	return 0;
+}
+
+int
+audio_setup(unsigned int bits, unsigned int r, unsigned int channels,
+    struct pollfd *pfds, int nfds)
+{
+	if (bits == 8)
+		bpf = 1;
+	else if (bits == 16)
+		bpf = 2;
+	else if (bits == 24 || bits == 32)
+		bpf = 4;
+	else {
+		log_warnx("can't handle %d bits", bits);
+		return -1;
+	}
+	bpf *= channels;
+
+	if (r == 0 || channels == 0) {
+		log_warnx("invalid params (bits=%u, rate=%u, channels=%u)",
+		    bits, r, channels);
+		return -1;
+	}
+
+	null_move();
+	running = 0;
+	rate = r;
+	return 0;
+}
+
+int
+audio_nfds(void)
+{
+	return 1;
+}
+
+int
+audio_pollfd(struct pollfd *pfds, int nfds, int events)
+{
+	if (nfds != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pfds[0].fd = pipefd[0];
+	pfds[0].events = POLLIN;
+	return 0;
+}
+
+int
+audio_revents(struct pollfd *pfds, int nfds)
+{
+	char	 buf[64];
+
+	if (nfds != 1) {
+		log_warnx("%s: called with nfds=%d", __func__, nfds);
+		return 0;
+	}
+
+	if (!realtime)
+		return POLLOUT;
+
+	if (pfds[0].revents & POLLIN)
+		while (read(pipefd[0], buf, sizeof(buf)) > 0)
+			/* nop */ ;
+
+	null_move();
+	if (!running || written - moved < (int64_t)rate * NULL_BUFMS / 1000)
+		return POLLOUT;
+	return 0;
+}
+
+size_t
+audio_write(const void *buf, size_t len)
+{
+	int64_t	 n, space;
+
+	if (bpf == 0 || (n = len / bpf) == 0)
+		return 0;
+
+	if (consumed == 0)
+		clock_gettime(CLOCK_MONOTONIC, &ts_start);
+
+	if (!realtime) {
+		consumed += n * bpf;
+		onmove_cb(NULL, n);
+		return n * bpf;
+	}
+
+	null_move();
+	if (!running) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		running = 1;
+		written = moved = 0;
+	}
+
+	space = (int64_t)rate * NULL_BUFMS / 1000 - (written - moved);
+	if (space <= 0)
+		return 0;
+	if (n > space)
+		n = space;
+
+	written += n;
+	consumed += n * bpf;
+	return n * bpf;
+}
+
+int
+audio_flush(void)
+{
+	running = 0;
+	null_report();
+	return 0;
+}
+
+int
+audio_stop(void)
+{
+	return audio_flush();
+}
@@ -116,6 +116,15 @@ audio_revents(struct pollfd *pfds, int nfds)
 size_t
 audio_write(const void *buf, size_t len)
 {
+	/* restart after a flush */
+	if (stopped) {
+		if (!sio_start(hdl)) {
+			log_warn("sio_start");
+			return 0;
+		}
+		stopped = 0;
+	}
+
 	return sio_write(hdl, buf, len);
 }
 
@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Run the decoders against a sink that throws away the samples and
+ * report, for every file, one line of tab-separated values:
+ *
+ *	file format rate chans bits secs rtf cpu_ms maxrss_kb seek_ms
+ *
+ * where rtf is how many seconds of audio are decoded per second, cpu_ms
+ * the CPU time spent per second of audio, maxrss_kb the peak resident
+ * set size and seek_ms the mean time between a seek request and the
+ * first buffer at the new position.  Every file is decoded in a child
+ * process, so that the resource usage is not mixed.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "pcm.h"
+#include "player.h"
+#include "seekidx.h"
+#include "xmalloc.h"
+
+/* number of seeks done, evenly spaced through the file */
+#define NSEEK	8
+
+struct result {
+	unsigned int	 bits;
+	unsigned int	 rate;
+	unsigned int	 chans;
+	int64_t		 frames;
+	double		 wall;
+	double		 cpu;
+	double		 seek_ms;
+	char		 err[128];
+};
+
+static struct result	 res;
+static size_t		 frame = 1;
+static int64_t		 duration;
+
+static int		 seeking;
+static int		 nseek;
+static int		 seek_pending;
+static struct timespec	 seek_ts;
+static double		 seek_tot;
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+cputime(void)
+{
+	struct rusage	 ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		fatal("getrusage");
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* the player.h interface used by the decoders */
+
+int
+player_setup(unsigned int bits, unsigned int rate, unsigned int chans)
+{
+	res.bits = bits;
+	res.rate = rate;
+	res.chans = chans;
+	frame = pcm_bps(bits) * chans;
+	return 0;
+}
+
+void
+player_setduration(int64_t d)
+{
+	duration = d;
+}
+
+struct seekidx *
+player_getidx(int fd, int type)
+{
+	struct seekidx	*idx;
+	struct stat	 sb;
+
+	idx = xcalloc(1, sizeof(*idx));
+	idx->length = -1;
+	if (fstat(fd, &sb) == -1)
+		return idx;
+
+	idx->dev = sb.st_dev;
+	idx->ino = sb.st_ino;
+	idx->size = sb.st_size;
+	idx->mtime = sb.st_mtime;
+	idx->type = type;
+	return idx;
+}
+
+void
+player_putidx(struct seekidx *idx)
+{
+	free(idx);
+}
+
+void
+player_setpos(int64_t pos)
+{
+	return;
+}
+
+int
+play(const void *buf, size_t len, int64_t *s)
+{
+	struct timespec	 ts;
+
+	*s = -1;
+	if (!seeking) {
+		res.frames += len / frame;
+		return 1;
+	}
+
+	if (seek_pending) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		seek_tot += (ts.tv_sec - seek_ts.tv_sec) * 1e3 +
+		    (ts.tv_nsec - seek_ts.tv_nsec) / 1e6;
+		seek_pending = 0;
+	}
+
+	if (nseek == NSEEK || duration <= 0)
+		return 0;
+
+	/* alternate forward and backward jumps */
+	nseek++;
+	if (nseek % 2)
+		*s = duration * (NSEEK - nseek) / NSEEK;
+	else
+		*s = duration * nseek / (NSEEK + 1);
+	seek_pending = 1;
+	clock_gettime(CLOCK_MONOTONIC, &seek_ts);
+	return 1;
+}
+
+static int (*
+decoder(const char *path, const char **fmt))(int, const char **)
+{
+	const char	*ext;
+
+	if ((ext = strrchr(path, '.')) == NULL)
+		ext = "";
+	*fmt = ext + (*ext == '.');
+
+	if (!strcasecmp(ext, ".wav"))
+		return play_wav;
+	if (!strcasecmp(ext, ".flac"))
+		return play_flac;
+	if (!strcasecmp(ext, ".mp3"))
+		return play_mp3;
+	if (!strcasecmp(ext, ".ogg") || !strcasecmp(ext, ".oga"))
+		return play_oggvorbis;
+	if (!strcasecmp(ext, ".opus"))
+		return play_opus;
+	return NULL;
+}
+
+static void
+run(const char *path, int (*fn)(int, const char **))
+{
+	const char	*errstr = NULL;
+	double		 t, c;
+	int		 fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		snprintf(res.err, sizeof(res.err), "open: %s",
+		    strerror(errno));
+		return;
+	}
+
+	c = cputime();
+	t = now();
+	if (fn(fd, &errstr) == -1) {
+		snprintf(res.err, sizeof(res.err), "%s",
+		    errstr ? errstr : "decoding failed");
+		return;
+	}
+	res.wall = now() - t;
+	res.cpu = cputime() - c;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		snprintf(res.err, sizeof(res.err), "open: %s",
+		    strerror(errno));
+		return;
+	}
+
+	seeking = 1;
+	if (fn(fd, &errstr) == -1) {
+		snprintf(res.err, sizeof(res.err), "seek: %s",
+		    errstr ? errstr : "decoding failed");
+		return;
+	}
+	res.seek_ms = nseek > 0 ? seek_tot / nseek : -1;
+}
+
+static int
+bench(const char *path)
+{
+	int		(*fn)(int, const char **);
+	struct rusage	 ru;
+	struct result	 r;
+	const char	*fmt;
+	double		 secs;
+	ssize_t		 n;
+	pid_t		 pid;
+	int		 p[2], status;
+
+	if ((fn = decoder(path, &fmt)) == NULL) {
+		log_warnx("%s: unknown format", path);
+		return -1;
+	}
+
+	if (pipe(p) == -1)
+		fatal("pipe");
+
+	switch (pid = fork()) {
+	case -1:
+		fatal("fork");
+	case 0:
+		close(p[0]);
+		run(path, fn);
+		if (write(p[1], &res, sizeof(res)) != sizeof(res))
+			_exit(1);
+		_exit(0);
+	}
+
+	close(p[1]);
+	memset(&r, 0, sizeof(r));
+	n = read(p[0], &r, sizeof(r));
+	close(p[0]);
+
+	if (wait4(pid, &status, 0, &ru) == -1)
+		fatal("wait4");
+
+	if (n != sizeof(r) || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		log_warnx("%s: decoder crashed", path);
+		return -1;
+	}
+	if (r.err[0] != '\0') {
+		log_warnx("%s: %s", path, r.err);
+		return -1;
+	}
+	if (r.rate == 0 || r.frames == 0) {
+		log_warnx("%s: no audio decoded", path);
+		return -1;
+	}
+
+	secs = (double)r.frames / r.rate;
+	printf("%s\t%s\t%u\t%u\t%u\t%.3f\t%.2f\t%.3f\t%ld\t",
+	    path, fmt, r.rate, r.chans, r.bits, secs,
+	    r.wall > 0 ? secs / r.wall : 0, r.cpu * 1000 / secs,
+	    (long)ru.ru_maxrss);
+	if (r.seek_ms < 0)
+		printf("-\n");
+	else
+		printf("%.3f\n", r.seek_ms);
+	fflush(stdout);
+	return 0;
+}
+
+static void
+put16(FILE *fp, uint16_t v)
+{
+	v = htole16(v);
+	fwrite(&v, 2, 1, fp);
+}
+
+static void
+put32(FILE *fp, uint32_t v)
+{
+	v = htole32(v);
+	fwrite(&v, 4, 1, fp);
+}
+
+/*
+ * Write a wav file with a few partials sweeping slowly and some
+ * noise, something the encoders have to do a bit of work for.
+ */
+static void
+generate(const char *path, int secs, unsigned int rate, unsigned int chans,
+    unsigned int bits)
+{
+	FILE		*fp;
+	uint32_t	 rnd = 1, u, len;
+	int64_t		 i, n;
+	double		 t, f, v, ph[4] = { 0 };
+	unsigned int	 c, k, bps = bits / 8;
+	int32_t		 s;
+
+	if (bits != 8 && bits != 16 && bits != 24 && bits != 32)
+		fatalx("unsupported bits: %u", bits);
+
+	if ((fp = fopen(path, "w")) == NULL)
+		fatal("fopen %s", path);
+
+	n = (int64_t)secs * rate;
+	len = n * chans * bps;
+
+	fwrite("RIFF", 1, 4, fp);
+	put32(fp, 36 + len);
+	fwrite("WAVEfmt ", 1, 8, fp);
+	put32(fp, 16);
+	put16(fp, 1);
+	put16(fp, chans);
+	put32(fp, rate);
+	put32(fp, rate * chans * bps);
+	put16(fp, chans * bps);
+	put16(fp, bits);
+	fwrite("data", 1, 4, fp);
+	put32(fp, len);
+
+	for (i = 0; i < n; ++i) {
+		t = (double)i / rate;
+		for (k = 0; k < 4; ++k) {
+			f = 110.0 * (k + 1) * (1 + 0.5 * (t / secs));
+			ph[k] += f / rate;
+			ph[k] -= (int)ph[k];
+		}
+
+		for (c = 0; c < chans; ++c) {
+			/* sawtooths, with a different phase per channel */
+			v = 0;
+			for (k = 0; k < 4; ++k) {
+				f = ph[k] + (double)c / chans;
+				v += f - (int)f - 0.5;
+			}
+			rnd = rnd * 1103515245 + 12345;
+			v = v * 0.2 + ((rnd >> 16) / 65536.0 - 0.5) * 0.05;
+
+			s = v * 2147483647.0;
+			switch (bits) {
+			case 8:
+				fputc(((s >> 24) + 128) & 0xff, fp);
+				break;
+			case 16:
+				put16(fp, s >> 16);
+				break;
+			case 24:
+				u = htole32(s >> 8);
+				fwrite(&u, 3, 1, fp);
+				break;
+			case 32:
+				put32(fp, s);
+				break;
+			}
+		}
+	}
+
+	if (fclose(fp) == EOF)
+		fatal("fclose %s", path);
+}
+
+static __dead void
+usage(void)
+{
+	fprintf(stderr, "usage: %s file ...\n", getprogname());
+	fprintf(stderr, "       %s [-b bits] [-c chans] [-d secs] [-r rate]"
+	    " -g file\n", getprogname());
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char	*errstr, *gen = NULL;
+	unsigned int	 bits = 16, chans = 2, rate = 44100;
+	int		 ch, secs = 60, ret = 0;
+
+	log_init(1, LOG_DAEMON);
+
+	while ((ch = getopt(argc, argv, "b:c:d:g:r:")) != -1) {
+		switch (ch) {
+		case 'b':
+			bits = strtonum(optarg, 8, 32, &errstr);
+			if (errstr != NULL)
+				fatalx("bits is %s: %s", errstr, optarg);
+			break;
+		case 'c':
+			chans = strtonum(optarg, 1, 8, &errstr);
+			if (errstr != NULL)
+				fatalx("chans is %s: %s", errstr, optarg);
+			break;
+		case 'd':
+			secs = strtonum(optarg, 1, 3600, &errstr);
+			if (errstr != NULL)
+				fatalx("secs is %s: %s", errstr, optarg);
+			break;
+		case 'g':
+			gen = optarg;
+			break;
+		case 'r':
+			rate = strtonum(optarg, 8000, 384000, &errstr);
+			if (errstr != NULL)
+				fatalx("rate is %s: %s", errstr, optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (gen != NULL) {
+		if (argc != 0)
+			usage();
+		generate(gen, secs, rate, chans, bits);
+		return 0;
+	}
+
+	if (argc == 0)
+		usage();
+
+	printf("file\tformat\trate\tchans\tbits\tsecs\trtf\tcpu_ms\t"
+	    "maxrss_kb\tseek_ms\n");
+	for (; *argv; ++argv)
+		if (bench(*argv) == -1)
+			ret = 1;
+
+	return ret;
+}
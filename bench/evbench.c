@@ -0,0 +1,604 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Drive the event loop of ev.c with many socketpairs and timers and
+ * report, for every test, one line of tab-separated values:
+ *
+ *	test ops ops_sec p50_us p99_us max_us errors
+ *
+ * The tests are:
+ *
+ *	ping		a few bytes hop between randomly chosen socketpairs,
+ *			all registered, and the latency is from the write
+ *			to the callback, which re-arms with ev_mod() as
+ *			the daemon does;
+ *	churn		ev_add() and ev_del() on all the socketpairs, the
+ *			latency is of the pair of calls;
+ *	timer_ops	ev_timer() and ev_timer_cancel() of many timers,
+ *			the latency is of each call;
+ *	timer_fire	as many timers fire, while their callbacks cancel
+ *			and add more, and the latency is how late they are.
+ *
+ * The errors are the events lost, the timers that fired early or after
+ * being cancelled and the ones that never did.  With -c the results are
+ * compared with those of a previous run, and it fails if the throughput
+ * dropped or the latency grew by more than the tolerance.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ev.h"
+#include "log.h"
+#include "xmalloc.h"
+
+/* don't report latency differences smaller than this */
+#define SLACK_US	20.0
+
+#define MINTIMEOUT	10	/* ms, to add all of them before the first */
+#define MAXTIMEOUT	110	/* ms */
+
+struct pair {
+	int		 fd[2];
+	double		 sent;
+};
+
+struct row {
+	char		 test[32];
+	double		 ops;
+	double		 rate;		/* -1 if it doesn't apply */
+	double		 p50;
+	double		 p99;
+	double		 max;
+	long		 errors;
+};
+
+struct tmr {
+	unsigned int	 id;
+	double		 deadline;
+	int		 state;
+#define T_PENDING	1
+#define T_CANCELLED	2
+#define T_FIRED		3
+};
+
+static struct pair	*pairs;
+static size_t		 npairs;
+
+static double		*samples;
+static size_t		 nsamples;
+static size_t		 samplecap;
+
+static uint32_t		 rnd = 1;
+
+static size_t		 hops;
+static size_t		 nhops;
+static int		 done;
+static unsigned int	 watchdog_id;
+
+static struct tmr	*tmrs;
+static size_t		 ntmrs;
+static size_t		 tmrcap;
+static size_t		 pending;
+static long		 terrors;
+
+static struct row	 rows[8];
+static size_t		 nrows;
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t
+random32(void)
+{
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	return rnd;
+}
+
+static void
+sample(double us)
+{
+	if (nsamples == samplecap) {
+		samplecap = samplecap ? samplecap * 2 : 4096;
+		samples = xreallocarray(samples, samplecap,
+		    sizeof(*samples));
+	}
+	samples[nsamples++] = us;
+}
+
+static int
+dblcmp(const void *a, const void *b)
+{
+	double	 x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double
+pct(double p)
+{
+	size_t	 i;
+
+	if (nsamples == 0)
+		return 0;
+	i = p * (nsamples - 1) / 100;
+	return samples[i];
+}
+
+/* add a row with the latencies sampled so far */
+static void
+report(const char *test, size_t ops, double secs, long errors)
+{
+	struct row	*r;
+
+	if (nrows == sizeof(rows) / sizeof(rows[0]))
+		fatalx("too many tests");
+	r = &rows[nrows++];
+
+	qsort(samples, nsamples, sizeof(*samples), dblcmp);
+	strlcpy(r->test, test, sizeof(r->test));
+	r->ops = ops;
+	r->rate = secs > 0 ? ops / secs : -1;
+	r->p50 = pct(50);
+	r->p99 = pct(99);
+	r->max = pct(100);
+	r->errors = errors;
+	nsamples = 0;
+
+	printf("%s\t%zu\t", r->test, ops);
+	if (r->rate < 0)
+		printf("-");
+	else
+		printf("%.0f", r->rate);
+	printf("\t%.2f\t%.2f\t%.2f\t%ld\n", r->p50, r->p99, r->max,
+	    r->errors);
+	fflush(stdout);
+}
+
+static void
+pairs_open(size_t n)
+{
+	struct rlimit	 rl;
+	size_t		 i, max;
+
+	/* two fds per pair, and some for the rest */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+	    rl.rlim_cur != RLIM_INFINITY) {
+		max = rl.rlim_cur > 64 ? (rl.rlim_cur - 32) / 2 : 16;
+		if (n > max) {
+			log_warnx("only %zu socketpairs, see ulimit -n", max);
+			n = max;
+		}
+	}
+
+	pairs = xcalloc(n, sizeof(*pairs));
+	for (i = 0; i < n; ++i) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i].fd) == -1)
+			fatal("socketpair");
+		if (fcntl(pairs[i].fd[0], F_SETFL, O_NONBLOCK) == -1 ||
+		    fcntl(pairs[i].fd[1], F_SETFL, O_NONBLOCK) == -1)
+			fatal("fcntl");
+	}
+	npairs = n;
+}
+
+static void
+ping_send(void)
+{
+	struct pair	*p;
+
+	p = &pairs[random32() % npairs];
+	p->sent = now();
+	if (write(p->fd[1], "x", 1) != 1)
+		fatal("write");
+}
+
+static void
+ping_cb(int fd, int ev, void *arg)
+{
+	struct pair	*p = arg;
+	char		 buf[64];
+	ssize_t		 r, i;
+
+	if ((r = read(fd, buf, sizeof(buf))) == -1) {
+		if (errno == EAGAIN)
+			return;
+		fatal("read");
+	}
+	if (r == 0)
+		fatalx("unexpected EOF");
+
+	sample((now() - p->sent) * 1e6);
+	for (i = 0; i < r && !done; ++i) {
+		if (++hops == nhops)
+			done = 1;
+		else
+			ping_send();
+	}
+
+	if (ev_mod(fd, EV_READ) == -1)
+		fatal("ev_mod");
+}
+
+/* give up if the loop stops making progress */
+static void
+watchdog(int fd, int ev, void *arg)
+{
+	static size_t	 last = -1;
+	struct timeval	 tv = { 1, 0 };
+	size_t		 cur = hops + ntmrs - pending;
+
+	if (done)
+		return;
+	if (cur == last) {
+		log_warnx("the event loop is stuck");
+		done = -1;
+		return;
+	}
+	last = cur;
+	if ((watchdog_id = ev_timer(&tv, watchdog, NULL)) == 0)
+		fatal("ev_timer");
+}
+
+static void
+loop(void)
+{
+	struct timeval	 tv = { 1, 0 };
+
+	if ((watchdog_id = ev_timer(&tv, watchdog, NULL)) == 0)
+		fatal("ev_timer");
+	while (!done)
+		if (ev_step() == -1)
+			fatal("ev_step");
+	ev_timer_cancel(watchdog_id);
+}
+
+static void
+bench_ping(size_t active)
+{
+	char		 buf[64];
+	double		 t;
+	size_t		 i;
+
+	for (i = 0; i < npairs; ++i)
+		if (ev_add(pairs[i].fd[0], EV_READ, ping_cb, &pairs[i]) == -1)
+			fatal("ev_add");
+
+	hops = 0;
+	done = 0;
+	t = now();
+	for (i = 0; i < active && i < nhops; ++i)
+		ping_send();
+	loop();
+	t = now() - t;
+
+	report("ping", hops, t, done == -1 ? (long)(nhops - hops) : 0);
+
+	/* drop the bytes still around */
+	for (i = 0; i < npairs; ++i) {
+		ev_del(pairs[i].fd[0]);
+		while (read(pairs[i].fd[0], buf, sizeof(buf)) > 0)
+			/* nop */ ;
+	}
+}
+
+static void
+churn_cb(int fd, int ev, void *arg)
+{
+	return;
+}
+
+static void
+bench_churn(int rounds)
+{
+	double		 t, beg;
+	size_t		 i;
+	int		 r;
+
+	beg = now();
+	for (r = 0; r < rounds; ++r) {
+		for (i = 0; i < npairs; ++i) {
+			t = now();
+			if (ev_add(pairs[i].fd[0], EV_READ, churn_cb, NULL)
+			    == -1 || ev_del(pairs[i].fd[0]) == -1)
+				fatal("ev_add");
+			sample((now() - t) * 1e6);
+		}
+	}
+	report("churn", 2 * npairs * rounds, now() - beg, 0);
+}
+
+static void	 timer_cb(int, int, void *);
+
+static void
+timer_add(void)
+{
+	struct timeval	 tv;
+	struct tmr	*t;
+	size_t		 ms;
+
+	if (ntmrs == tmrcap) {
+		tmrcap = tmrcap ? tmrcap * 2 : 1024;
+		tmrs = xreallocarray(tmrs, tmrcap, sizeof(*tmrs));
+	}
+	t = &tmrs[ntmrs];
+
+	ms = MINTIMEOUT + random32() % (MAXTIMEOUT - MINTIMEOUT);
+	tv.tv_sec = 0;
+	tv.tv_usec = ms * 1000 + random32() % 1000;
+
+	t->deadline = now() + tv.tv_usec / 1e6;
+	if ((t->id = ev_timer(&tv, timer_cb, (void *)ntmrs)) == 0)
+		fatal("ev_timer");
+
+	t->state = T_PENDING;
+	ntmrs++;
+	pending++;
+}
+
+static void
+timer_cancel(struct tmr *t)
+{
+	if (ev_timer_cancel(t->id) == -1) {
+		log_warnx("timer %u: can't cancel", t->id);
+		terrors++;
+	}
+
+	if (ev_timer_pending(t->id)) {
+		log_warnx("timer %u: still pending", t->id);
+		terrors++;
+	}
+	t->state = T_CANCELLED;
+	pending--;
+}
+
+static void
+timer_cb(int fd, int ev, void *arg)
+{
+	struct tmr	*t = &tmrs[(size_t)arg];
+	double		 late;
+	size_t		 i;
+
+	late = now() - t->deadline;
+	if (t->state != T_PENDING) {
+		log_warnx("timer %u: fired when %s", t->id,
+		    t->state == T_FIRED ? "already fired" : "cancelled");
+		terrors++;
+		return;
+	}
+	/* ev.c keeps microseconds */
+	if (late < -1e-6) {
+		log_warnx("timer %u: %.3fms early", t->id, -late * 1e3);
+		terrors++;
+	}
+	sample(late * 1e6);
+	t->state = T_FIRED;
+	pending--;
+
+	/* stir a bit the heap while it's being walked */
+	switch (random32() % 4) {
+	case 0:
+		i = random32() % ntmrs;
+		if (tmrs[i].state == T_PENDING)
+			timer_cancel(&tmrs[i]);
+		break;
+	case 1:
+		if (ntmrs < tmrcap)
+			timer_add();
+		break;
+	}
+
+	if (pending == 0)
+		done = 1;
+}
+
+static void
+bench_timers(size_t n)
+{
+	double		 beg, t;
+	size_t		 i, fired;
+
+	ntmrs = pending = 0;
+	terrors = 0;
+
+	beg = now();
+	for (i = 0; i < n; ++i) {
+		t = now();
+		timer_add();
+		sample((now() - t) * 1e6);
+	}
+	for (i = 0; i < n; i += 2) {
+		t = now();
+		timer_cancel(&tmrs[i]);
+		sample((now() - t) * 1e6);
+	}
+	report("timer_ops", n + (n + 1) / 2, now() - beg, terrors);
+
+	for (i = 1; i < n; i += 2)
+		timer_cancel(&tmrs[i]);
+
+	/* room for the timers added by the callbacks */
+	ntmrs = pending = 0;
+	tmrcap = n + n / 2;
+	tmrs = xreallocarray(tmrs, tmrcap, sizeof(*tmrs));
+
+	terrors = 0;
+	for (i = 0; i < n; ++i)
+		timer_add();
+	done = 0;
+	loop();
+
+	fired = 0;
+	for (i = 0; i < ntmrs; ++i) {
+		if (tmrs[i].state == T_FIRED)
+			fired++;
+		else if (tmrs[i].state == T_PENDING)
+			terrors++;
+	}
+	report("timer_fire", fired, -1, terrors);
+}
+
+/* compare with a previous run, returns the number of regressions */
+static int
+compare(const char *path, double tol)
+{
+	FILE		*fp;
+	struct row	*r;
+	char		 line[256], test[32], rate[32];
+	double		 ops, p50, p99, max, was;
+	size_t		 i;
+	long		 errors;
+	int		 bad = 0;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		fatal("fopen %s", path);
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%31s %lf %31s %lf %lf %lf %ld", test, &ops,
+		    rate, &p50, &p99, &max, &errors) != 7)
+			continue;
+
+		for (i = 0; i < nrows; ++i)
+			if (!strcmp(rows[i].test, test))
+				break;
+		if (i == nrows)
+			continue;
+		r = &rows[i];
+
+		if (r->rate >= 0 && strcmp(rate, "-") != 0) {
+			was = strtod(rate, NULL);
+			if (r->rate < was * (1 - tol / 100)) {
+				log_warnx("%s: %.0f ops/sec, was %.0f",
+				    test, r->rate, was);
+				bad++;
+			}
+		}
+		if (r->p99 > p99 * (1 + tol / 100) && r->p99 - p99 > SLACK_US) {
+			log_warnx("%s: p99 of %.2fus, was %.2fus", test,
+			    r->p99, p99);
+			bad++;
+		}
+	}
+
+	if (ferror(fp))
+		fatal("read %s", path);
+	fclose(fp);
+	return bad;
+}
+
+static __dead void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-a active] [-c file] [-e events] "
+	    "[-n pairs] [-T timers]\n"
+	    "          [-t tolerance]\n", getprogname());
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char	*errstr, *cmp = NULL;
+	size_t		 active = 16, n = 2000, ntimers = 20000, i;
+	double		 tol = 20;
+	int		 ch, ret = 0;
+
+	log_init(1, LOG_DAEMON);
+
+	nhops = 200000;
+	while ((ch = getopt(argc, argv, "a:c:e:n:T:t:")) != -1) {
+		switch (ch) {
+		case 'a':
+			active = strtonum(optarg, 1, 1024, &errstr);
+			if (errstr != NULL)
+				fatalx("active is %s: %s", errstr, optarg);
+			break;
+		case 'c':
+			cmp = optarg;
+			break;
+		case 'e':
+			nhops = strtonum(optarg, 1, 100000000, &errstr);
+			if (errstr != NULL)
+				fatalx("events is %s: %s", errstr, optarg);
+			break;
+		case 'n':
+			n = strtonum(optarg, 1, 1000000, &errstr);
+			if (errstr != NULL)
+				fatalx("pairs is %s: %s", errstr, optarg);
+			break;
+		case 'T':
+			ntimers = strtonum(optarg, 1, 10000000, &errstr);
+			if (errstr != NULL)
+				fatalx("timers is %s: %s", errstr, optarg);
+			break;
+		case 't':
+			tol = strtonum(optarg, 0, 1000, &errstr);
+			if (errstr != NULL)
+				fatalx("tolerance is %s: %s", errstr, optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage();
+
+	if (ev_init() == -1)
+		fatal("ev_init");
+
+	pairs_open(n);
+
+	printf("test\tops\tops_sec\tp50_us\tp99_us\tmax_us\terrors\n");
+	bench_ping(active);
+	bench_churn(10);
+	bench_timers(ntimers);
+
+	for (i = 0; i < nrows; ++i)
+		if (rows[i].errors != 0)
+			ret = 1;
+	if (cmp != NULL && compare(cmp, tol) != 0)
+		ret = 1;
+
+	return ret;
+}
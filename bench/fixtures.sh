@@ -0,0 +1,93 @@
+#!/bin/sh
+#
+# Generate the files for the benchmarks.  The source signal is written
+# by amused-bench itself; the encoded versions are made with the
+# reference encoders if available, otherwise with ffmpeg.  Formats for
+# which no encoder is found are skipped.
+
+set -e
+
+bench=${1:-./amused-bench}
+dir=${2:-fixtures}
+secs=${BENCH_SECS:-60}
+
+have() {
+	command -v "$1" >/dev/null 2>&1
+}
+
+ff() {
+	have ffmpeg && ffmpeg -v error -y -i "$@"
+}
+
+# enc out function
+enc() {
+	[ -f "$dir/$1" ] && return 0
+	if $2 2>/dev/null; then
+		echo "generated $dir/$1"
+	else
+		rm -f "$dir/$1"
+		echo "skipping $1: no encoder available" >&2
+	fi
+}
+
+mkdir -p "$dir"
+
+src() {
+	[ -f "$dir/$1" ] || "$bench" -d "$secs" -r "$2" -c "$3" -b "$4" \
+	    -g "$dir/$1"
+}
+
+src wav16.wav 44100 2 16
+src wav24.wav 96000 2 24
+src wav51.wav 48000 6 16
+
+f=$dir/wav16.wav
+f24=$dir/wav24.wav
+f51=$dir/wav51.wav
+
+flac16() {
+	if have flac; then flac -s -f -o "$dir/flac16.flac" "$f"
+	else ff "$f" "$dir/flac16.flac"; fi
+}
+flac24() {
+	if have flac; then flac -s -f -o "$dir/flac24.flac" "$f24"
+	else ff "$f24" -c:a flac -sample_fmt s32 "$dir/flac24.flac"; fi
+}
+flac51() {
+	if have flac; then flac -s -f -o "$dir/flac51.flac" "$f51"
+	else ff "$f51" "$dir/flac51.flac"; fi
+}
+mp3cbr() {
+	if have lame; then lame --quiet -b 192 "$f" "$dir/mp3cbr.mp3"
+	else ff "$f" -c:a libmp3lame -b:a 192k "$dir/mp3cbr.mp3"; fi
+}
+mp3vbr() {
+	if have lame; then lame --quiet -V 2 "$f" "$dir/mp3vbr.mp3"
+	else ff "$f" -c:a libmp3lame -q:a 2 "$dir/mp3vbr.mp3"; fi
+}
+vorbis() {
+	if have oggenc; then oggenc -Q -q 5 -o "$dir/vorbis.ogg" "$f"
+	else ff "$f" -c:a libvorbis -q:a 5 "$dir/vorbis.ogg"; fi
+}
+vorbis51() {
+	if have oggenc; then oggenc -Q -q 5 -o "$dir/vorbis51.ogg" "$f51"
+	else ff "$f51" -c:a libvorbis -q:a 5 "$dir/vorbis51.ogg"; fi
+}
+opus() {
+	if have opusenc; then opusenc --quiet "$f" "$dir/opus.opus"
+	else ff "$f" -c:a libopus -b:a 128k "$dir/opus.opus"; fi
+}
+opus51() {
+	if have opusenc; then opusenc --quiet "$f51" "$dir/opus51.opus"
+	else ff "$f51" -c:a libopus -b:a 256k "$dir/opus51.opus"; fi
+}
+
+enc flac16.flac flac16
+enc flac24.flac flac24
+enc flac51.flac flac51
+enc mp3cbr.mp3 mp3cbr
+enc mp3vbr.mp3 mp3vbr
+enc vorbis.ogg vorbis
+enc vorbis51.ogg vorbis51
+enc opus.opus opus
+enc opus51.opus opus51
@@ -0,0 +1,2 @@
+#include "config.h"
+#include_next "sys/mman.h"
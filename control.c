@@ -38,7 +38,10 @@
 #include "ev.h"
 #include "log.h"
 #include "control.h"
+#include "library.h"
 #include "playlist.h"
+#include "state.h"
+#include "watch.h"
 
 #define	CONTROL_BACKLOG	5
 
@@ -47,7 +50,8 @@ struct {
 	unsigned int	tout;
 	struct playlist	play;
 	int		tx;
-} control_state = {.fd = -1, .tx = -1};
+	int		scan;		/* waiting for the library scan */
+} control_state = {.fd = -1, .tx = -1, .scan = -1};
 
 struct ctl_conn {
 	TAILQ_ENTRY(ctl_conn)	entry;
@@ -174,6 +178,7 @@ control_accept(int listenfd, int event, void *bula)
 
 	if (imsgbuf_init(&c->iev.imsgbuf, connfd) == -1)
 		fatal("imsgbuf_init");
+	imsgbuf_allow_fdpass(&c->iev.imsgbuf);
 	c->iev.handler = control_dispatch_imsg;
 	c->iev.events = EV_READ;
 	ev_add(c->iev.imsgbuf.fd, c->iev.events, c->iev.handler, &c->iev);
@@ -223,6 +228,10 @@ control_close(int fd)
 		control_state.tx = -1;
 	}
 
+	/* the scan goes on anyway */
+	if (c->iev.imsgbuf.fd == control_state.scan)
+		control_state.scan = -1;
+
 	imsgbuf_clear(&c->iev.imsgbuf);
 	TAILQ_REMOVE(&ctl_conns, c, entry);
 
@@ -231,7 +240,7 @@ control_close(int fd)
 
 	/* Some file descriptors are available again. */
 	if (ev_timer_pending(control_state.tout)) {
-		ev_timer(NULL, NULL, NULL);
+		ev_timer_cancel(control_state.tout);
 		ev_add(control_state.fd, EV_READ, control_accept, NULL);
 	}
 
@@ -244,6 +253,8 @@ control_notify(int type)
 	struct ctl_conn *c;
 	struct player_event ev;
 
+	state_notify(type);
+
 	memset(&ev, 0, sizeof(ev));
 	ev.event = type;
 	ev.position = current_status.position;
@@ -251,6 +262,7 @@ control_notify(int type)
 	ev.mode.repeat_one = repeat_one;
 	ev.mode.repeat_all = repeat_all;
 	ev.mode.consume = consume;
+	ev.mode.random = random_mode;
 
 	TAILQ_FOREACH(c, &ctl_conns, entry) {
 		if (!c->monitor)
@@ -261,6 +273,21 @@ control_notify(int type)
 	}
 }
 
+/* called by the library once a scan is done */
+void
+control_scandone(uint64_t n)
+{
+	struct ctl_conn	*c;
+
+	if (control_state.scan == -1)
+		return;
+
+	if ((c = control_connbyfd(control_state.scan)) != NULL)
+		imsg_compose_event(&c->iev, IMSG_CTL_SCAN, 0, 0, -1,
+		    &n, sizeof(n));
+	control_state.scan = -1;
+}
+
 static int
 new_mode(int val, int newval)
 {
@@ -279,8 +306,9 @@ control_dispatch_imsg(int fd, int event, void *bula)
 	struct imsg		 imsg;
 	struct player_mode	 mode;
 	struct player_seek	 seek;
+	const char		*errstr;
 	ssize_t		 	 n, off;
-	int			 type, all;
+	int			 type, all, flags;
 
 	if ((c = control_connbyfd(fd)) == NULL) {
 		log_warnx("%s: fd %d: not found", __func__, fd);
@@ -357,14 +385,22 @@ control_dispatch_imsg(int fd, int event, void *bula)
 				break;
 			play_state = STATE_STOPPED;
 			main_send_player(IMSG_STOP, -1, NULL, 0);
+			main_preload();
 			control_notify(type);
 			break;
 		case IMSG_CTL_FLUSH:
 			playlist_truncate();
+			main_preload();
 			control_notify(IMSG_CTL_COMMIT);
 			break;
 		case IMSG_CTL_SHOW:
-			main_send_playlist(&c->iev);
+			flags = 0;
+			if (imsg_get_len(&imsg) != 0 &&
+			    imsg_get_data(&imsg, &flags, sizeof(flags)) == -1) {
+				main_senderr(&c->iev, "wrong size");
+				break;
+			}
+			main_send_playlist(&c->iev, flags);
 			break;
 		case IMSG_CTL_STATUS:
 			main_send_status(&c->iev);
@@ -390,6 +426,8 @@ control_dispatch_imsg(int fd, int event, void *bula)
 			consume = new_mode(consume, mode.consume);
 			repeat_all = new_mode(repeat_all, mode.repeat_all);
 			repeat_one = new_mode(repeat_one, mode.repeat_one);
+			playlist_setrandom(new_mode(random_mode, mode.random));
+			main_preload();
 			control_notify(type);
 			break;
 		case IMSG_CTL_BEGIN:
@@ -402,15 +440,18 @@ control_dispatch_imsg(int fd, int event, void *bula)
 			    NULL, 0);
 			break;
 		case IMSG_CTL_ADD:
+		case IMSG_CTL_ADD_UNIQUE:
 			if (control_state.tx != -1 &&
 			    control_state.tx != imsgbuf->fd) {
 				main_senderr(&c->iev, "locked");
 				break;
 			}
-			main_enqueue(control_state.tx != -1,
-			   &control_state.play,&c->iev, &imsg);
-			if (control_state.tx == -1)
-				control_notify(type);
+			if (main_enqueue(control_state.tx != -1,
+			    type == IMSG_CTL_ADD_UNIQUE, &control_state.play,
+			    &c->iev, &imsg) && control_state.tx == -1) {
+				main_preload();
+				control_notify(IMSG_CTL_ADD);
+			}
 			break;
 		case IMSG_CTL_COMMIT:
 			if (control_state.tx != imsgbuf->fd) {
@@ -422,6 +463,7 @@ control_dispatch_imsg(int fd, int event, void *bula)
 				break;
 			}
 			playlist_swap(&control_state.play, off);
+			main_preload();
 			memset(&control_state.play, 0,
 			    sizeof(control_state.play));
 			control_state.tx = -1;
@@ -429,6 +471,44 @@ control_dispatch_imsg(int fd, int event, void *bula)
 			    NULL, 0);
 			control_notify(type);
 			break;
+		case IMSG_CTL_LOAD:
+			if (control_state.tx != -1) {
+				main_senderr(&c->iev, "locked");
+				break;
+			}
+			if (main_load(&c->iev, &imsg) == -1)
+				break;
+			control_notify(IMSG_CTL_COMMIT);
+			break;
+		case IMSG_CTL_LOADFILE:
+			if (control_state.tx != -1) {
+				main_senderr(&c->iev, "locked");
+				break;
+			}
+			if (main_loadfile(&c->iev, &imsg) == -1)
+				break;
+			control_notify(IMSG_CTL_COMMIT);
+			break;
+		case IMSG_CTL_SEARCH:
+			main_search(&c->iev, &imsg);
+			break;
+		case IMSG_CTL_SCAN:
+			if (library_scan(&imsg, &errstr) == -1) {
+				main_senderr(&c->iev, errstr);
+				break;
+			}
+			control_state.scan = imsgbuf->fd;
+			break;
+		case IMSG_CTL_FIND:
+			if (control_state.tx != -1) {
+				main_senderr(&c->iev, "locked");
+				break;
+			}
+			library_find(&c->iev, &imsg);
+			break;
+		case IMSG_CTL_WATCH:
+			watch_ctl(&c->iev, &imsg);
+			break;
 		case IMSG_CTL_MONITOR:
 			c->monitor = 1;
 			break;
@@ -450,6 +530,7 @@ control_dispatch_imsg(int fd, int event, void *bula)
 				break;
 			}
 			playlist_shuffle(all);
+			main_preload();
 			control_notify(IMSG_CTL_COMMIT);
 			break;
 		default:
@@ -20,4 +20,5 @@ int	control_init(char *);
 int	control_listen(int fd);
 void	control_accept(int, int, void *);
 void	control_notify(int);
+void	control_scandone(uint64_t);
 void	control_dispatch_imsg(int, int, void *);
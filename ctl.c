@@ -15,8 +15,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/mman.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 
 #include <errno.h>
@@ -34,6 +36,7 @@
 #include "amused.h"
 #include "log.h"
 #include "playlist.h"
+#include "walk.h"
 #include "xmalloc.h"
 
 #ifndef nitems
@@ -46,6 +49,13 @@ struct parse_result {
 	FILE			*fp;
 	int			 all;
 	int			 pretty;
+	int			 count;
+	int			 unique;
+	int			 recursive;
+	int			 list;
+	int			 clear;
+	size_t			 nsent;
+	int			 server;
 	int			 monitor[IMSG__LAST];
 	struct player_mode	 mode;
 	struct player_seek	 seek;
@@ -63,6 +73,9 @@ struct ctl_command {
 static struct imsgbuf	*imsgbuf;
 char			 cwd[PATH_MAX];
 
+/* flush the enqueued files every once in a while */
+#define CTL_ADDBATCH	256
+
 static int	ctl_noarg(struct parse_result *, int, char **);
 static int	ctl_add(struct parse_result *, int, char **);
 static int	ctl_show(struct parse_result *, int, char **);
@@ -70,30 +83,40 @@ static int	ctl_load(struct parse_result *, int, char **);
 static int	ctl_jump(struct parse_result *, int, char **);
 static int	ctl_repeat(struct parse_result *, int, char **);
 static int	ctl_consume(struct parse_result *, int, char **);
+static int	ctl_find(struct parse_result *, int, char **);
+static int	ctl_random(struct parse_result *, int, char **);
 static int	ctl_monitor(struct parse_result *, int, char **);
+static int	ctl_scan(struct parse_result *, int, char **);
+static int	ctl_search(struct parse_result *, int, char **);
 static int	ctl_seek(struct parse_result *, int, char **);
 static int	ctl_shuffle(struct parse_result *, int, char **);
 static int	ctl_status(struct parse_result *, int, char **);
+static int	ctl_watch(struct parse_result *, int, char **);
 
 struct ctl_command ctl_commands[] = {
-	{ "add",	ADD,		ctl_add,	"file ..."},
+	{ "add",	ADD,		ctl_add,	"[-ru] file ..."},
 	{ "consume",	MODE,		ctl_consume,	"[one|all]"},
+	{ "find",	FIND,		ctl_find,	"[-l] term ..."},
 	{ "flush",	FLUSH,		ctl_noarg,	""},
 	{ "jump",	JUMP,		ctl_jump,	"pattern"},
-	{ "load",	LOAD,		ctl_load,	"[file]"},
+	{ "load",	LOAD,		ctl_load,	"[-s] [file]"},
 	{ "monitor",	MONITOR,	ctl_monitor,	"[events]"},
 	{ "next",	NEXT,		ctl_noarg,	""},
 	{ "pause",	PAUSE,		ctl_noarg,	""},
 	{ "play",	PLAY,		ctl_noarg,	""},
 	{ "previous",	PREV,		ctl_noarg,	""},
+	{ "random",	MODE,		ctl_random,	"[on|off]"},
 	{ "repeat",	MODE,		ctl_repeat,	"one|all [on|off]"},
 	{ "restart",	RESTART,	ctl_noarg,	""},
+	{ "scan",	SCAN,		ctl_scan,	"[dir ...]"},
+	{ "search",	SEARCH,		ctl_search,	"[-n count] pattern ..."},
 	{ "seek",	SEEK,		ctl_seek,	"[+-]time[%]"},
 	{ "show",	SHOW,		ctl_show,	"[-p]"},
 	{ "shuffle",	SHUFFLE,	ctl_shuffle,	"[-a]" },
 	{ "status",	STATUS,		ctl_status,	"[-f fmt]"},
 	{ "stop",	STOP,		ctl_noarg,	""},
 	{ "toggle",	TOGGLE,		ctl_noarg,	""},
+	{ "watch",	WATCH,		ctl_watch,	"[-c] [dir ...]"},
 };
 
 __dead void
@@ -111,53 +134,6 @@ ctl_usage(struct ctl_command *ctl)
 	exit(1);
 }
 
-/* based on canonpath from kern_pledge.c */
-static int
-canonpath(const char *input, char *buf, size_t bufsize)
-{
-	const char *p;
-	char *q, path[PATH_MAX];
-	int r;
-
-	if (input[0] != '/') {
-		r = snprintf(path, sizeof(path), "%s/%s", cwd, input);
-		if (r < 0 || (size_t)r >= sizeof(path)) {
-			errno = ENAMETOOLONG;
-			return -1;
-		}
-		input = path;
-	}
-
-	p = input;
-	q = buf;
-	while (*p && (q - buf < bufsize)) {
-		if (p[0] == '/' && (p[1] == '/' || p[1] == '\0')) {
-			p += 1;
-
-		} else if (p[0] == '/' && p[1] == '.' &&
-		    (p[2] == '/' || p[2] == '\0')) {
-			p += 2;
-
-		} else if (p[0] == '/' && p[1] == '.' && p[2] == '.' &&
-		    (p[3] == '/' || p[3] == '\0')) {
-			p += 3;
-			if (q != buf)	/* "/../" at start of buf */
-				while (*--q != '/')
-					continue;
-
-		} else {
-			*q++ = *p++;
-		}
-	}
-	if ((*p == '\0') && (q - buf < bufsize)) {
-		*q = 0;
-		return 0;
-	} else {
-		errno = ENAMETOOLONG;
-		return -1;
-	}
-}
-
 static int
 parse(struct parse_result *res, int argc, char **argv)
 {
@@ -194,14 +170,18 @@ parse(struct parse_result *res, int argc, char **argv)
 	return status;
 }
 
+/*
+ * Canonicalize the next entry of the playlist being loaded into path.
+ * Returns -1 at the end of the file.
+ */
 static int
-load_files(struct parse_result *res, int *ret)
+load_next(struct parse_result *res, char *path, size_t len, ssize_t *curr,
+    size_t *i)
 {
+	static char	*line;
+	static size_t	 linesize;
 	const char	*file;
-	char		*line = NULL;
-	char		 path[PATH_MAX];
-	size_t		 linesize = 0, i = 0;
-	ssize_t		 linelen, curr = -1;
+	ssize_t		 linelen;
 
 	while ((linelen = getline(&line, &linesize, res->fp)) != -1) {
 		if (linelen == 0)
@@ -210,26 +190,39 @@ load_files(struct parse_result *res, int *ret)
 		file = line;
 		if (!strncmp(file, "> ", 2)) {
 			file += 2;
-			curr = i;
+			*curr = *i;
 		} else if (!strncmp(file, "  ", 2))
 			file += 2;
 
-		memset(path, 0, sizeof(path));
-		if (canonpath(file, path, sizeof(path)) == -1) {
+		if (canonpath(cwd, file, path, len) == -1) {
 			log_warn("canonpath %s", file);
 			continue;
 		}
 
-		i++;
-		imsg_compose(imsgbuf, IMSG_CTL_ADD, 0, 0, -1,
-		    path, sizeof(path));
+		(*i)++;
+		return 0;
 	}
 
 	free(line);
+	line = NULL;
+	linesize = 0;
 	if (ferror(res->fp))
 		fatal("getline");
 	fclose(res->fp);
 	res->fp = NULL;
+	return -1;
+}
+
+static int
+load_files(struct parse_result *res, int *ret)
+{
+	char		 path[PATH_MAX];
+	size_t		 i = 0;
+	ssize_t		 curr = -1;
+
+	while (load_next(res, path, sizeof(path), &curr, &i) != -1)
+		imsg_compose(imsgbuf, IMSG_CTL_ADD, 0, 0, -1,
+		    path, strlen(path) + 1);
 
 	imsg_compose(imsgbuf, IMSG_CTL_COMMIT, 0, 0, -1,
 	    &curr, sizeof(curr));
@@ -237,6 +230,135 @@ load_files(struct parse_result *res, int *ret)
 	return 0;
 }
 
+#if HAVE_MEMFD_CREATE
+/*
+ * Write the whole playlist in a sealed memfd and hand it to the daemon
+ * with a single IMSG_CTL_LOAD.  Returns -1 if the memfd can't be used;
+ * the playlist is then sent one entry at a time.
+ */
+static int
+load_memfd(struct parse_result *res)
+{
+	FILE		*fp;
+	char		 path[PATH_MAX];
+	size_t		 i = 0;
+	ssize_t		 curr = -1;
+	int		 fd, dfd;
+
+	fd = memfd_create("amused-load", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1)
+		return -1;
+
+	if ((dfd = dup(fd)) == -1 || (fp = fdopen(dfd, "w")) == NULL)
+		fatal("fdopen");
+
+	while (load_next(res, path, sizeof(path), &curr, &i) != -1)
+		if (fwrite(path, 1, strlen(path) + 1, fp) != strlen(path) + 1)
+			fatal("fwrite");
+
+	if (fclose(fp) == EOF)
+		fatal("fclose");
+
+#ifdef F_ADD_SEALS
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+	    F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+		fatal("fcntl(F_ADD_SEALS)");
+#endif
+
+	imsg_compose(imsgbuf, IMSG_CTL_LOAD, 0, 0, fd, &curr, sizeof(curr));
+	return 0;
+}
+#endif
+
+static int
+search_entry(struct imsg *imsg, char *path, size_t size)
+{
+	struct player_match	 m;
+	struct ibuf		 ibuf;
+	size_t			 len;
+
+	if (imsg_get_ibuf(imsg, &ibuf) == -1 ||
+	    ibuf_get(&ibuf, &m, sizeof(m)) == -1 ||
+	    (len = ibuf_size(&ibuf)) == 0 || len > size ||
+	    ibuf_get(&ibuf, path, len) == -1 ||
+	    path[len - 1] != '\0')
+		return -1;
+	return 0;
+}
+
+static int
+track_entry(struct imsg *imsg, struct player_track *pt, const char **strs,
+    size_t nstrs)
+{
+	struct ibuf	 ibuf;
+	const char	*p, *e, *end;
+	size_t		 i;
+
+	if (imsg_get_ibuf(imsg, &ibuf) == -1 ||
+	    ibuf_get(&ibuf, pt, sizeof(*pt)) == -1)
+		return -1;
+
+	p = ibuf_data(&ibuf);
+	end = p + ibuf_size(&ibuf);
+	for (i = 0; i < nstrs; ++i) {
+		if ((e = memchr(p, '\0', end - p)) == NULL)
+			return -1;
+		strs[i] = p;
+		p = e + 1;
+	}
+	return 0;
+}
+
+/* print the NUL-terminated watch folders */
+static int
+print_folders(struct imsg *imsg)
+{
+	struct ibuf	 ibuf;
+	const char	*p, *e, *end;
+
+	if (imsg_get_len(imsg) == 0)
+		return 0;
+	if (imsg_get_ibuf(imsg, &ibuf) == -1)
+		return -1;
+
+	p = ibuf_data(&ibuf);
+	end = p + ibuf_size(&ibuf);
+	while (p < end) {
+		if ((e = memchr(p, '\0', end - p)) == NULL)
+			return -1;
+		puts(p);
+		p = e + 1;
+	}
+	return 0;
+}
+
+static void
+show_path(const char *path, int current, int pretty)
+{
+	if (pretty)
+		printf("%c ", current ? '>' : ' ');
+	puts(path);
+}
+
+static void
+show_snapshot(int fd, int pretty)
+{
+	struct playlist	 pl;
+	ssize_t		 curr;
+	size_t		 i;
+	char		 path[PATH_MAX];
+
+	if (playlist_loadsnapshot(fd, &pl, &curr) == -1)
+		fatal("received corrupted snapshot");
+
+	for (i = 0; i < pl.len; ++i) {
+		if (playlist_get(&pl, i, path, sizeof(path)) == NULL)
+			fatalx("received corrupted snapshot");
+		show_path(path, curr == (ssize_t)i, pretty);
+	}
+	playlist_free(&pl);
+}
+
 static const char *
 imsg_strerror(struct imsg *imsg)
 {
@@ -360,7 +482,8 @@ print_status(struct player_status *ps, const char *spec)
 			printf("repeat one:%s ",
 			    ps->mode.repeat_one ? "on" : "off");
 			printf("all:%s ", ps->mode.repeat_all ? "on" : "off");
-			printf("consume:%s\n", ps->mode.consume ? "on" : "off");
+			printf("consume:%s ", ps->mode.consume ? "on" : "off");
+			printf("random:%s\n", ps->mode.random ? "on" : "off");
 		} else if (!strcmp(tok, "mode")) {
 			printf("repeat all %s\n",
 			    ps->mode.repeat_all ? "on" : "off");
@@ -368,6 +491,8 @@ print_status(struct player_status *ps, const char *spec)
 			    ps->mode.repeat_one ? "on" : "off");
 			printf("consume %s\n",
 			    ps->mode.consume ? "on" : "off");
+			printf("random %s\n",
+			    ps->mode.random ? "on" : "off");
 		} else if (!strcmp(tok, "status")) {
 			printf("%s %s\n", status, ps->path);
 		} else if (!strcmp(tok, "time:oneline")) {
@@ -392,11 +517,12 @@ print_monitor_event(struct player_event *ev)
 {
 	switch (ev->event) {
 	case IMSG_CTL_MODE:
-		printf("%s repeat one:%s all:%s consume:%s\n",
+		printf("%s repeat one:%s all:%s consume:%s random:%s\n",
 		    event_name(ev->event),
 		    ev->mode.repeat_one ? "on" : "off",
 		    ev->mode.repeat_all ? "on" : "off",
-		    ev->mode.consume ? "on" : "off");
+		    ev->mode.consume ? "on" : "off",
+		    ev->mode.random ? "on" : "off");
 		break;
 	case IMSG_CTL_SEEK:
 		printf("%s %lld %lld\n", event_name(ev->event),
@@ -410,17 +536,42 @@ print_monitor_event(struct player_event *ev)
 	fflush(stdout);
 }
 
+static void
+enqueue(const char *path, int isdir, void *arg)
+{
+	struct parse_result	*res = arg;
+
+	if (isdir)
+		return;
+
+	imsg_compose(imsgbuf, res->unique ? IMSG_CTL_ADD_UNIQUE :
+	    IMSG_CTL_ADD, 0, 0, -1, path, strlen(path) + 1);
+	if (++res->nsent % CTL_ADDBATCH == 0 && imsgbuf_flush(imsgbuf) == -1)
+		fatal("imsgbuf_flush");
+}
+
 static int
 ctlaction(struct parse_result *res)
 {
 	char path[PATH_MAX];
 	struct imsg imsg;
+	struct ibuf *wbuf;
 	struct player_status ps;
 	struct player_event ev;
+	struct player_search search;
+	struct player_find find;
+	struct player_watch watch;
+	struct player_track track;
+	const char *strs[5];
+	uint64_t count;
+	struct stat sb;
 	ssize_t n;
-	int i, type, ret = 0, done = 1;
+	size_t len;
+	int i, fd, type, ret = 0, done = 1;
 
-	if (pledge("stdio", NULL) == -1)
+	/* add -r reads the directories while sending the files */
+	if (pledge(res->recursive ? "stdio rpath sendfd recvfd" :
+	    "stdio sendfd recvfd", NULL) == -1)
 		fatal("pledge");
 
 	switch (res->action) {
@@ -447,26 +598,35 @@ ctlaction(struct parse_result *res)
 		imsg_compose(imsgbuf, IMSG_CTL_STOP, 0, 0, -1, NULL, 0);
 		break;
 	case ADD:
-		done = 0;
 		for (i = 0; res->files[i] != NULL; ++i) {
-			memset(path, 0, sizeof(path));
-			if (canonpath(res->files[i], path, sizeof(path))
-			    == -1) {
+			if (canonpath(cwd, res->files[i], path,
+			    sizeof(path)) == -1) {
 				log_warn("canonpath %s", res->files[i]);
 				continue;
 			}
 
-			imsg_compose(imsgbuf, IMSG_CTL_ADD, 0, 0, -1,
-			    path, sizeof(path));
+			if (res->recursive && stat(path, &sb) == 0 &&
+			    S_ISDIR(sb.st_mode))
+				walk(path, enqueue, res);
+			else
+				enqueue(path, 0, res);
+		}
+		if (res->recursive && pledge("stdio sendfd recvfd",
+		    NULL) == -1)
+			fatal("pledge");
+		if (res->nsent == 0) {
+			log_warnx("no files to add");
+			ret = 1;
 		}
-		ret = i == 0;
+		done = 0;
 		break;
 	case FLUSH:
 		imsg_compose(imsgbuf, IMSG_CTL_FLUSH, 0, 0, -1, NULL, 0);
 		break;
 	case SHOW:
 		done = 0;
-		imsg_compose(imsgbuf, IMSG_CTL_SHOW, 0, 0, -1, NULL, 0);
+		i = SHOW_VARLEN | SHOW_SNAPSHOT;
+		imsg_compose(imsgbuf, IMSG_CTL_SHOW, 0, 0, -1, &i, sizeof(i));
 		break;
 	case STATUS:
 		done = 0;
@@ -490,14 +650,103 @@ ctlaction(struct parse_result *res)
 		break;
 	case LOAD:
 		done = 0;
+		if (res->server) {
+			if (canonpath(cwd, res->files[0], path, sizeof(path))
+			    == -1) {
+				log_warn("canonpath %s", res->files[0]);
+				ret = 1;
+				done = 1;
+				break;
+			}
+			imsg_compose(imsgbuf, IMSG_CTL_LOADFILE, 0, 0, -1,
+			    path, strlen(path) + 1);
+			break;
+		}
+#if HAVE_MEMFD_CREATE
+		if (load_memfd(res) == 0)
+			break;
+#endif
 		imsg_compose(imsgbuf, IMSG_CTL_BEGIN, 0, 0, -1, NULL, 0);
 		break;
 	case JUMP:
 		done = 0;
-		memset(path, 0, sizeof(path));
-		strlcpy(path, res->files[0], sizeof(path));
+		if (strlcpy(path, res->files[0], sizeof(path))
+		    >= sizeof(path)) {
+			log_warnx("%s: path too long", res->ctl->name);
+			ret = 1;
+			break;
+		}
 		imsg_compose(imsgbuf, IMSG_CTL_JUMP, 0, 0, -1,
-		    path, sizeof(path));
+		    path, strlen(path) + 1);
+		break;
+	case SEARCH:
+		done = 0;
+		for (i = 0, path[0] = '\0'; res->files[i] != NULL; ++i) {
+			if ((i != 0 && strlcat(path, " ", sizeof(path))
+			    >= sizeof(path)) ||
+			    strlcat(path, res->files[i], sizeof(path))
+			    >= sizeof(path)) {
+				log_warnx("%s: pattern too long",
+				    res->ctl->name);
+				ret = 1;
+				break;
+			}
+		}
+		if (ret != 0)
+			break;
+		memset(&search, 0, sizeof(search));
+		search.count = res->count;
+		if ((wbuf = imsg_create(imsgbuf, IMSG_CTL_SEARCH, 0, 0,
+		    sizeof(search) + strlen(path) + 1)) == NULL ||
+		    imsg_add(wbuf, &search, sizeof(search)) == -1 ||
+		    imsg_add(wbuf, path, strlen(path) + 1) == -1)
+			fatal("imsg_create");
+		imsg_close(imsgbuf, wbuf);
+		break;
+	case SCAN:
+		done = 0;
+		if ((wbuf = imsg_create(imsgbuf, IMSG_CTL_SCAN, 0, 0, 0))
+		    == NULL)
+			fatal("imsg_create");
+		for (i = 0; res->files[i] != NULL; ++i) {
+			if (canonpath(cwd, res->files[i], path,
+			    sizeof(path)) == -1)
+				fatal("canonpath %s", res->files[i]);
+			if (imsg_add(wbuf, path, strlen(path) + 1) == -1)
+				fatal("imsg_add");
+		}
+		imsg_close(imsgbuf, wbuf);
+		break;
+	case FIND:
+		done = 0;
+		memset(&find, 0, sizeof(find));
+		find.list = res->list;
+		if ((wbuf = imsg_create(imsgbuf, IMSG_CTL_FIND, 0, 0,
+		    sizeof(find))) == NULL ||
+		    imsg_add(wbuf, &find, sizeof(find)) == -1)
+			fatal("imsg_create");
+		for (i = 0; res->files[i] != NULL; ++i)
+			if (imsg_add(wbuf, res->files[i],
+			    strlen(res->files[i]) + 1) == -1)
+				fatal("imsg_add");
+		imsg_close(imsgbuf, wbuf);
+		break;
+	case WATCH:
+		done = 0;
+		memset(&watch, 0, sizeof(watch));
+		watch.clear = res->clear;
+		if ((wbuf = imsg_create(imsgbuf, IMSG_CTL_WATCH, 0, 0,
+		    sizeof(watch))) == NULL ||
+		    imsg_add(wbuf, &watch, sizeof(watch)) == -1)
+			fatal("imsg_create");
+		for (i = 0; res->files[i] != NULL; ++i) {
+			if (canonpath(cwd, res->files[i], path,
+			    sizeof(path)) == -1)
+				fatal("canonpath %s", res->files[i]);
+			if (imsg_add(wbuf, path, strlen(path) + 1) == -1)
+				fatal("imsg_add");
+		}
+		imsg_close(imsgbuf, wbuf);
 		break;
 	case MODE:
 		done = 0;
@@ -560,34 +809,31 @@ ctlaction(struct parse_result *res)
 
 			switch (res->action) {
 			case ADD:
-				if (res->files[i] == NULL)
-					fatalx("received more replies than "
-					    "files enqueued.");
-
-				if (type == IMSG_CTL_ADD)
-					log_debug("enqueued %s", res->files[i]);
-				else
+				if (type != IMSG_CTL_ADD)
 					fatalx("invalid message %d", type);
-				i++;
-				done = res->files[i] == NULL;
+				len = imsg_get_len(&imsg);
+				if (len == 0)
+					log_debug("skipped a file");
+				else if (len <= sizeof(path) &&
+				    imsg_get_data(&imsg, path, len) == 0 &&
+				    path[len - 1] == '\0')
+					log_debug("enqueued %s", path);
+				done = (size_t)++i == res->nsent;
 				break;
 			case SHOW:
+				if ((fd = imsg_get_fd(&imsg)) != -1) {
+					show_snapshot(fd, res->pretty);
+					close(fd);
+					break;
+				}
 				if (imsg_get_len(&imsg) == 0) {
 					done = 1;
 					break;
 				}
-				if (imsg_get_data(&imsg, &ps, sizeof(ps))
-				    == -1)
-					fatalx("data size mismatch");
-				if (ps.path[sizeof(ps.path) - 1] != '\0')
+				if (playlist_showentry(&imsg, &ps) == -1)
 					fatalx("received corrupted data");
-				if (res->pretty) {
-					char c = ' ';
-					if (ps.status == STATE_PLAYING)
-						c = '>';
-					printf("%c ", c);
-				}
-				puts(ps.path);
+				show_path(ps.path, ps.status == STATE_PLAYING,
+				    res->pretty);
 				break;
 			case PLAY:
 			case TOGGLE:
@@ -608,6 +854,55 @@ ctlaction(struct parse_result *res)
 				print_status(&ps, res->status_format);
 				done = 1;
 				break;
+			case SEARCH:
+				if (type != IMSG_CTL_SEARCH)
+					fatalx("invalid message %d", type);
+				if (imsg_get_len(&imsg) == 0) {
+					done = 1;
+					break;
+				}
+				if (search_entry(&imsg, path, sizeof(path))
+				    == -1)
+					fatalx("received corrupted data");
+				puts(path);
+				break;
+			case SCAN:
+				if (type != IMSG_CTL_SCAN ||
+				    imsg_get_data(&imsg, &count,
+				    sizeof(count)) == -1)
+					fatalx("invalid message %d", type);
+				log_debug("%llu tracks in the library",
+				    (unsigned long long)count);
+				done = 1;
+				break;
+			case FIND:
+				if (type != IMSG_CTL_FIND)
+					fatalx("invalid message %d", type);
+				if (imsg_get_len(&imsg) == sizeof(count)) {
+					if (imsg_get_data(&imsg, &count,
+					    sizeof(count)) == -1)
+						fatalx("imsg_get_data");
+					log_debug("%llu matches",
+					    (unsigned long long)count);
+					done = 1;
+					break;
+				}
+				if (track_entry(&imsg, &track, strs,
+				    nitems(strs)) == -1)
+					fatalx("received corrupted data");
+				/* path, title, artist, album, codec */
+				printf("%s\t%s\t%u\t%s\t%u:%02u\t%s\t%u\t%s\n",
+				    strs[2], strs[3], track.track, strs[1],
+				    track.duration / 60, track.duration % 60,
+				    strs[4], track.rate, strs[0]);
+				break;
+			case WATCH:
+				if (type != IMSG_CTL_WATCH)
+					fatalx("invalid message %d", type);
+				if (print_folders(&imsg) == -1)
+					fatalx("received corrupted data");
+				done = 1;
+				break;
 			case LOAD:
 				if (type == IMSG_CTL_ADD)
 					break;
@@ -671,8 +966,18 @@ ctl_add(struct parse_result *res, int argc, char **argv)
 {
 	int ch;
 
-	while ((ch = getopt(argc, argv, "")) != -1)
-		ctl_usage(res->ctl);
+	while ((ch = getopt(argc, argv, "ru")) != -1) {
+		switch (ch) {
+		case 'r':
+			res->recursive = 1;
+			break;
+		case 'u':
+			res->unique = 1;
+			break;
+		default:
+			ctl_usage(res->ctl);
+		}
+	}
 	argc -= optind;
 	argv += optind;
 
@@ -704,16 +1009,37 @@ ctl_show(struct parse_result *res, int argc, char **argv)
 static int
 ctl_load(struct parse_result *res, int argc, char **argv)
 {
+	struct stat sb;
 	int ch;
 
-	while ((ch = getopt(argc, argv, "")) != -1)
-		ctl_usage(res->ctl);
+	while ((ch = getopt(argc, argv, "s")) != -1) {
+		switch (ch) {
+		case 's':
+			res->server = 1;
+			break;
+		default:
+			ctl_usage(res->ctl);
+		}
+	}
 	argc -= optind;
 	argv += optind;
 
-	if (argc > 1)
+	if (argc > 1 || (res->server && argc != 1))
 		ctl_usage(res->ctl);
 
+	/*
+	 * The daemon only reads regular files; send the contents of
+	 * anything else, like a fifo or one of our descriptors.
+	 */
+	if (res->server) {
+		if (!isfdpath(argv[0]) && stat(argv[0], &sb) == 0 &&
+		    S_ISREG(sb.st_mode)) {
+			res->files = argv;
+			return ctlaction(res);
+		}
+		res->server = 0;
+	}
+
 	res->fp = stdin;
 	if (argc == 1) {
 		if ((res->fp = fopen(argv[0], "r")) == NULL)
@@ -740,6 +1066,91 @@ ctl_jump(struct parse_result *res, int argc, char **argv)
 	return ctlaction(res);
 }
 
+static int
+ctl_search(struct parse_result *res, int argc, char **argv)
+{
+	const char *errstr;
+	int ch;
+
+	res->count = 10;
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			res->count = strtonum(optarg, 1, SEARCH_MAX, &errstr);
+			if (errstr != NULL)
+				fatalx("count is %s: %s", errstr, optarg);
+			break;
+		default:
+			ctl_usage(res->ctl);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0)
+		ctl_usage(res->ctl);
+
+	res->files = argv;
+	return ctlaction(res);
+}
+
+static int
+ctl_scan(struct parse_result *res, int argc, char **argv)
+{
+	if (getopt(argc, argv, "") != -1)
+		ctl_usage(res->ctl);
+	argc -= optind;
+	argv += optind;
+
+	res->files = argv;
+	return ctlaction(res);
+}
+
+static int
+ctl_find(struct parse_result *res, int argc, char **argv)
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "l")) != -1) {
+		switch (ch) {
+		case 'l':
+			res->list = 1;
+			break;
+		default:
+			ctl_usage(res->ctl);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0)
+		ctl_usage(res->ctl);
+
+	res->files = argv;
+	return ctlaction(res);
+}
+
+static int
+ctl_watch(struct parse_result *res, int argc, char **argv)
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c")) != -1) {
+		switch (ch) {
+		case 'c':
+			res->clear = 1;
+			break;
+		default:
+			ctl_usage(res->ctl);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	res->files = argv;
+	return ctlaction(res);
+}
+
 static int
 parse_mode(struct parse_result *res, const char *v)
 {
@@ -792,6 +1203,23 @@ ctl_consume(struct parse_result *res, int argc, char **argv)
 	return ctlaction(res);
 }
 
+static int
+ctl_random(struct parse_result *res, int argc, char **argv)
+{
+	int ch;
+
+	while ((ch = getopt(argc, argv, "")) != -1)
+		ctl_usage(res->ctl);
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1)
+		ctl_usage(res->ctl);
+
+	res->mode.random = parse_mode(res, argv[0]);
+	return ctlaction(res);
+}
+
 static int
 ctl_monitor(struct parse_result *res, int argc, char **argv)
 {
@@ -1072,6 +1500,7 @@ ctl(int argc, char **argv)
 	res.mode.consume = MODE_UNDEF;
 	res.mode.repeat_all = MODE_UNDEF;
 	res.mode.repeat_one = MODE_UNDEF;
+	res.mode.random = MODE_UNDEF;
 
 	log_init(1, LOG_DAEMON);
 	log_setverbose(verbose);
@@ -1085,6 +1514,7 @@ ctl(int argc, char **argv)
 	imsgbuf = xmalloc(sizeof(*imsgbuf));
 	if (imsgbuf_init(imsgbuf, ctl_sock) == -1)
 		fatal("imsgbuf_init");
+	imsgbuf_allow_fdpass(imsgbuf);
 
 	optreset = 1;
 	optind = 1;
@@ -25,6 +25,10 @@
 
 #include <sys/time.h>
 
+#if HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -40,20 +44,34 @@
 struct evcb {
 	void		(*cb)(int, int, void *);
 	void		*udata;
+	int		 ev;		/* as given to ev_add() */
 };
 
 struct evtimer {
 	unsigned int	 id;
-	struct timeval	 tv;
+	unsigned int	 tick;		/* when it was added */
+	size_t		 pos;		/* in the heap */
+	struct timeval	 deadline;
 	struct evcb	 cb;
 };
 
+/*
+ * With epoll(7) the pfds are only the table of the registered fds,
+ * and a tick costs as much as the number of ready ones.
+ */
+#define EV_MAXEVENTS	128
+
 struct evbase {
 	size_t		 len;
 
 	struct pollfd	*pfds;
 	size_t		 pfdlen;
 
+#if HAVE_EPOLL
+	int		 epfd;
+	struct epoll_event evs[EV_MAXEVENTS];
+#endif
+
 	struct evcb	*cbs;
 	size_t		 cblen;
 
@@ -61,18 +79,20 @@ struct evbase {
 	struct evcb	 sigcb;
 
 	unsigned int	 tid;
+	unsigned int	 tick;
 
 	/*
-	 * Binary heap of timers.  At runtime, new timers are added in
-	 * the ``reserve'', a space after the caninocal end of the
-	 * array, and at the end of every tick they're added to the
-	 * heap.
+	 * Binary heap of timers by deadline, an absolute time on the
+	 * monotonic clock, so a tick only looks at the expired ones.
+	 * They're also in an open-addressing hash table by id, to find
+	 * them in constant time.  The timers added during a tick wait
+	 * at least until the next one.
 	 */
-	struct evtimer	*timers;
+	struct evtimer	**timers;
 	size_t		 ntimers;
-	size_t		 reserve_from;
-	size_t		 reserve_till;
 	size_t		 timerscap;
+	struct evtimer	**ids;
+	size_t		 idsz;
 };
 
 static struct evbase	*base;
@@ -117,7 +137,18 @@ ev_init(void)
 	base->sigpipe[0] = -1;
 	base->sigpipe[1] = -1;
 
+#if HAVE_EPOLL
+	if ((base->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		free(base);
+		base = NULL;
+		return -1;
+	}
+#endif
+
 	if (ev_resize(16) == -1) {
+#if HAVE_EPOLL
+		close(base->epfd);
+#endif
 		free(base->pfds);
 		free(base->cbs);
 		free(base);
@@ -141,6 +172,37 @@ ev2poll(int ev)
 	return (ret);
 }
 
+#if HAVE_EPOLL
+/* the fd may have been closed and reused without ev_del() */
+static int
+ev_epoll_ctl(int fd, int registered, int ev)
+{
+	struct epoll_event	 ee;
+	int			 op;
+
+	memset(&ee, 0, sizeof(ee));
+	if (ev & EV_READ)
+		ee.events |= EPOLLIN;
+	if (ev & EV_WRITE)
+		ee.events |= EPOLLOUT;
+	if (ev & EV_EDGE)
+		ee.events |= EPOLLET;
+	ee.data.fd = fd;
+
+	op = registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (epoll_ctl(base->epfd, op, fd, &ee) == 0)
+		return 0;
+
+	if (op == EPOLL_CTL_MOD && errno == ENOENT)
+		op = EPOLL_CTL_ADD;
+	else if (op == EPOLL_CTL_ADD && errno == EEXIST)
+		op = EPOLL_CTL_MOD;
+	else
+		return -1;
+	return epoll_ctl(base->epfd, op, fd, &ee);
+}
+#endif
+
 int
 ev_add(int fd, int ev, void (*cb)(int, int, void *), void *udata)
 {
@@ -154,13 +216,45 @@ ev_add(int fd, int ev, void (*cb)(int, int, void *), void *udata)
 			return -1;
 	}
 
+#if HAVE_EPOLL
+	if (ev_epoll_ctl(fd, base->pfds[fd].fd != -1, ev) == -1)
+		return -1;
+#endif
+
 	base->pfds[fd].fd = fd;
 	base->pfds[fd].events = ev2poll(ev);
 	base->pfds[fd].revents = 0;
 
 	base->cbs[fd].cb = cb;
 	base->cbs[fd].udata = udata;
+	base->cbs[fd].ev = ev;
+
+	return 0;
+}
+
+/*
+ * Change the events of a fd added with ev_add(), keeping the
+ * callback.  Nothing to do when they're the same, so the callbacks
+ * can call it every time.
+ */
+int
+ev_mod(int fd, int ev)
+{
+	if (fd < 0 || (size_t)fd >= base->len || base->pfds[fd].fd == -1) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (base->cbs[fd].ev == ev)
+		return 0;
+
+#if HAVE_EPOLL
+	if (ev_epoll_ctl(fd, 1, ev) == -1)
+		return -1;
+#endif
 
+	base->pfds[fd].events = ev2poll(ev);
+	base->cbs[fd].ev = ev;
 	return 0;
 }
 
@@ -219,79 +313,42 @@ ev_signal(int sig, void (*cb)(int, int, void *), void *udata)
 	return 0;
 }
 
-unsigned int
-ev_timer(const struct timeval *tv, void (*cb)(int, int, void*), void *udata)
+static void
+ev_now(struct timeval *tv)
 {
-	struct evtimer	*evt;
-	void		*t;
-	size_t		 newcap;
-	unsigned int	 nextid;
-
-	if (tv == NULL) {
-		errno = EINVAL;
-		return 0;
-	}
+	struct timespec	 ts;
 
-	if (base->reserve_till == base->timerscap) {
-		newcap = base->timerscap + 8;
-		t = recallocarray(base->timers, base->timerscap, newcap,
-		    sizeof(*base->timers));
-		if (t == NULL)
-			return 0;
-		base->timers = t;
-		base->timerscap = newcap;
-	}
-
-	if ((nextid = ++base->tid) == 0)
-		nextid = ++base->tid;
-
-	evt = &base->timers[base->reserve_till];
-	evt->id = nextid;
-	memcpy(&evt->tv, tv, sizeof(*tv));
-	evt->cb.cb = cb;
-	evt->cb.udata = udata;
-
-	base->reserve_till++;
-	return (nextid);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	TIMESPEC_TO_TIMEVAL(tv, &ts);
 }
 
-static int
-find_timer(unsigned int id, size_t *pos)
+static inline void
+heap_set(size_t i, struct evtimer *evt)
 {
-	size_t		 i;
-
-	if (id == 0)
-		return (0);
-
-	for (i = 0; i < base->ntimers; ++i) {
-		if (base->timers[i].id == id) {
-			*pos = i;
-			return (1);
-		}
-	}
-
-	for (i = base->reserve_from; i < base->reserve_till; ++i) {
-		if (base->timers[i].id == id) {
-			*pos = i;
-			return (1);
-		}
-	}
-
-	return (0);
+	base->timers[i] = evt;
+	evt->pos = i;
 }
 
-int
-ev_timer_pending(unsigned int id)
+static void
+bubbleup(size_t i)
 {
-	size_t		 i;
+	struct evtimer	*evt = base->timers[i];
+	size_t		 p;
 
-	return (find_timer(id, &i));
+	while (i > 0) {
+		p = (i - 1) / 2;
+		if (!timercmp(&evt->deadline, &base->timers[p]->deadline, <))
+			break;
+		heap_set(i, base->timers[p]);
+		i = p;
+	}
+	heap_set(i, evt);
 }
 
 static void
 bubbledown(size_t i)
 {
-	struct evtimer	 tmp;
+	struct evtimer	*evt = base->timers[i];
 	size_t		 l, r, s;
 
 	for (;;) {
@@ -300,55 +357,167 @@ bubbledown(size_t i)
 
 		/* base case: there are no children */
 		if (l >= base->ntimers)
-			return;
+			break;
 
 		/* find the smaller child */
 		s = r;
-		if (r >= base->ntimers ||
-		    timercmp(&base->timers[l].tv, &base->timers[r].tv, <))
+		if (r >= base->ntimers || timercmp(&base->timers[l]->deadline,
+		    &base->timers[r]->deadline, <))
 			s = l;
 
 		/* other base case: it's at the right place */
-		if (timercmp(&base->timers[i].tv, &base->timers[s].tv, <))
-			return;
-
-		/* swap */
-		memcpy(&tmp, &base->timers[s], sizeof(tmp));
-		memcpy(&base->timers[s], &base->timers[i], sizeof(tmp));
-		memcpy(&base->timers[i], &tmp, sizeof(tmp));
+		if (timercmp(&evt->deadline, &base->timers[s]->deadline, <))
+			break;
 
+		heap_set(i, base->timers[s]);
 		i = s;
 	}
+	heap_set(i, evt);
 }
 
-static inline void
-cancel_timer(size_t i)
+/*
+ * The ids are sequential: scatter them, or they'd make a single run
+ * that id_del() has to walk every time.
+ */
+static inline size_t
+id_hash(unsigned int id)
 {
-	base->ntimers--;
-	if (i != base->ntimers) {
-		memcpy(&base->timers[i], &base->timers[base->ntimers],
+	return (id * 2654435761U) & (base->idsz - 1);
+}
+
+/* the slot of the timer id in the hash table, or of where it'd go */
+static size_t
+id_slot(unsigned int id)
+{
+	size_t		 i, mask = base->idsz - 1;
+
+	for (i = id_hash(id); base->ids[i] != NULL; i = (i + 1) & mask)
+		if (base->ids[i]->id == id)
+			break;
+	return i;
+}
+
+static struct evtimer *
+find_timer(unsigned int id)
+{
+	if (id == 0 || base->idsz == 0)
+		return (NULL);
+	return (base->ids[id_slot(id)]);
+}
+
+static int
+id_grow(void)
+{
+	struct evtimer	**t;
+	size_t		  i, newsz;
+
+	newsz = base->idsz ? base->idsz * 2 : 16;
+	if ((t = calloc(newsz, sizeof(*t))) == NULL)
+		return (-1);
+	free(base->ids);
+	base->ids = t;
+	base->idsz = newsz;
+
+	/* all the timers are in the heap */
+	for (i = 0; i < base->ntimers; ++i)
+		base->ids[id_slot(base->timers[i]->id)] = base->timers[i];
+	return (0);
+}
+
+/* remove the timer in slot i, moving back the ones after it */
+static void
+id_del(size_t i)
+{
+	size_t		 j, k, mask = base->idsz - 1;
+
+	base->ids[i] = NULL;
+	for (j = (i + 1) & mask; base->ids[j] != NULL; j = (j + 1) & mask) {
+		/* leave it if its home is cyclically in (i, j] */
+		k = id_hash(base->ids[j]->id);
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		base->ids[i] = base->ids[j];
+		base->ids[j] = NULL;
+		i = j;
+	}
+}
+
+unsigned int
+ev_timer(const struct timeval *tv, void (*cb)(int, int, void*), void *udata)
+{
+	struct evtimer	*evt;
+	struct timeval	 now;
+	void		*t;
+	size_t		 newcap;
+	unsigned int	 nextid;
+
+	if (tv == NULL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (base->ntimers == base->timerscap) {
+		newcap = base->timerscap ? base->timerscap * 2 : 8;
+		t = recallocarray(base->timers, base->timerscap, newcap,
 		    sizeof(*base->timers));
-		bubbledown(i);
+		if (t == NULL)
+			return 0;
+		base->timers = t;
+		base->timerscap = newcap;
 	}
+
+	if ((base->ntimers + 1) * 2 > base->idsz && id_grow() == -1)
+		return 0;
+
+	if ((evt = calloc(1, sizeof(*evt))) == NULL)
+		return 0;
+
+	/* skip the ids still in use after a wrap around */
+	do {
+		if ((nextid = ++base->tid) == 0)
+			nextid = ++base->tid;
+	} while (find_timer(nextid) != NULL);
+
+	ev_now(&now);
+	evt->id = nextid;
+	evt->tick = base->tick;
+	timeradd(&now, tv, &evt->deadline);
+	evt->cb.cb = cb;
+	evt->cb.udata = udata;
+
+	base->ids[id_slot(nextid)] = evt;
+	heap_set(base->ntimers++, evt);
+	bubbleup(evt->pos);
+	return (nextid);
+}
+
+int
+ev_timer_pending(unsigned int id)
+{
+	return (find_timer(id) != NULL);
 }
 
 int
 ev_timer_cancel(unsigned int id)
 {
+	struct evtimer	*evt, *last;
 	size_t		 i;
 
-	if (!find_timer(id, &i))
+	if ((evt = find_timer(id)) == NULL)
 		return (-1);
 
-	if (i < base->ntimers) {
-		cancel_timer(i);
-		return (0);
+	id_del(id_slot(id));
+
+	i = evt->pos;
+	base->ntimers--;
+	if (i != base->ntimers) {
+		last = base->timers[base->ntimers];
+		heap_set(i, last);
+		bubbledown(i);
+		bubbleup(last->pos);
 	}
 
-	base->reserve_till--;
-	if (i != base->reserve_till)
-		memcpy(&base->timers[i], &base->timers[base->reserve_till],
-		    sizeof(*base->timers));
+	free(evt);
 	return (0);
 }
 
@@ -365,47 +534,22 @@ ev_del(int fd)
 		return -1;
 	}
 
+#if HAVE_EPOLL
+	/* fails if it was already closed */
+	if (base->pfds[fd].fd != -1)
+		epoll_ctl(base->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+
 	base->pfds[fd].fd = -1;
 	base->pfds[fd].events = 0;
 
 	base->cbs[fd].cb = NULL;
 	base->cbs[fd].udata = NULL;
+	base->cbs[fd].ev = 0;
 
 	return 0;
 }
 
-static void
-timerheapify(void)
-{
-	size_t		 i, reserve, gap;
-
-	reserve = base->reserve_till - base->reserve_from;
-	if (reserve == 0)
-		return;
-
-	gap = base->reserve_from - base->ntimers;
-	if (gap != 0) {
-		memmove(&base->timers[base->ntimers],
-		    &base->timers[base->reserve_from],
-		    reserve * sizeof(*base->timers));
-		base->reserve_from -= gap;
-		base->reserve_till -= gap;
-	}
-
-	base->ntimers = base->reserve_till;
-
-	if (base->ntimers < 2)
-		return;
-
-	i = base->ntimers / 2 - 1;
-	for (;;) {
-		bubbledown(i);
-		if (i == 0)
-			break;
-		i--;
-	}
-}
-
 static inline int
 poll2ev(int ev)
 {
@@ -419,57 +563,51 @@ poll2ev(int ev)
 	return (r);
 }
 
-int
-ev_step(void)
+#if HAVE_EPOLL
+static inline int
+ev_wait(int msec)
 {
-	struct timespec	 elapsed, beg, end;
-	struct timeval	 tv, sub, *min;
-	struct evcb	 cb;
-	int		 n, msec;
-	size_t		 i;
-
-	timerheapify();
-	base->reserve_from = base->ntimers;
-	base->reserve_till = base->ntimers;
+	return epoll_wait(base->epfd, base->evs, EV_MAXEVENTS, msec);
+}
 
-	min = NULL;
-	msec = -1;
-	if (base->ntimers) {
-		min = &base->timers[0].tv;
-		msec = min->tv_sec * 1000 + (min->tv_usec + 999) / 1000;
-	}
+static void
+ev_dispatch(int n)
+{
+	int		 i, fd, ev, revents;
 
-	clock_gettime(CLOCK_MONOTONIC, &beg);
-	if ((n = poll(base->pfds, base->len, msec)) == -1) {
-		if (errno != EINTR)
-			return -1;
-	}
+	for (i = 0; i < n && !ev_stop; ++i) {
+		fd = base->evs[i].data.fd;
 
-	if (n == 0 && min)
-		memcpy(&tv, min, sizeof(tv));
-	else {
-		clock_gettime(CLOCK_MONOTONIC, &end);
-		timespecsub(&end, &beg, &elapsed);
-		TIMESPEC_TO_TIMEVAL(&tv, &elapsed);
-	}
+		/* it may have been deleted by a previous callback */
+		if ((size_t)fd >= base->len || base->pfds[fd].fd == -1)
+			continue;
 
-	for (i = 0; i < base->ntimers && !ev_stop; /* nop */) {
-		timersub(&base->timers[i].tv, &tv, &sub);
-		if (sub.tv_sec <= 0) {
-			/*
-			 * delete the timer before calling its
-			 * callback; protects from timer that
-			 * attempt to delete themselves.
-			 */
-			memcpy(&cb, &base->timers[i].cb, sizeof(cb));
-			cancel_timer(i);
-			cb.cb(-1, EV_TIMEOUT, cb.udata);
+		revents = base->evs[i].events;
+		ev = 0;
+		if (revents & (EPOLLIN|EPOLLHUP))
+			ev |= EV_READ;
+		if (revents & EPOLLOUT)
+			ev |= EV_WRITE;
+		/* let the callback find out about the error */
+		if (revents & EPOLLERR)
+			ev |= base->cbs[fd].ev & (EV_READ|EV_WRITE);
+		if (ev == 0)
 			continue;
-		}
 
-		memcpy(&base->timers[i].tv, &sub, sizeof(sub));
-		i++;
+		base->cbs[fd].cb(fd, ev, base->cbs[fd].udata);
 	}
+}
+#else
+static inline int
+ev_wait(int msec)
+{
+	return poll(base->pfds, base->len, msec);
+}
+
+static void
+ev_dispatch(int n)
+{
+	size_t		 i;
 
 	for (i = 0; i < base->len && n > 0 && !ev_stop; ++i) {
 		if (base->pfds[i].fd == -1)
@@ -481,7 +619,54 @@ ev_step(void)
 			    base->cbs[i].udata);
 		}
 	}
+}
+#endif
+
+int
+ev_step(void)
+{
+	struct timeval	 now, tv;
+	struct evtimer	*evt;
+	struct evcb	 cb;
+	int		 n, msec;
+
+	base->tick++;
+
+	msec = -1;
+	if (base->ntimers) {
+		ev_now(&now);
+		timersub(&base->timers[0]->deadline, &now, &tv);
+		if (tv.tv_sec < 0)
+			msec = 0;
+		else if (tv.tv_sec >= INT_MAX / 1000 - 1)
+			msec = INT_MAX;
+		else
+			msec = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+	}
+
+	if ((n = ev_wait(msec)) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+
+	ev_now(&now);
+	while (base->ntimers && !ev_stop) {
+		evt = base->timers[0];
+		if (evt->tick == base->tick ||
+		    timercmp(&evt->deadline, &now, >))
+			break;
+
+		/*
+		 * delete the timer before calling its callback;
+		 * protects from timer that attempt to delete
+		 * themselves.
+		 */
+		memcpy(&cb, &evt->cb, sizeof(cb));
+		ev_timer_cancel(evt->id);
+		cb.cb(-1, EV_TIMEOUT, cb.udata);
+	}
 
+	ev_dispatch(n);
 	return (0);
 }
 
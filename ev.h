@@ -30,8 +30,15 @@ struct timeval;
 #define EV_SIGNAL	0x4
 #define EV_TIMEOUT	0x8
 
+/*
+ * Only call back when new data arrives, for the fds whose callbacks
+ * read or write until EAGAIN.  Ignored without epoll.
+ */
+#define EV_EDGE		0x10
+
 int		ev_init(void);
 int		ev_add(int, int, void(*)(int, int, void *), void *);
+int		ev_mod(int, int);
 int		ev_signal(int, void(*)(int, int, void * ), void *);
 unsigned int	ev_timer(const struct timeval *, void(*)(int, int, void *),
 		    void *);
@@ -39,6 +46,5 @@ int		ev_timer_pending(unsigned int);
 int		ev_timer_cancel(unsigned int);
 int		ev_del(int);
 int		ev_step(void);
-int		ev_step(void);
 int		ev_loop(void);
 void		ev_break(void);
@@ -0,0 +1,1215 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <imsg.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "amused.h"
+#include "control.h"
+#include "ev.h"
+#include "library.h"
+#include "log.h"
+#include "player.h"
+#include "playlist.h"
+#include "tags.h"
+#include "walk.h"
+#include "watch.h"
+#include "xmalloc.h"
+
+/*
+ * The index is stored by columns, so that a query only goes through
+ * the ones it needs:
+ *
+ *	struct lib_hdr
+ *	uint64_t mtime[nents], size[nents]
+ *	uint64_t dirmtime[ndirs]
+ *	uint32_t col[LIB_NCOLS][nents]
+ *	uint32_t dirs[ndirs]
+ *	uint32_t roots[nroots]
+ *	the string table
+ *
+ * The string columns, the directories and the roots are offsets in
+ * the string table, where each string appears only once, and the first
+ * is the empty one.  The entries and the directories are sorted by
+ * path as walk() finds them, so a subtree is always contiguous.  The
+ * file in the cache directory is mapped at startup.
+ *
+ * A scan walks the roots in a thread and builds a new index, reusing
+ * the entries of the files whose mtime and size didn't change, that
+ * replaces the current one once done.  An update instead only reads
+ * again the directories the watcher saw changing, without descending
+ * in the subdirectories it already knows, and keeps the rest as it is.
+ * Reading the tags isn't thread-safe, so there's only one scan at a
+ * time.
+ */
+
+#ifndef nitems
+#define nitems(x) (sizeof(x)/sizeof(x[0]))
+#endif
+
+enum {
+	LIB_PATH,
+	LIB_TITLE,
+	LIB_ARTIST,
+	LIB_ALBUM,
+	LIB_TRACK,
+	LIB_DURATION,
+	LIB_RATE,
+	LIB_CODEC,
+	LIB_NCOLS,
+};
+
+#define LIB_NSTR	(LIB_ALBUM + 1)		/* string columns */
+#define LIB_NOVAL	UINT32_MAX		/* no codec */
+
+#define LIB_ENTSZ	(2 * 8 + LIB_NCOLS * 4)
+#define LIB_DIRSZ	(8 + 4)
+
+struct lib_hdr {
+	char		 magic[8];
+	uint32_t	 nents;
+	uint32_t	 nroots;
+	uint32_t	 ndirs;
+	uint32_t	 pad;
+	uint64_t	 strsz;
+};
+
+struct library {
+	char		*base;
+	size_t		 len;
+	int		 mapped;
+	uint32_t	 nents;
+	uint32_t	 nroots;
+	uint32_t	 ndirs;
+	const uint64_t	*mtime;
+	const uint64_t	*size;
+	const uint64_t	*dmtime;
+	const uint32_t	*col[LIB_NCOLS];
+	const uint32_t	*dirs;
+	const uint32_t	*roots;
+	const char	*str;
+	size_t		 strsz;
+};
+
+/* a library being built */
+struct libbuild {
+	uint64_t	*mtime;
+	uint64_t	*size;
+	uint32_t	*col[LIB_NCOLS];
+	size_t		 nents;
+	size_t		 cap;
+	uint64_t	*dmtime;
+	uint32_t	*dirs;
+	size_t		 ndirs;
+	size_t		 dcap;
+	uint32_t	*roots;
+	size_t		 nroots;
+	char		*str;
+	size_t		 strsz;
+	size_t		 strcap;
+	uint32_t	*ht;		/* string offset + 1, or 0 */
+	size_t		 htsz;
+	size_t		 htlen;
+};
+
+/* the entries or the directories of the current library by path */
+struct pathidx {
+	uint32_t	*tab;		/* index + 1, or 0 */
+	size_t		 sz;
+	const uint32_t	*off;		/* path of each one */
+};
+
+#define MARK_SEEN	0x1		/* still in its parent */
+#define MARK_DONE	0x2		/* read again */
+#define MARK_GONE	0x4		/* removed */
+
+struct scan {
+	pthread_t	 thread;
+	int		 pipe[2];
+	struct libbuild	 b;
+	struct pathidx	 old;
+	struct pathidx	 olddirs;
+	int		 update;
+	int		 poll;		/* check every directory and file */
+	char		**dirty;	/* directories to read again */
+	size_t		 ndirty;
+	uint8_t		*mark;		/* for each of the current dirs */
+	uint32_t	*fresh;		/* paths of the new tracks */
+	size_t		 nfresh;
+	uint32_t	*newdirs;
+	size_t		 nnewdirs;
+	char		*out;
+	size_t		 outlen;
+};
+
+#define LIB_TERM_ANY	0		/* bare word: any string column */
+
+struct libterm {
+	int		 col;
+	int		 op;		/* '=', '~' or LIB_TERM_ANY */
+	const char	*val;
+	unsigned int	 num;
+	uint32_t	 last;		/* last string offset checked */
+	int		 lastres;
+};
+
+static const char	 magic[8] = "AMLIB002";
+static const char	*codecs[] = {
+	[FORMAT_FLAC] = "flac",
+	[FORMAT_MP3] = "mp3",
+	[FORMAT_WAV] = "wav",
+	[FORMAT_OPUS] = "opus",
+	[FORMAT_OGGVORBIS] = "vorbis",
+};
+static const char	*colnames[LIB_NCOLS] = {
+	[LIB_PATH] = "path",
+	[LIB_TITLE] = "title",
+	[LIB_ARTIST] = "artist",
+	[LIB_ALBUM] = "album",
+	[LIB_TRACK] = "track",
+	[LIB_DURATION] = "duration",
+	[LIB_RATE] = "rate",
+	[LIB_CODEC] = "codec",
+};
+
+static struct library	 lib;
+static int		 libfd = -1;
+static struct scan	*scan;
+
+static uint32_t
+strhash(const char *s, size_t len)
+{
+	uint32_t	 h = 2166136261U;
+
+	for (; len > 0; --len, ++s)
+		h = (h ^ (uint8_t)*s) * 16777619U;
+	return h;
+}
+
+static inline int
+pathchr(unsigned char c)
+{
+	if (c == '/')
+		return 1;
+	return c == '\0' ? 0 : c + 1;
+}
+
+/* like strcmp(3), but with '/' sorting first as walk() does */
+static int
+pathcmp(const char *a, const char *b)
+{
+	for (; *a == *b; ++a, ++b)
+		if (*a == '\0')
+			return 0;
+	return pathchr(*a) - pathchr(*b);
+}
+
+/* whether path is inside dir */
+static int
+pathunder(const char *path, const char *dir, size_t dirlen)
+{
+	return !strncmp(path, dir, dirlen) && path[dirlen] == '/';
+}
+
+static const char *
+codec_name(uint32_t codec)
+{
+	if (codec >= nitems(codecs) || codecs[codec] == NULL)
+		return "";
+	return codecs[codec];
+}
+
+static int
+lib_attach(struct library *l, char *base, size_t len, int mapped)
+{
+	struct lib_hdr	 hdr;
+	const char	*p;
+	size_t		 need, i, c;
+
+	if (len < sizeof(hdr))
+		return -1;
+	memcpy(&hdr, base, sizeof(hdr));
+	if (memcmp(hdr.magic, magic, sizeof(magic)) != 0 ||
+	    hdr.strsz == 0 || hdr.strsz > len ||
+	    hdr.nents > (len - hdr.strsz) / LIB_ENTSZ ||
+	    hdr.ndirs > (len - hdr.strsz) / LIB_DIRSZ ||
+	    hdr.nroots > (len - hdr.strsz) / 4)
+		return -1;
+
+	need = sizeof(hdr) + (size_t)hdr.nents * LIB_ENTSZ +
+	    (size_t)hdr.ndirs * LIB_DIRSZ + hdr.nroots * 4 + hdr.strsz;
+	if (need != len)
+		return -1;
+
+	memset(l, 0, sizeof(*l));
+	l->base = base;
+	l->len = len;
+	l->mapped = mapped;
+	l->nents = hdr.nents;
+	l->nroots = hdr.nroots;
+	l->ndirs = hdr.ndirs;
+
+	p = base + sizeof(hdr);
+	l->mtime = (const uint64_t *)p;
+	p += hdr.nents * 8;
+	l->size = (const uint64_t *)p;
+	p += hdr.nents * 8;
+	l->dmtime = (const uint64_t *)p;
+	p += hdr.ndirs * 8;
+	for (c = 0; c < LIB_NCOLS; ++c) {
+		l->col[c] = (const uint32_t *)p;
+		p += hdr.nents * 4;
+	}
+	l->dirs = (const uint32_t *)p;
+	p += hdr.ndirs * 4;
+	l->roots = (const uint32_t *)p;
+	p += hdr.nroots * 4;
+	l->str = p;
+	l->strsz = hdr.strsz;
+
+	if (l->str[l->strsz - 1] != '\0')
+		return -1;
+	for (c = 0; c < LIB_NSTR; ++c)
+		for (i = 0; i < l->nents; ++i)
+			if (l->col[c][i] >= l->strsz)
+				return -1;
+	for (i = 0; i < l->ndirs; ++i)
+		if (l->dirs[i] >= l->strsz)
+			return -1;
+	for (i = 0; i < l->nroots; ++i)
+		if (l->roots[i] >= l->strsz)
+			return -1;
+	return 0;
+}
+
+static void
+lib_free(struct library *l)
+{
+	if (l->mapped)
+		munmap(l->base, l->len);
+	else
+		free(l->base);
+	memset(l, 0, sizeof(*l));
+}
+
+static const char *
+lib_str(const struct library *l, int col, size_t i)
+{
+	return l->str + l->col[col][i];
+}
+
+static void
+lib_save(void)
+{
+	struct lib_hdr	 hdr;
+	size_t		 len = lib.len - sizeof(hdr);
+
+	if (libfd == -1)
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (pwrite(libfd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    pwrite(libfd, lib.base + sizeof(hdr), len, sizeof(hdr)) !=
+	    (ssize_t)len ||
+	    ftruncate(libfd, lib.len) == -1 ||
+	    pwrite(libfd, lib.base, sizeof(hdr), 0) != sizeof(hdr)) {
+		log_warn("can't write the library");
+		close(libfd);
+		libfd = -1;
+	}
+}
+
+/* hand the directories to the watcher */
+static void
+library_watch(void)
+{
+	const char	**dirs, **roots;
+	size_t		  i;
+
+	dirs = xcalloc(lib.ndirs + 1, sizeof(*dirs));
+	roots = xcalloc(lib.nroots + 1, sizeof(*roots));
+	for (i = 0; i < lib.ndirs; ++i)
+		dirs[i] = lib.str + lib.dirs[i];
+	for (i = 0; i < lib.nroots; ++i)
+		roots[i] = lib.str + lib.roots[i];
+	watch_sync(dirs, lib.ndirs, roots, lib.nroots);
+	free(dirs);
+	free(roots);
+}
+
+/* whether the given path is under one of the roots */
+int
+library_covers(const char *path)
+{
+	const char	*root;
+	size_t		 i;
+
+	for (i = 0; i < lib.nroots; ++i) {
+		root = lib.str + lib.roots[i];
+		if (!strcmp(path, root) ||
+		    pathunder(path, root, strlen(root)))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Load the index from the given file, which is then kept up to date.
+ */
+int
+library_init(int fd)
+{
+	struct stat	 sb;
+	char		*m;
+
+	libfd = fd;
+
+	if (fstat(fd, &sb) == -1) {
+		log_warn("fstat library");
+		return -1;
+	}
+	if (sb.st_size == 0)
+		return 0;
+	if ((uintmax_t)sb.st_size > SIZE_MAX)
+		goto bad;
+
+	m = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED) {
+		log_warn("mmap library");
+		return -1;
+	}
+	if (lib_attach(&lib, m, sb.st_size, 1) == -1) {
+		munmap(m, sb.st_size);
+		goto bad;
+	}
+
+	log_debug("library: %u tracks", lib.nents);
+	library_watch();
+	return 0;
+
+bad:
+	log_warnx("the library index is corrupted, ignoring it");
+	return -1;
+}
+
+static uint32_t
+build_str(struct libbuild *b, const char *s)
+{
+	uint32_t	*ht;
+	size_t		 i, j, len, htsz;
+
+	if (*s == '\0')
+		return 0;
+
+	if (b->htlen >= b->htsz / 2) {
+		htsz = b->htsz ? b->htsz * 2 : 1024;
+		ht = xcalloc(htsz, sizeof(*ht));
+		for (i = 0; i < b->htsz; ++i) {
+			if (b->ht[i] == 0)
+				continue;
+			j = strhash(b->str + b->ht[i] - 1,
+			    strlen(b->str + b->ht[i] - 1)) & (htsz - 1);
+			while (ht[j] != 0)
+				j = (j + 1) & (htsz - 1);
+			ht[j] = b->ht[i];
+		}
+		free(b->ht);
+		b->ht = ht;
+		b->htsz = htsz;
+	}
+
+	len = strlen(s) + 1;
+	for (i = strhash(s, len - 1) & (b->htsz - 1); b->ht[i] != 0;
+	    i = (i + 1) & (b->htsz - 1))
+		if (!strcmp(b->str + b->ht[i] - 1, s))
+			return b->ht[i] - 1;
+
+	if (b->strsz + len > UINT32_MAX - 1)
+		fatalx("library: too many strings");
+	while (b->strsz + len > b->strcap) {
+		b->strcap = b->strcap ? b->strcap * 2 : 64 * 1024;
+		b->str = xreallocarray(b->str, b->strcap, 1);
+	}
+	memcpy(b->str + b->strsz, s, len);
+	b->ht[i] = b->strsz + 1;
+	b->htlen++;
+	b->strsz += len;
+	return b->ht[i] - 1;
+}
+
+static void
+build_init(struct libbuild *b)
+{
+	memset(b, 0, sizeof(*b));
+	b->strcap = 64 * 1024;
+	b->str = xmalloc(b->strcap);
+	b->str[0] = '\0';
+	b->strsz = 1;
+}
+
+static void
+build_root(struct libbuild *b, const char *path)
+{
+	b->roots = xreallocarray(b->roots, b->nroots + 1, 4);
+	b->roots[b->nroots++] = build_str(b, path);
+}
+
+static int
+build_add(struct libbuild *b, const char *path, uint64_t mtime,
+    uint64_t size, const char *strs[LIB_NSTR], const uint32_t *vals)
+{
+	size_t		 c;
+
+	if (b->nents == UINT32_MAX)
+		return -1;
+
+	if (b->nents == b->cap) {
+		b->cap = b->cap ? b->cap * 2 : 1024;
+		b->mtime = xreallocarray(b->mtime, b->cap, 8);
+		b->size = xreallocarray(b->size, b->cap, 8);
+		for (c = 0; c < LIB_NCOLS; ++c)
+			b->col[c] = xreallocarray(b->col[c], b->cap, 4);
+	}
+
+	b->mtime[b->nents] = mtime;
+	b->size[b->nents] = size;
+	b->col[LIB_PATH][b->nents] = build_str(b, path);
+	for (c = LIB_PATH + 1; c < LIB_NSTR; ++c)
+		b->col[c][b->nents] = build_str(b, strs[c]);
+	for (; c < LIB_NCOLS; ++c)
+		b->col[c][b->nents] = vals[c];
+	b->nents++;
+	return 0;
+}
+
+/* add the entry i of the current library as it is */
+static void
+build_copy(struct libbuild *b, size_t i)
+{
+	const char	*strs[LIB_NSTR];
+	uint32_t	 vals[LIB_NCOLS];
+	size_t		 c;
+
+	for (c = 0; c < LIB_NCOLS; ++c) {
+		if (c < LIB_NSTR)
+			strs[c] = lib_str(&lib, c, i);
+		else
+			vals[c] = lib.col[c][i];
+	}
+	build_add(b, lib_str(&lib, LIB_PATH, i), lib.mtime[i], lib.size[i],
+	    strs, vals);
+}
+
+static uint32_t
+build_dir(struct libbuild *b, const char *path, uint64_t mtime)
+{
+	if (b->ndirs == b->dcap) {
+		b->dcap = b->dcap ? b->dcap * 2 : 256;
+		b->dmtime = xreallocarray(b->dmtime, b->dcap, 8);
+		b->dirs = xreallocarray(b->dirs, b->dcap, 4);
+	}
+	b->dmtime[b->ndirs] = mtime;
+	b->dirs[b->ndirs] = build_str(b, path);
+	return b->dirs[b->ndirs++];
+}
+
+static const char	*sortstr;	/* for permcmp */
+static const uint32_t	*sortkey;
+
+static int
+permcmp(const void *a, const void *b)
+{
+	uint32_t	 ia = *(const uint32_t *)a, ib = *(const uint32_t *)b;
+
+	return pathcmp(sortstr + sortkey[ia], sortstr + sortkey[ib]);
+}
+
+/* the order of the paths in key, or NULL if they're already sorted */
+static uint32_t *
+build_order(struct libbuild *b, const uint32_t *key, size_t n)
+{
+	uint32_t	*perm;
+	size_t		 i;
+
+	for (i = 1; i < n; ++i)
+		if (pathcmp(b->str + key[i - 1], b->str + key[i]) > 0)
+			break;
+	if (i >= n)
+		return NULL;
+
+	perm = xcalloc(n, sizeof(*perm));
+	for (i = 0; i < n; ++i)
+		perm[i] = i;
+	sortstr = b->str;
+	sortkey = key;
+	qsort(perm, n, sizeof(*perm), permcmp);
+	return perm;
+}
+
+/* copy n elements of size sz from src to dst in the given order */
+static void
+permute(char *dst, const char *src, size_t n, size_t sz,
+    const uint32_t *perm)
+{
+	size_t		 i;
+
+	if (perm == NULL) {
+		memcpy(dst, src, n * sz);
+		return;
+	}
+	for (i = 0; i < n; ++i)
+		memcpy(dst + i * sz, src + perm[i] * sz, sz);
+}
+
+/* lay out b in a single buffer, freeing it */
+static char *
+build_finish(struct libbuild *b, size_t *len)
+{
+	struct lib_hdr	 hdr;
+	uint32_t	*ents, *dirs;
+	char		*buf, *p;
+	size_t		 c;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, magic, sizeof(hdr.magic));
+	hdr.nents = b->nents;
+	hdr.nroots = b->nroots;
+	hdr.ndirs = b->ndirs;
+	hdr.strsz = b->strsz;
+
+	*len = sizeof(hdr) + b->nents * LIB_ENTSZ + b->ndirs * LIB_DIRSZ +
+	    b->nroots * 4 + b->strsz;
+	p = buf = xmalloc(*len);
+
+	/* updates append what they find at the end */
+	ents = build_order(b, b->col[LIB_PATH], b->nents);
+	dirs = build_order(b, b->dirs, b->ndirs);
+
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+	permute(p, (char *)b->mtime, b->nents, 8, ents);
+	p += b->nents * 8;
+	permute(p, (char *)b->size, b->nents, 8, ents);
+	p += b->nents * 8;
+	permute(p, (char *)b->dmtime, b->ndirs, 8, dirs);
+	p += b->ndirs * 8;
+	for (c = 0; c < LIB_NCOLS; ++c) {
+		permute(p, (char *)b->col[c], b->nents, 4, ents);
+		p += b->nents * 4;
+		free(b->col[c]);
+	}
+	permute(p, (char *)b->dirs, b->ndirs, 4, dirs);
+	p += b->ndirs * 4;
+	memcpy(p, b->roots, b->nroots * 4);
+	p += b->nroots * 4;
+	memcpy(p, b->str, b->strsz);
+
+	free(ents);
+	free(dirs);
+	free(b->mtime);
+	free(b->size);
+	free(b->dmtime);
+	free(b->dirs);
+	free(b->roots);
+	free(b->str);
+	free(b->ht);
+	memset(b, 0, sizeof(*b));
+	return buf;
+}
+
+static void
+pathidx_init(struct pathidx *x, const uint32_t *off, size_t n)
+{
+	const char	*path;
+	size_t		 i, j;
+
+	memset(x, 0, sizeof(*x));
+	if (n == 0)
+		return;
+
+	for (x->sz = 1024; x->sz < n * 2; x->sz *= 2)
+		/* nop */ ;
+	x->tab = xcalloc(x->sz, sizeof(*x->tab));
+	x->off = off;
+	for (i = 0; i < n; ++i) {
+		path = lib.str + off[i];
+		j = strhash(path, strlen(path)) & (x->sz - 1);
+		while (x->tab[j] != 0)
+			j = (j + 1) & (x->sz - 1);
+		x->tab[j] = i + 1;
+	}
+}
+
+/* the index of the first len bytes of path in x, or -1 */
+static ssize_t
+pathidx_find(struct pathidx *x, const char *path, size_t len)
+{
+	const char	*p;
+	size_t		 i;
+	uint32_t	 e;
+
+	if (x->sz == 0)
+		return -1;
+	for (i = strhash(path, len) & (x->sz - 1); (e = x->tab[i]) != 0;
+	    i = (i + 1) & (x->sz - 1)) {
+		p = lib.str + x->off[e - 1];
+		if (!strncmp(p, path, len) && p[len] == '\0')
+			return e - 1;
+	}
+	return -1;
+}
+
+static void
+scan_track(struct scan *s, const char *path)
+{
+	struct stat	 sb;
+	struct tags	 t;
+	const char	*strs[LIB_NSTR];
+	uint32_t	 vals[LIB_NCOLS];
+	ssize_t		 o;
+
+	if (stat(path, &sb) == -1)
+		return;
+
+	o = pathidx_find(&s->old, path, strlen(path));
+	if (o != -1 &&
+	    lib.mtime[o] == (uint64_t)sb.st_mtime &&
+	    lib.size[o] == (uint64_t)sb.st_size) {
+		build_copy(&s->b, o);
+		return;
+	}
+
+	if (tags_read(path, &t) == -1)
+		return;
+	strs[LIB_TITLE] = t.title;
+	strs[LIB_ARTIST] = t.artist;
+	strs[LIB_ALBUM] = t.album;
+	vals[LIB_TRACK] = t.track;
+	vals[LIB_DURATION] = t.duration;
+	vals[LIB_RATE] = t.rate;
+	vals[LIB_CODEC] = t.codec == -1 ? LIB_NOVAL : (uint32_t)t.codec;
+	if (build_add(&s->b, path, sb.st_mtime, sb.st_size, strs, vals) == -1)
+		return;
+
+	if (s->update && o == -1) {
+		s->fresh = xreallocarray(s->fresh, s->nfresh + 1, 4);
+		s->fresh[s->nfresh++] = s->b.col[LIB_PATH][s->b.nents - 1];
+	}
+}
+
+/* called by walk() */
+static void
+scan_file(const char *path, int isdir, void *arg)
+{
+	struct scan	*s = arg;
+	struct stat	 sb;
+	uint32_t	 off;
+
+	if (!isdir) {
+		scan_track(s, path);
+		return;
+	}
+
+	if (stat(path, &sb) == -1)
+		return;
+	off = build_dir(&s->b, path, sb.st_mtime);
+	if (s->update) {
+		s->newdirs = xreallocarray(s->newdirs, s->nnewdirs + 1, 4);
+		s->newdirs[s->nnewdirs++] = off;
+	}
+}
+
+/* called by walk_list() when reading again a directory */
+static void
+scan_list(const char *path, int isdir, void *arg)
+{
+	struct scan	*s = arg;
+	ssize_t		 d;
+
+	if (!isdir)
+		scan_track(s, path);
+	else if ((d = pathidx_find(&s->olddirs, path, strlen(path))) != -1)
+		s->mark[d] |= MARK_SEEN;
+	else
+		walk(path, scan_file, s);
+}
+
+/* drop the current directory d and all its subdirectories */
+static void
+scan_drop(struct scan *s, size_t d)
+{
+	const char	*path = lib.str + lib.dirs[d];
+	size_t		 i, len = strlen(path);
+
+	s->mark[d] |= MARK_GONE;
+	for (i = d + 1; i < lib.ndirs; ++i) {
+		if (!pathunder(lib.str + lib.dirs[i], path, len))
+			break;
+		s->mark[i] |= MARK_GONE;
+	}
+}
+
+/* read again the current directory d */
+static void
+scan_relist(struct scan *s, size_t d)
+{
+	struct stat	 sb;
+	const char	*path = lib.str + lib.dirs[d], *p;
+	size_t		 i, len = strlen(path);
+
+	if (stat(path, &sb) == -1 || !S_ISDIR(sb.st_mode) ||
+	    walk_list(path, scan_list, s) == -1) {
+		scan_drop(s, d);
+		return;
+	}
+	s->mark[d] |= MARK_DONE;
+	build_dir(&s->b, path, sb.st_mtime);
+
+	/* the subdirectories not seen are gone */
+	for (i = d + 1; i < lib.ndirs; ++i) {
+		p = lib.str + lib.dirs[i];
+		if (!pathunder(p, path, len))
+			break;
+		if (strchr(p + len + 1, '/') != NULL)
+			continue;
+		if (!(s->mark[i] & MARK_SEEN))
+			scan_drop(s, i);
+		s->mark[i] &= ~MARK_SEEN;
+	}
+}
+
+static int
+dirtycmp(const void *a, const void *b)
+{
+	return pathcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void
+scan_update(struct scan *s)
+{
+	struct stat	 sb;
+	const char	*path, *slash;
+	size_t		 i;
+	ssize_t		 d;
+
+	if (s->poll) {
+		for (i = 0; i < lib.ndirs; ++i) {
+			path = lib.str + lib.dirs[i];
+			if (stat(path, &sb) == 0 && S_ISDIR(sb.st_mode) &&
+			    lib.dmtime[i] == (uint64_t)sb.st_mtime)
+				continue;
+			s->dirty = xreallocarray(s->dirty, s->ndirty + 1,
+			    sizeof(*s->dirty));
+			s->dirty[s->ndirty++] = xstrdup(path);
+		}
+	}
+
+	/* parents first, so the subdirectories are dropped only once */
+	qsort(s->dirty, s->ndirty, sizeof(*s->dirty), dirtycmp);
+	for (i = 0; i < s->ndirty; ++i) {
+		d = pathidx_find(&s->olddirs, s->dirty[i],
+		    strlen(s->dirty[i]));
+		if (d != -1 && !(s->mark[d] & (MARK_DONE|MARK_GONE)))
+			scan_relist(s, d);
+	}
+
+	for (i = 0; i < lib.ndirs; ++i)
+		if (!(s->mark[i] & (MARK_DONE|MARK_GONE)))
+			build_dir(&s->b, lib.str + lib.dirs[i],
+			    lib.dmtime[i]);
+
+	for (i = 0; i < lib.nents; ++i) {
+		path = lib_str(&lib, LIB_PATH, i);
+		if ((slash = strrchr(path, '/')) != NULL &&
+		    (d = pathidx_find(&s->olddirs, path, slash - path)) != -1 &&
+		    (s->mark[d] & (MARK_DONE|MARK_GONE)))
+			continue;
+		if (s->poll)
+			scan_track(s, path);
+		else
+			build_copy(&s->b, i);
+	}
+}
+
+static void *
+scan_run(void *arg)
+{
+	struct scan	*s = arg;
+	size_t		 i;
+
+	if (s->update)
+		scan_update(s);
+	else
+		for (i = 0; i < s->b.nroots; ++i)
+			walk(s->b.str + s->b.roots[i], scan_file, s);
+
+	s->out = build_finish(&s->b, &s->outlen);
+
+	/* wake up the main thread */
+	if (write(s->pipe[1], "", 1) == -1)
+		fatal("write");
+	return NULL;
+}
+
+static int
+freshcmp(const void *a, const void *b)
+{
+	return pathcmp(lib.str + *(const uint32_t *)a,
+	    lib.str + *(const uint32_t *)b);
+}
+
+/* enqueue the new tracks in the watch folders */
+static void
+scan_enqueue(struct scan *s)
+{
+	const char	*path;
+	size_t		 i, n = 0;
+
+	qsort(s->fresh, s->nfresh, sizeof(*s->fresh), freshcmp);
+	for (i = 0; i < s->nfresh; ++i) {
+		path = lib.str + s->fresh[i];
+		if (!watch_folder(path))
+			continue;
+		playlist_enqueue(path);
+		control_notify(IMSG_CTL_ADD);
+		n++;
+	}
+
+	if (n != 0) {
+		log_debug("enqueued %zu new tracks", n);
+		main_preload();
+	}
+}
+
+static void
+scan_done(int fd, int event, void *arg)
+{
+	struct scan	*s = scan;
+	char		 ch;
+	size_t		 i;
+	uint64_t	 n;
+
+	if (read(fd, &ch, 1) == -1)
+		return;
+
+	if ((errno = pthread_join(s->thread, NULL)) != 0)
+		fatal("pthread_join");
+	ev_del(s->pipe[0]);
+	close(s->pipe[0]);
+	close(s->pipe[1]);
+
+	lib_free(&lib);
+	if (lib_attach(&lib, s->out, s->outlen, 0) == -1)
+		fatalx("%s: built a bad index", __func__);
+	lib_save();
+
+	if (s->update) {
+		for (i = 0; i < s->nnewdirs; ++i)
+			watch_add(lib.str + s->newdirs[i]);
+		scan_enqueue(s);
+		log_debug("library: %u tracks, %zu new", lib.nents,
+		    s->nfresh);
+	} else {
+		library_watch();
+		n = lib.nents;
+		log_info("library: %u tracks", lib.nents);
+		control_scandone(n);
+	}
+
+	for (i = 0; i < s->ndirty; ++i)
+		free(s->dirty[i]);
+	free(s->dirty);
+	free(s->mark);
+	free(s->fresh);
+	free(s->newdirs);
+	free(s->old.tab);
+	free(s->olddirs.tab);
+	free(s);
+	scan = NULL;
+}
+
+static void
+scan_start(struct scan *s)
+{
+	pathidx_init(&s->old, lib.col[LIB_PATH], lib.nents);
+	if (s->update) {
+		pathidx_init(&s->olddirs, lib.dirs, lib.ndirs);
+		s->mark = xcalloc(lib.ndirs + 1, 1);
+	}
+
+	if (pipe(s->pipe) == -1)
+		fatal("pipe");
+	ev_add(s->pipe[0], EV_READ, scan_done, NULL);
+
+	scan = s;
+	if ((errno = pthread_create(&s->thread, NULL, scan_run, s)) != 0)
+		fatal("pthread_create");
+}
+
+/*
+ * Start a scan of the roots in the IMSG_CTL_SCAN message, or of the
+ * ones of the last scan if none are given.
+ */
+int
+library_scan(struct imsg *imsg, const char **errstr)
+{
+	struct scan	*s;
+	struct stat	 sb;
+	struct ibuf	 ibuf;
+	const char	*p = NULL, *end = NULL;
+	size_t		 i, len;
+
+	if (scan != NULL) {
+		*errstr = "a scan is already running";
+		return -1;
+	}
+
+	if ((len = imsg_get_len(imsg)) != 0) {
+		if (imsg_get_ibuf(imsg, &ibuf) == -1 ||
+		    ((const char *)ibuf_data(&ibuf))[len - 1] != '\0') {
+			*errstr = "malformed request";
+			return -1;
+		}
+		p = ibuf_data(&ibuf);
+		end = p + len;
+	}
+
+	for (; p < end; p += strlen(p) + 1) {
+		if (*p != '/' || stat(p, &sb) == -1 || !S_ISDIR(sb.st_mode)) {
+			*errstr = "not a directory";
+			return -1;
+		}
+	}
+
+	s = xcalloc(1, sizeof(*s));
+	build_init(&s->b);
+
+	if (len == 0) {
+		for (i = 0; i < lib.nroots; ++i)
+			build_root(&s->b, lib.str + lib.roots[i]);
+	} else {
+		for (p = ibuf_data(&ibuf); p < end; p += strlen(p) + 1)
+			build_root(&s->b, p);
+	}
+
+	if (s->b.nroots == 0) {
+		free(build_finish(&s->b, &len));
+		free(s);
+		*errstr = "no directories to scan";
+		return -1;
+	}
+
+	scan_start(s);
+	return 0;
+}
+
+/*
+ * Read again the given directories, taking ownership of the array, or
+ * check all of them when poll is set.  Fails if a scan is already
+ * running.
+ */
+int
+library_update(char **dirty, size_t ndirty, int poll)
+{
+	struct scan	*s;
+	size_t		 i;
+
+	if (scan != NULL)
+		return -1;
+
+	if (lib.ndirs == 0) {
+		for (i = 0; i < ndirty; ++i)
+			free(dirty[i]);
+		free(dirty);
+		return 0;
+	}
+
+	s = xcalloc(1, sizeof(*s));
+	build_init(&s->b);
+	for (i = 0; i < lib.nroots; ++i)
+		build_root(&s->b, lib.str + lib.roots[i]);
+	s->update = 1;
+	s->poll = poll;
+	s->dirty = dirty;
+	s->ndirty = ndirty;
+
+	scan_start(s);
+	return 0;
+}
+
+static int
+term_parse(struct libterm *t, const char *s)
+{
+	const char	*op, *errstr;
+	size_t		 len;
+
+	memset(t, 0, sizeof(*t));
+	t->last = UINT32_MAX;
+
+	if ((op = strpbrk(s, "=~")) == NULL) {
+		t->col = LIB_PATH;
+		t->op = LIB_TERM_ANY;
+		t->val = s;
+		return 0;
+	}
+
+	len = op - s;
+	for (t->col = 0; t->col < LIB_NCOLS; ++t->col)
+		if (strlen(colnames[t->col]) == len &&
+		    !strncmp(colnames[t->col], s, len))
+			break;
+	if (t->col == LIB_NCOLS)
+		return -1;
+
+	t->op = *op;
+	t->val = op + 1;
+	if (t->col >= LIB_NSTR && t->col != LIB_CODEC) {
+		t->num = strtonum(t->val, 0, UINT32_MAX, &errstr);
+		if (errstr != NULL)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+term_strmatch(struct libterm *t, const char *s)
+{
+	if (t->op == '=')
+		return !strcasecmp(s, t->val);
+	return strcasestr(s, t->val) != NULL;
+}
+
+static int
+term_match(struct libterm *t, size_t i)
+{
+	uint32_t	 off;
+	int		 c;
+
+	if (t->op == LIB_TERM_ANY) {
+		for (c = 0; c < LIB_NSTR; ++c)
+			if (strcasestr(lib_str(&lib, c, i), t->val) != NULL)
+				return 1;
+		return 0;
+	}
+
+	if (t->col == LIB_CODEC)
+		return term_strmatch(t, codec_name(lib.col[t->col][i]));
+	if (t->col >= LIB_NSTR)
+		return lib.col[t->col][i] == t->num;
+
+	/* the strings are shared: consecutive tracks of the same album */
+	off = lib.col[t->col][i];
+	if (off != t->last) {
+		t->last = off;
+		t->lastres = term_strmatch(t, lib.str + off);
+	}
+	return t->lastres;
+}
+
+static void
+find_reply(struct imsgev *iev, size_t i)
+{
+	struct player_track	 pt;
+	struct ibuf		*wbuf;
+	const char		*codec;
+	int			 c;
+
+	memset(&pt, 0, sizeof(pt));
+	pt.track = lib.col[LIB_TRACK][i];
+	pt.duration = lib.col[LIB_DURATION][i];
+	pt.rate = lib.col[LIB_RATE][i];
+	codec = codec_name(lib.col[LIB_CODEC][i]);
+
+	if ((wbuf = imsg_create(&iev->imsgbuf, IMSG_CTL_FIND, 0, 0,
+	    sizeof(pt) + PATH_MAX + LIB_NSTR * TAGS_MAXLEN)) == NULL ||
+	    imsg_add(wbuf, &pt, sizeof(pt)) == -1)
+		fatal("imsg_create");
+	for (c = 0; c < LIB_NSTR; ++c)
+		if (imsg_add(wbuf, lib_str(&lib, c, i),
+		    strlen(lib_str(&lib, c, i)) + 1) == -1)
+			fatal("imsg_add");
+	if (imsg_add(wbuf, codec, strlen(codec) + 1) == -1)
+		fatal("imsg_add");
+	imsg_close(&iev->imsgbuf, wbuf);
+}
+
+/*
+ * Answer an IMSG_CTL_FIND: enqueue the matching tracks, or just list
+ * them, then reply with the count.
+ */
+void
+library_find(struct imsgev *iev, struct imsg *imsg)
+{
+	struct player_find	 pf;
+	struct libterm		*terms = NULL;
+	struct ibuf		 ibuf;
+	const char		*p, *end;
+	size_t			 i, j, len, nterms = 0;
+	uint64_t		 n = 0;
+
+	if (imsg_get_ibuf(imsg, &ibuf) == -1 ||
+	    ibuf_get(&ibuf, &pf, sizeof(pf)) == -1 ||
+	    (len = ibuf_size(&ibuf)) == 0 ||
+	    ((const char *)ibuf_data(&ibuf))[len - 1] != '\0') {
+		main_senderr(iev, "malformed request");
+		return;
+	}
+	p = ibuf_data(&ibuf);
+	end = p + len;
+
+	for (; p < end; p += strlen(p) + 1) {
+		terms = xreallocarray(terms, nterms + 1, sizeof(*terms));
+		if (term_parse(&terms[nterms++], p) == -1) {
+			main_senderr(iev, "bad query");
+			free(terms);
+			return;
+		}
+	}
+
+	for (i = 0; i < lib.nents; ++i) {
+		for (j = 0; j < nterms; ++j)
+			if (!term_match(&terms[j], i))
+				break;
+		if (j != nterms)
+			continue;
+
+		n++;
+		if (pf.list)
+			find_reply(iev, i);
+		else {
+			playlist_enqueue(lib_str(&lib, LIB_PATH, i));
+			control_notify(IMSG_CTL_ADD);
+		}
+	}
+	free(terms);
+
+	if (n != 0 && !pf.list)
+		main_preload();
+	imsg_compose_event(iev, IMSG_CTL_FIND, 0, 0, -1, &n, sizeof(n));
+}
@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <endian.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PCM_NEON 1
+#endif
+
+#if defined(__SSE2__) || defined(PCM_NEON)
+#define PCM_SIMD 1
+#endif
+
+#include "pcm.h"
+
+/*
+ * The vector kernels handle the common mono and stereo cases and
+ * leave the tail, or anything else, to the scalar loops.  Which ones
+ * are used is decided at compile time.
+ */
+
+size_t
+pcm_bps(unsigned int bits)
+{
+	if (bits <= 8)
+		return 1;
+	if (bits <= 16)
+		return 2;
+	return 4;
+}
+
+#ifdef PCM_SIMD
+static size_t
+planar_s16(int16_t *d, const int32_t * const *src, size_t off, size_t n,
+    int chans)
+{
+	const int32_t	*l = src[0] + off, *r = src[chans - 1] + off;
+	size_t		 i = 0;
+
+	if (chans > 2)
+		return 0;
+
+#if defined(__AVX2__)
+	if (chans == 1) {
+		for (; i + 16 <= n; i += 16) {
+			__m256i a, b, x;
+
+			a = _mm256_loadu_si256((const __m256i *)(l + i));
+			b = _mm256_loadu_si256((const __m256i *)(l + i + 8));
+			x = _mm256_packs_epi32(a, b);
+			x = _mm256_permute4x64_epi64(x, 0xd8);
+			_mm256_storeu_si256((__m256i *)(d + i), x);
+		}
+		return i;
+	}
+	for (; i + 8 <= n; i += 8) {
+		__m256i a, b, x, y;
+
+		a = _mm256_loadu_si256((const __m256i *)(l + i));
+		b = _mm256_loadu_si256((const __m256i *)(r + i));
+		x = _mm256_unpacklo_epi32(a, b);
+		y = _mm256_unpackhi_epi32(a, b);
+		_mm256_storeu_si256((__m256i *)(d + 2 * i),
+		    _mm256_packs_epi32(x, y));
+	}
+#elif defined(__SSE2__)
+	if (chans == 1) {
+		for (; i + 8 <= n; i += 8) {
+			__m128i a, b;
+
+			a = _mm_loadu_si128((const __m128i *)(l + i));
+			b = _mm_loadu_si128((const __m128i *)(l + i + 4));
+			_mm_storeu_si128((__m128i *)(d + i),
+			    _mm_packs_epi32(a, b));
+		}
+		return i;
+	}
+	for (; i + 4 <= n; i += 4) {
+		__m128i a, b, x, y;
+
+		a = _mm_loadu_si128((const __m128i *)(l + i));
+		b = _mm_loadu_si128((const __m128i *)(r + i));
+		x = _mm_unpacklo_epi32(a, b);
+		y = _mm_unpackhi_epi32(a, b);
+		_mm_storeu_si128((__m128i *)(d + 2 * i), _mm_packs_epi32(x, y));
+	}
+#elif defined(PCM_NEON)
+	for (; i + 4 <= n; i += 4) {
+		int16x4x2_t	 v;
+
+		v.val[0] = vqmovn_s32(vld1q_s32(l + i));
+		if (chans == 1) {
+			vst1_s16(d + i, v.val[0]);
+			continue;
+		}
+		v.val[1] = vqmovn_s32(vld1q_s32(r + i));
+		vst2_s16(d + 2 * i, v);
+	}
+#endif
+
+	return i;
+}
+
+static size_t
+planar_s32(int32_t *d, const int32_t * const *src, size_t off, size_t n,
+    int chans)
+{
+	const int32_t	*l = src[0] + off, *r = src[chans - 1] + off;
+	size_t		 i = 0;
+
+	if (chans != 2)
+		return 0;
+
+#if defined(__AVX2__)
+	for (; i + 8 <= n; i += 8) {
+		__m256i a, b, x, y;
+
+		a = _mm256_loadu_si256((const __m256i *)(l + i));
+		b = _mm256_loadu_si256((const __m256i *)(r + i));
+		x = _mm256_unpacklo_epi32(a, b);
+		y = _mm256_unpackhi_epi32(a, b);
+		_mm256_storeu_si256((__m256i *)(d + 2 * i),
+		    _mm256_permute2x128_si256(x, y, 0x20));
+		_mm256_storeu_si256((__m256i *)(d + 2 * i + 8),
+		    _mm256_permute2x128_si256(x, y, 0x31));
+	}
+#elif defined(__SSE2__)
+	for (; i + 4 <= n; i += 4) {
+		__m128i a, b;
+
+		a = _mm_loadu_si128((const __m128i *)(l + i));
+		b = _mm_loadu_si128((const __m128i *)(r + i));
+		_mm_storeu_si128((__m128i *)(d + 2 * i),
+		    _mm_unpacklo_epi32(a, b));
+		_mm_storeu_si128((__m128i *)(d + 2 * i + 4),
+		    _mm_unpackhi_epi32(a, b));
+	}
+#elif defined(PCM_NEON)
+	for (; i + 4 <= n; i += 4) {
+		int32x4x2_t	 v;
+
+		v.val[0] = vld1q_s32(l + i);
+		v.val[1] = vld1q_s32(r + i);
+		vst2q_s32(d + 2 * i, v);
+	}
+#endif
+
+	return i;
+}
+#else
+#define planar_s16(d, src, off, n, chans)	0
+#define planar_s32(d, src, off, n, chans)	0
+#endif
+
+static inline int16_t
+clip16(int32_t v)
+{
+	if (v > INT16_MAX)
+		return INT16_MAX;
+	if (v < INT16_MIN)
+		return INT16_MIN;
+	return v;
+}
+
+/*
+ * Interleave n samples per channel starting at off from the planar
+ * 32 bit buffers that libFLAC hands out.
+ */
+void
+pcm_planar32(void *dst, const int32_t * const *src, size_t off, size_t n,
+    int chans, unsigned int bits)
+{
+	int8_t		*d8 = dst;
+	int16_t		*d16 = dst;
+	int32_t		*d32 = dst;
+	size_t		 i;
+	int		 c;
+
+	switch (pcm_bps(bits)) {
+	case 1:
+		for (i = 0; i < n; ++i)
+			for (c = 0; c < chans; ++c)
+				*d8++ = src[c][off + i];
+		break;
+	case 2:
+		i = planar_s16(d16, src, off, n, chans);
+		for (d16 += i * chans; i < n; ++i)
+			for (c = 0; c < chans; ++c)
+				*d16++ = clip16(src[c][off + i]);
+		break;
+	default:
+		if (chans == 1) {
+			memcpy(d32, src[0] + off, n * sizeof(*d32));
+			break;
+		}
+		i = planar_s32(d32, src, off, n, chans);
+		for (d32 += i * chans; i < n; ++i)
+			for (c = 0; c < chans; ++c)
+				*d32++ = src[c][off + i];
+		break;
+	}
+}
+
+/*
+ * Round half to even, as lrintf(3) does in the default rounding mode
+ * and as the vector conversions do, without pulling in libm.  v - r
+ * is exact since |v| < 2^24.
+ */
+static inline int16_t
+float16(float f)
+{
+	float	 v, d;
+	int32_t	 r;
+
+	v = f * 32768.f;
+	if (v >= INT16_MAX)
+		return INT16_MAX;
+	if (v <= INT16_MIN)
+		return INT16_MIN;
+
+	r = v;
+	d = v - r;
+	if (d > 0.5f || (d == 0.5f && (r & 1)))
+		r++;
+	else if (d < -0.5f || (d == -0.5f && (r & 1)))
+		r--;
+	return r;
+}
+
+/* the same for the planar float buffers of libvorbis, with clipping */
+void
+pcm_float16(int16_t *d, float * const *src, size_t off, size_t n,
+    int chans)
+{
+	size_t		 i = 0;
+	int		 c;
+
+#ifdef PCM_SIMD
+	if (chans <= 2) {
+		const float	*l = src[0] + off, *r = src[chans - 1] + off;
+#if defined(__SSE2__)
+		const __m128 k = _mm_set1_ps(32768.f);
+
+		for (; i + 4 <= n; i += 4) {
+			__m128i a, b;
+
+			a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(l + i), k));
+			b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(r + i), k));
+			if (chans == 1) {
+				/* the upper half is garbage */
+				_mm_storel_epi64((__m128i *)(d + i),
+				    _mm_packs_epi32(a, a));
+				continue;
+			}
+			_mm_storeu_si128((__m128i *)(d + 2 * i),
+			    _mm_packs_epi32(_mm_unpacklo_epi32(a, b),
+			    _mm_unpackhi_epi32(a, b)));
+		}
+#elif defined(PCM_NEON)
+		for (; i + 4 <= n; i += 4) {
+			int16x4x2_t	 v;
+
+			v.val[0] = vqmovn_s32(vcvtnq_s32_f32(
+			    vmulq_n_f32(vld1q_f32(l + i), 32768.f)));
+			if (chans == 1) {
+				vst1_s16(d + i, v.val[0]);
+				continue;
+			}
+			v.val[1] = vqmovn_s32(vcvtnq_s32_f32(
+			    vmulq_n_f32(vld1q_f32(r + i), 32768.f)));
+			vst2_s16(d + 2 * i, v);
+		}
+#endif
+	}
+#endif
+
+	for (d += i * chans; i < n; ++i)
+		for (c = 0; c < chans; ++c)
+			*d++ = float16(src[c][off + i]);
+}
+
+/*
+ * Convert n samples from the little endian, packed, format of the wav
+ * files, where 8 bit samples are unsigned.
+ */
+void
+pcm_le(void *dst, const uint8_t *s, size_t n, unsigned int bits)
+{
+	uint8_t		*d8 = dst;
+	int16_t		*d16 = dst;
+	int32_t		*d32 = dst;
+	uint32_t	 u;
+#if BYTE_ORDER != LITTLE_ENDIAN
+	uint16_t	 h;
+#endif
+	size_t		 i;
+
+	switch (bits) {
+	case 8:
+		for (i = 0; i < n; ++i)
+			d8[i] = s[i] ^ 0x80;
+		break;
+	case 16:
+#if BYTE_ORDER == LITTLE_ENDIAN
+		memcpy(d16, s, n * 2);
+#else
+		for (i = 0; i < n; ++i) {
+			memcpy(&h, s + 2 * i, 2);
+			d16[i] = le16toh(h);
+		}
+#endif
+		break;
+	case 24:
+		for (i = 0; i < n; ++i, s += 3) {
+			u = (uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 |
+			    (uint32_t)s[2] << 24;
+			d32[i] = (int32_t)u >> 8;
+		}
+		break;
+	case 32:
+#if BYTE_ORDER == LITTLE_ENDIAN
+		memcpy(d32, s, n * 4);
+#else
+		for (i = 0; i < n; ++i) {
+			memcpy(&u, s + 4 * i, 4);
+			d32[i] = le32toh(u);
+		}
+#endif
+		break;
+	}
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Conversion of the decoded samples to what the audio backends expect:
+ * interleaved, signed and in native byte order, with 8 bits samples
+ * stored in one byte, 16 bits in two and 24 and 32 bits in four.
+ * The destination has to be suitably aligned for the output samples.
+ */
+
+size_t	pcm_bps(unsigned int);
+void	pcm_planar32(void *, const int32_t * const *, size_t, size_t, int,
+	    unsigned int);
+void	pcm_float16(int16_t *, float * const *, size_t, size_t, int);
+void	pcm_le(void *, const uint8_t *, size_t, unsigned int);
@@ -15,13 +15,18 @@
  */
 
 #include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 #include <errno.h>
 #include <imsg.h>
 #include <limits.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -32,37 +37,260 @@
 #include "amused.h"
 #include "audio.h"
 #include "log.h"
+#include "pcm.h"
 #include "player.h"
+#include "ring.h"
+#include "seekidx.h"
 #include "xmalloc.h"
 
+/*
+ * The decoders run in the main thread of the player process and push
+ * the PCM data in a ring, which is drained by the output thread.  The
+ * two threads talk over a socketpair using one-byte messages.
+ */
+#define OUT_WAKE	'w'	/* there's new data in the ring */
+#define OUT_SPACE	's'	/* there's free space in the ring */
+#define OUT_ACK		'a'
+#define OUT_PAUSE	'p'
+#define OUT_RESUME	'r'
+#define OUT_FLUSH	'f'	/* drop the buffered data */
+#define OUT_SEEK	'k'	/* drop the buffered data and go on */
+#define OUT_SETUP	'S'	/* (re)configure the device */
+#define OUT_TRUNC	't'	/* drop what's after output_trunc */
+
+/* how many tracks the main process can enqueue */
+#define PLAYER_QUEUE	4
+
+/* the biggest frame we handle: 32 bits times 64 channels */
+#define PLAYER_MAXFRAME	256
+
+/*
+ * The track being heard is `cur'.  When its decoder is done the next
+ * one in the queue is started right away and its frames are appended
+ * in the ring after the current ones: that's `nxt'.  Positions are in
+ * frames since the audio device was opened.
+ */
+struct track {
+	int			 fd;	/* to restart the decoding */
+	uint32_t		 id;
+	int64_t			 seek;	/* where to start from, or -1 */
+	int64_t			 start;	/* `played' at the beginning */
+	int64_t			 end;	/* `pushed' at the end, or -1 */
+	size_t			 endpos; /* head of the ring at the end */
+	int64_t			 duration;
+	int			 failed;
+	const char		*errstr;
+	struct seekidx		*idx;	/* cached by the main process */
+	struct player_info	 info;
+};
+
 struct pollfd		*player_pfds;
 int			 player_nfds;
 static struct imsgbuf	*imsgbuf;
 
-static int nextfd = -1;
-static int64_t frames;
-static int64_t duration;
-static struct player_info info;
+static struct ring	 ring;
+static pthread_t	 output_tid;
+static int		 output_sp[2];	/* player, output thread */
+static int		 output_err;
+static int		 output_stopped = 1;
+static size_t		 output_trunc;
+static struct player_info output_info;
+static uint8_t		 part[PLAYER_MAXFRAME]; /* incomplete frame */
+static size_t		 npart;
+static atomic_int	 prod_waiting;
+static atomic_int	 cons_waiting;
+
+static struct track	 queue[PLAYER_QUEUE];
+static size_t		 nqueue;
+static struct track	 tracks[2];
+static struct track	*cur;		/* the one being played */
+static struct track	*nxt;		/* the one after it */
+static struct track	*dec;		/* the one being decoded */
+static int		 aborted;	/* the decoder has to stop */
+
+static _Atomic int64_t	 played;
+static int64_t		 pushed;
+static int64_t		 reported;
 
 volatile sig_atomic_t halted;
 
+static void	player_stop(void);
+static void	player_step(int64_t *, int);
+
 static void
 player_signal_handler(int signo)
 {
 	halted = 1;
 }
 
+static int
+output_cmd(int cmd)
+{
+	ssize_t	 r;
+	char	 ch = cmd;
+
+	if (write(output_sp[0], &ch, 1) == -1)
+		fatal("write to the output thread");
+
+	if (cmd == OUT_WAKE || cmd == OUT_PAUSE || cmd == OUT_RESUME)
+		return 0;
+
+	for (;;) {
+		if ((r = read(output_sp[0], &ch, 1)) == -1)
+			fatal("read from the output thread");
+		if (r == 0)
+			fatalx("output thread went away");
+		if (ch == OUT_ACK)
+			return output_err;
+	}
+}
+
+static void
+output_wakeup(void)
+{
+	if (atomic_exchange(&cons_waiting, 0))
+		output_cmd(OUT_WAKE);
+}
+
+/*
+ * Check whether we have to wait for the output thread before making
+ * progress: until there's space for a frame or, if drain is set,
+ * until the ring is empty.  Declares the intent to wait before the
+ * last check so that a wakeup can't be lost.
+ */
+static int
+output_mustwait(int drain)
+{
+	atomic_store(&prod_waiting, 1);
+	if (drain ? ring_used(&ring) == 0 : ring_space(&ring) != 0) {
+		atomic_store(&prod_waiting, 0);
+		return 0;
+	}
+	return 1;
+}
+
+/* wait for the output thread to play everything that was queued */
+static void
+output_sync(void)
+{
+	char	 ch;
+
+	while (output_mustwait(1)) {
+		if (read(output_sp[0], &ch, 1) == -1)
+			fatal("read from the output thread");
+	}
+}
+
+/* drop everything that's buffered */
+static void
+output_flush(int restart)
+{
+	if (output_stopped)
+		return;
+
+	if (restart)
+		output_cmd(OUT_SEEK);
+	else {
+		output_cmd(OUT_FLUSH);
+		output_stopped = 1;
+	}
+	pushed = atomic_load(&played);
+	npart = 0;
+}
+
+static void
+track_free(struct track *t)
+{
+	if (t->fd != -1)
+		close(t->fd);
+	t->fd = -1;
+	free(t->idx);
+	t->idx = NULL;
+}
+
+static void
+queue_push(int fd, uint32_t id, int64_t seek, struct seekidx *idx,
+    int front)
+{
+	struct track	*t;
+
+	if (nqueue == PLAYER_QUEUE) {
+		if (!front)
+			fatalx("too many tracks enqueued");
+		track_free(&queue[--nqueue]);
+	}
+
+	if (front) {
+		memmove(&queue[1], &queue[0], nqueue * sizeof(*queue));
+		t = &queue[0];
+	} else
+		t = &queue[nqueue];
+	nqueue++;
+
+	memset(t, 0, sizeof(*t));
+	t->fd = fd;
+	t->id = id;
+	t->seek = seek;
+	t->idx = idx;
+}
+
+/* put back a track that was already started */
+static void
+queue_requeue(struct track *t, int64_t seek)
+{
+	if (lseek(t->fd, 0, SEEK_SET) == -1) {
+		log_warn("%s: lseek", __func__);
+		track_free(t);
+		return;
+	}
+	queue_push(t->fd, t->id, seek, t->idx, 1);
+	t->fd = -1;
+	t->idx = NULL;
+}
+
+static void
+queue_clear(void)
+{
+	while (nqueue > 0)
+		track_free(&queue[--nqueue]);
+}
+
 int
 player_setup(unsigned int bits, unsigned int rate, unsigned int channels)
 {
 	log_debug("%s: bits=%u, rate=%u, channels=%u", __func__,
 	    bits, rate, channels);
 
-	info.bits = bits;
-	info.rate = rate;
-	info.chan = channels;
+	dec->info.bits = bits;
+	dec->info.rate = rate;
+	dec->info.chan = channels;
+
+	if (pcm_bps(bits) * channels > sizeof(part)) {
+		log_warnx("can't handle %u channels of %u bits",
+		    channels, bits);
+		return -1;
+	}
+
+	/* a partial frame can't be carried over to another track */
+	npart = 0;
 
-	return audio_setup(bits, rate, channels, player_pfds + 1, player_nfds);
+	/* no need to touch the device: the track can just follow */
+	if (!output_stopped &&
+	    memcmp(&output_info, &dec->info, sizeof(output_info)) == 0)
+		return 0;
+
+	/* let the previous track finish first */
+	while (dec != cur && !aborted)
+		player_step(NULL, output_mustwait(1));
+	if (aborted)
+		return 0;
+
+	/* what's in the ring is in the old format. */
+	output_sync();
+
+	output_info = dec->info;
+	output_stopped = 0;
+	return output_cmd(OUT_SETUP);
 }
 
 static void
@@ -71,11 +299,14 @@ send_status(void)
 	struct player_status s;
 
 	memset(&s, 0, sizeof(s));
-	if (info.rate != 0) {
-		s.duration = duration / info.rate;
-		s.position = frames / info.rate;
+	if (cur != NULL) {
+		if (cur->info.rate != 0) {
+			s.duration = cur->duration / cur->info.rate;
+			s.position = (atomic_load(&played) - cur->start) /
+			    cur->info.rate;
+		}
+		memcpy(&s.info, &cur->info, sizeof(s.info));
 	}
-	memcpy(&s.info, &info, sizeof(info));
 
 	imsg_compose(imsgbuf, IMSG_META, 0, 0, -1, &s, sizeof(s));
 	imsgbuf_flush(imsgbuf);
@@ -84,27 +315,193 @@ send_status(void)
 void
 player_setduration(int64_t d)
 {
-	duration = d;
-	send_status();
+	dec->duration = d;
+	if (dec == cur)
+		send_status();
 }
 
+/* called by the output thread */
 static void
 player_onmove(void *arg, int delta)
 {
-	static int64_t reported;
+	atomic_fetch_add(&played, delta);
+}
+
+/*
+ * Tell the main process that the track with the given id couldn't be
+ * played; the id lets it ignore errors about a track already replaced.
+ */
+static void
+player_senderr(uint32_t id, const char *errstr)
+{
+	size_t len = 0;
+
+	if (errstr != NULL)
+		len = strlen(errstr) + 1;
+
+	imsg_compose(imsgbuf, IMSG_ERR, id, 0, -1, errstr, len);
+	imsgbuf_flush(imsgbuf);
+}
+
+/*
+ * Tell the main process that the track with the given id is over.
+ * The id of the queued track that's being played now, or 0, follows
+ * so that it doesn't have to be sent again.
+ */
+static void
+player_sendeof(uint32_t id, uint32_t next)
+{
+	imsg_compose(imsgbuf, IMSG_EOF, id, 0, -1, &next, sizeof(next));
+	imsgbuf_flush(imsgbuf);
+}
+
+/*
+ * Move to the next track once the current one was completely played,
+ * or handed to the device when the ring is empty (the output thread
+ * doesn't report the progress when idle), then send the position
+ * every second.
+ */
+static void
+player_report(void)
+{
+	int64_t	 p, pos;
+
+	p = atomic_load(&played);
+	while (cur != NULL && cur->end != -1 &&
+	    (p >= cur->end || ring_used(&ring) == 0)) {
+		if (cur->failed) {
+			/* the main process will tell what to do next */
+			player_senderr(cur->id, cur->errstr);
+			player_stop();
+			break;
+		}
+		player_sendeof(cur->id, nxt != NULL ? nxt->id : 0);
+		track_free(cur);
+		cur = nxt;
+		nxt = NULL;
+		reported = 0;
+		if (cur != NULL)
+			send_status();
+	}
 
-	frames += delta;
-	if (llabs(frames - reported) >= info.rate) {
-		reported = frames;
+	if (cur == NULL)
+		return;
+
+	pos = p - cur->start;
+	if (cur->info.rate != 0 && llabs(pos - reported) >= cur->info.rate) {
+		reported = pos;
 		send_status();
 	}
 }
 
+/*
+ * Return a seek index for the track being decoded, starting from the
+ * cached one if it's of the right type.  The decoder gives it back
+ * with player_putidx() when it's done.
+ */
+struct seekidx *
+player_getidx(int fd, int type)
+{
+	struct seekidx	*idx;
+	struct stat	 sb;
+
+	idx = xcalloc(1, sizeof(*idx));
+	if (dec->idx != NULL && dec->idx->type == type) {
+		memcpy(idx, dec->idx, SEEKIDX_SIZE(dec->idx->nent));
+		return idx;
+	}
+
+	idx->length = -1;
+	if (fstat(fd, &sb) == -1) {
+		log_warn("%s: fstat", __func__);
+		return idx;
+	}
+
+	idx->dev = sb.st_dev;
+	idx->ino = sb.st_ino;
+	idx->size = sb.st_size;
+	idx->mtime = sb.st_mtime;
+	idx->type = type;
+	return idx;
+}
+
+/* send the seek index to the main process if it was improved */
+void
+player_putidx(struct seekidx *idx)
+{
+	const struct seekidx *old = dec->idx;
+
+	if (idx->type != 0 && (idx->nent > 0 || idx->length != -1) &&
+	    (old == NULL || old->nent != idx->nent ||
+	    old->step != idx->step || old->length != idx->length)) {
+		imsg_compose(imsgbuf, IMSG_INDEX, 0, 0, -1, idx,
+		    SEEKIDX_SIZE(idx->nent));
+		imsgbuf_flush(imsgbuf);
+	}
+
+	free(idx);
+}
+
 void
 player_setpos(int64_t pos)
 {
-	frames = pos;
-	player_onmove(NULL, 0);
+	dec->start = atomic_load(&played) - pos;
+	player_report();
+}
+
+/* stop everything and forget the queued tracks */
+static void
+player_stop(void)
+{
+	output_flush(0);
+	queue_clear();
+
+	if (cur != NULL)
+		track_free(cur);
+	if (nxt != NULL)
+		track_free(nxt);
+	cur = nxt = NULL;
+	aborted = 1;
+}
+
+/*
+ * Seek in a track whose decoder is already done: drop what's in the
+ * ring and start decoding it again from the given position.
+ */
+static void
+player_restart(int64_t seek)
+{
+	log_debug("%s: restarting the track to seek", __func__);
+
+	output_flush(1);
+
+	if (nxt != NULL)
+		queue_requeue(nxt, -1);
+	queue_requeue(cur, seek);
+	cur = nxt = NULL;
+	aborted = 1;
+}
+
+/* forget the queued tracks, including the one that follows cur */
+static void
+player_unqueue(void)
+{
+	queue_clear();
+
+	if (nxt == NULL)
+		return;
+
+	output_trunc = cur->endpos;
+	if (output_cmd(OUT_TRUNC) == -1) {
+		/* too late, it's already being played. */
+		return;
+	}
+
+	pushed = cur->end;
+	if (dec == nxt)
+		aborted = 1;
+	track_free(nxt);
+	nxt = NULL;
 }
 
 /* process only one message */
@@ -112,13 +509,19 @@ static int
 player_dispatch(int64_t *s, int wait)
 {
 	struct player_seek seek;
+	struct seekidx	*idx;
 	struct pollfd	pfd;
 	struct imsg	imsg;
+	struct ibuf	ibuf;
 	ssize_t		n;
-	int		ret;
+	size_t		len;
+	int64_t		pos;
+	int		ret, fd;
 
-	if (halted != 0)
+	if (halted != 0) {
+		player_stop();
 		return IMSG_STOP;
+	}
 
 again:
 	if ((n = imsg_get(imsgbuf, &imsg)) == -1)
@@ -141,30 +544,65 @@ again:
 	ret = imsg_get_type(&imsg);
 	switch (ret) {
 	case IMSG_PLAY:
-		if (nextfd != -1)
-			fatalx("track already enqueued");
-		if ((nextfd = imsg_get_fd(&imsg)) == -1)
+	case IMSG_QUEUE:
+		if ((fd = imsg_get_fd(&imsg)) == -1)
 			fatalx("%s: got invalid file descriptor", __func__);
+		if (ret == IMSG_PLAY)
+			player_stop();
+		else if (cur == NULL && nqueue == 0) {
+			/* the track it should follow is already over */
+			log_debug("dropping queued track %u",
+			    imsg_get_id(&imsg));
+			close(fd);
+			break;
+		}
+
+		/* the seek index of the file, if the main process has one */
+		idx = NULL;
+		if ((len = imsg_get_len(&imsg)) != 0) {
+			if (len > sizeof(*idx) ||
+			    imsg_get_ibuf(&imsg, &ibuf) == -1)
+				fatalx("%s: bad seek index", __func__);
+			idx = xmalloc(len);
+			memcpy(idx, ibuf_data(&ibuf), len);
+			if (!seekidx_valid(idx, len)) {
+				log_warnx("%s: got an invalid seek index",
+				    __func__);
+				free(idx);
+				idx = NULL;
+			}
+		}
+
+		queue_push(fd, imsg_get_id(&imsg), -1, idx, 0);
 		log_debug("song enqueued");
-		ret = IMSG_STOP;
+		break;
+	case IMSG_UNQUEUE:
+		player_unqueue();
 		break;
 	case IMSG_RESUME:
 	case IMSG_PAUSE:
+		break;
 	case IMSG_STOP:
+		player_stop();
 		break;
 	case IMSG_CTL_SEEK:
-		if (s == NULL)
+		if (cur == NULL)
 			break;
 		if (imsg_get_data(&imsg, &seek, sizeof(seek)) == -1)
 			fatalx("wrong size for seek ctl");
 		if (seek.percent)
-			*s = (double)seek.offset * (double)duration / 100.0;
+			pos = (double)seek.offset * (double)cur->duration /
+			    100.0;
 		else
-			*s = seek.offset * info.rate;
+			pos = seek.offset * cur->info.rate;
 		if (seek.relative)
-			*s += frames;
-		if (*s < 0)
-			*s = 0;
+			pos += atomic_load(&played) - cur->start;
+		if (pos < 0)
+			pos = 0;
+		if (s != NULL && dec == cur)
+			*s = pos;
+		else
+			player_restart(pos);
 		break;
 	default:
 		fatalx("unknown imsg %d", ret);
@@ -174,59 +612,56 @@ again:
 	return ret;
 }
 
-static void
-player_senderr(const char *errstr)
+/*
+ * Guess the format of a file from its first PLAYER_MAGICSIZ bytes.
+ * Returns -1 if it's not known.
+ */
+int
+player_format(const char *buf, size_t len)
 {
-	size_t len = 0;
-
-	if (errstr != NULL)
-		len = strlen(errstr) + 1;
-
-	imsg_compose(imsgbuf, IMSG_ERR, 0, 0, -1, errstr, len);
-	imsgbuf_flush(imsgbuf);
-}
+	/* 8 byte is the larger magic number */
+	if (len < 8)
+		return -1;
 
-static void
-player_sendeof(void)
-{
-	imsg_compose(imsgbuf, IMSG_EOF, 0, 0, -1, NULL, 0);
-	imsgbuf_flush(imsgbuf);
+	if (memcmp(buf, "fLaC", 4) == 0)
+		return FORMAT_FLAC;
+	if (memcmp(buf, "ID3", 3) == 0 ||
+	    memcmp(buf, "\xFF\xFB", 2) == 0 ||
+	    memcmp(buf, "\xFF\xFA", 2) == 0)
+		return FORMAT_MP3;
+	if (memcmp(buf, "RIFF", 4) == 0)
+		return FORMAT_WAV;
+	if (memmem(buf, len, "OpusHead", 8) != NULL)
+		return FORMAT_OPUS;
+	if (memmem(buf, len, "OggS", 4) != NULL)
+		return FORMAT_OGGVORBIS;
+	return -1;
 }
 
 static int
-player_playnext(const char **errstr)
+player_decode(int fd, const char **errstr)
 {
-	static char buf[512];
+	static char buf[PLAYER_MAGICSIZ];
 	ssize_t r;
-	int fd = nextfd;
-
-	assert(nextfd != -1);
-	nextfd = -1;
-
-	/* reset frames and set position to zero */
-	frames = 0;
-	player_setduration(0);
 
 	r = pread(fd, buf, sizeof(buf), 0);
-
-	/* 8 byte is the larger magic number */
 	if (r < 8) {
 		*errstr = "read failed";
 		goto err;
 	}
 
-	if (memcmp(buf, "fLaC", 4) == 0)
+	switch (player_format(buf, r)) {
+	case FORMAT_FLAC:
 		return play_flac(fd, errstr);
-	if (memcmp(buf, "ID3", 3) == 0 ||
-	    memcmp(buf, "\xFF\xFB", 2) == 0 ||
-	    memcmp(buf, "\xFF\xFA", 2) == 0)
+	case FORMAT_MP3:
 		return play_mp3(fd, errstr);
-	if (memcmp(buf, "RIFF", 4) == 0)
+	case FORMAT_WAV:
 		return play_wav(fd, errstr);
-	if (memmem(buf, r, "OpusHead", 8) != NULL)
+	case FORMAT_OPUS:
 		return play_opus(fd, errstr);
-	if (memmem(buf, r, "OggS", 4) != NULL)
+	case FORMAT_OGGVORBIS:
 		return play_oggvorbis(fd, errstr);
+	}
 
 	*errstr = "unknown file type";
 err:
@@ -234,70 +669,337 @@ err:
 	return -1;
 }
 
-static int
-player_pause(int64_t *s)
+static void
+player_playnext(void)
 {
-	int r;
+	struct track	*t;
+	int		 fd, r;
+
+	t = cur == &tracks[0] ? &tracks[1] : &tracks[0];
+	memcpy(t, &queue[0], sizeof(*t));
+	memmove(&queue[0], &queue[1], --nqueue * sizeof(*queue));
+
+	/* keep a copy to restart it if needed */
+	fd = t->fd;
+	if ((t->fd = dup(fd)) == -1)
+		fatal("dup");
+
+	t->start = pushed;
+	t->end = -1;
+
+	if (cur == NULL) {
+		cur = t;
+		reported = 0;
+		if (t->seek == -1)
+			send_status();
+	} else
+		nxt = t;
+	dec = t;
+	aborted = 0;
+
+	r = player_decode(fd, &t->errstr);
+	dec = NULL;
 
-	r = player_dispatch(s, 1);
-	return r == IMSG_RESUME || r == IMSG_CTL_SEEK;
+	if (aborted)
+		return;
+
+	/* the eof or the error is sent once all the frames were played */
+	t->failed = r == -1;
+	t->end = pushed;
+	t->endpos = atomic_load(&ring.head);
+	player_report();
 }
 
+static void
+player_pause(int64_t *s)
+{
+	output_cmd(OUT_PAUSE);
+	for (;;) {
+		switch (player_dispatch(s, 1)) {
+		case IMSG_RESUME:
+		case IMSG_CTL_SEEK:
+			if (!aborted)
+				output_cmd(OUT_RESUME);
+			return;
+		}
+		if (aborted)
+			return;
+	}
+}
+
+/*
+ * Wait up to timeout for a message from the main process or from the
+ * output thread.  Returns non-zero if there's an imsg to read.
+ */
 static int
-player_shouldstop(int64_t *s, int wait)
+player_poll(int timeout)
 {
-	switch (player_dispatch(s, wait)) {
-	case IMSG_PAUSE:
-		if (player_pause(s))
-			break;
-		/* fallthrough */
-	case IMSG_STOP:
-		return 1;
+	struct pollfd	 pfds[2];
+	char		 buf[64];
+
+	memset(pfds, 0, sizeof(pfds));
+	pfds[0].fd = imsgbuf->fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = output_sp[0];
+	pfds[1].events = POLLIN;
+
+	if (poll(pfds, 2, timeout) == -1) {
+		if (errno != EINTR)
+			fatal("poll");
+		return 0;
 	}
 
-	return 0;
+	/* just wakeups */
+	if (pfds[1].revents & (POLLIN|POLLHUP)) {
+		if (read(output_sp[0], buf, sizeof(buf)) == -1)
+			fatal("read from the output thread");
+	}
+
+	return pfds[0].revents & (POLLHUP|POLLIN);
+}
+
+/*
+ * Report the progress and handle at most one message from the main
+ * process, waiting for something to happen if block is set.
+ */
+static void
+player_step(int64_t *s, int block)
+{
+	int	 wait;
+
+	player_report();
+
+	wait = player_poll(block ? INFTIM : 0);
+	if (player_dispatch(s, wait) == IMSG_PAUSE)
+		player_pause(s);
+}
+
+/*
+ * Push len bytes, a multiple of the frame size, to the output thread
+ * waiting for space when needed.
+ */
+static int
+play_frames(const void *buf, size_t len, int64_t *s)
+{
+	size_t	 w;
+
+	for (;;) {
+		if ((w = ring_write(&ring, buf, len)) != 0) {
+			pushed += w / ring.frame;
+			output_wakeup();
+			len -= w;
+			buf += w;
+		}
+
+		player_step(dec == cur ? s : NULL,
+		    len != 0 && output_mustwait(0));
+		if (aborted)
+			return 0;
+
+		if (*s != -1) {
+			output_flush(1);
+			return 1;
+		}
+
+		if (len == 0)
+			return 1;
+	}
 }
 
+/*
+ * Decoders may hand out buffers that don't end on a frame boundary:
+ * what's left of the last frame is kept in `part' until the next call.
+ */
 int
 play(const void *buf, size_t len, int64_t *s)
 {
-	size_t w;
-	int revents, r, wait;
+	size_t	 n;
 
 	*s = -1;
-	while (len != 0) {
-		audio_pollfd(player_pfds + 1, player_nfds, POLLOUT);
-		r = poll(player_pfds, player_nfds + 1, INFTIM);
-		if (r == -1)
+	if (aborted)
+		return 0;
+
+	/* the track was restarted to seek */
+	if (dec->seek != -1) {
+		*s = dec->seek;
+		dec->seek = -1;
+		return 1;
+	}
+
+	if (npart != 0) {
+		if ((n = ring.frame - npart) > len)
+			n = len;
+		memcpy(part + npart, buf, n);
+		npart += n;
+		buf += n;
+		len -= n;
+		if (npart < ring.frame)
+			return 1;
+
+		npart = 0;
+		if (!play_frames(part, ring.frame, s) || *s != -1)
+			return !aborted;
+	}
+
+	n = len % ring.frame;
+	if (!play_frames(buf, len - n, s) || *s != -1)
+		return !aborted;
+
+	memcpy(part, buf + len - n, n);
+	npart = n;
+	return 1;
+}
+
+/*
+ * Wait for the output thread to play what's left of the current track
+ * after the decoder is done, or for the main process to queue more.
+ */
+static void
+player_drain(void)
+{
+	struct track	*t = cur;
+	size_t		 n = nqueue;
+
+	while (cur == t && nqueue == n && !halted)
+		player_step(NULL, output_mustwait(1));
+}
+
+/*
+ * Configure the device and the ring for output_info.  Nothing is done
+ * if the format didn't change since the last successful call.
+ */
+static int
+output_setup(struct pollfd *pfds)
+{
+	static struct player_info cfg;
+	struct player_info *info = &output_info;
+	size_t	 bps;
+
+	if (memcmp(&cfg, info, sizeof(cfg)) == 0) {
+		output_err = 0;
+		return 0;
+	}
+
+	memset(&cfg, 0, sizeof(cfg));
+	output_err = audio_setup(info->bits, info->rate, info->chan,
+	    pfds + 1, player_nfds);
+	if (output_err == -1)
+		return -1;
+
+	bps = pcm_bps(info->bits);
+	ring_setup(&ring, bps * info->chan,
+	    bps * info->chan * info->rate * AMUSED_RINGSEC);
+
+	cfg = *info;
+	return 0;
+}
+
+static void *
+output_thread(void *arg)
+{
+	struct pollfd	*pfds = player_pfds;
+	const void	*p;
+	sigset_t	 set;
+	size_t		 n, w;
+	ssize_t		 r, i;
+	int		 sock = output_sp[1];
+	int		 nfds, revents, paused = 0;
+	char		 cmd[64], ack = OUT_ACK, ch = OUT_SPACE;
+
+	/* signals are for the player */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	for (;;) {
+		n = 0;
+		if (!paused && (n = ring_used(&ring)) == 0) {
+			atomic_store(&cons_waiting, 1);
+			if ((n = ring_used(&ring)) != 0)
+				atomic_store(&cons_waiting, 0);
+		}
+
+		nfds = 1;
+		if (n != 0) {
+			audio_pollfd(pfds + 1, player_nfds, POLLOUT);
+			nfds += player_nfds;
+		}
+
+		if (poll(pfds, nfds, INFTIM) == -1) {
+			if (errno == EINTR)
+				continue;
 			fatal("poll");
+		}
 
-		wait = player_pfds[0].revents & (POLLHUP|POLLIN);
-		if (player_shouldstop(s, wait)) {
-			audio_flush();
-			return 0;
+		if (pfds[0].revents & (POLLIN|POLLHUP)) {
+			if ((r = read(sock, cmd, sizeof(cmd))) == -1)
+				fatal("read");
+			if (r == 0)
+				break;
+
+			for (i = 0; i < r; ++i) {
+				switch (cmd[i]) {
+				case OUT_WAKE:
+					break;
+				case OUT_PAUSE:
+					paused = 1;
+					break;
+				case OUT_RESUME:
+					paused = 0;
+					break;
+				case OUT_FLUSH:
+				case OUT_SEEK:
+					paused = 0;
+					audio_flush();
+					ring_reset(&ring);
+					if (write(sock, &ack, 1) == -1)
+						fatal("write");
+					break;
+				case OUT_SETUP:
+					output_setup(pfds);
+					if (write(sock, &ack, 1) == -1)
+						fatal("write");
+					break;
+				case OUT_TRUNC:
+					output_err = ring_truncate(&ring,
+					    output_trunc);
+					if (write(sock, &ack, 1) == -1)
+						fatal("write");
+					break;
+				default:
+					fatalx("%s: unknown command %d",
+					    __func__, cmd[i]);
+				}
+			}
+			continue;
 		}
 
-		revents = audio_revents(player_pfds + 1, player_nfds);
+		if (nfds == 1)
+			continue;
+
+		revents = audio_revents(pfds + 1, player_nfds);
 		if (revents & POLLHUP) {
 			if (errno == EAGAIN)
 				continue;
 			fatal("audio hang-up");
 		}
 		if (revents & POLLOUT) {
-			w = audio_write(buf, len);
-			len -= w;
-			buf += w;
+			n = ring_peek(&ring, &p);
+			w = audio_write(p, n);
+			if (w != 0) {
+				ring_consume(&ring, w);
+				if (atomic_exchange(&prod_waiting, 0) &&
+				    write(sock, &ch, 1) == -1)
+					fatal("write");
+			}
 		}
 	}
 
-	return 1;
+	return NULL;
 }
 
 int
 player(int debug, int verbose)
 {
-	int r;
-
 	log_init(debug, LOG_DAEMON);
 	log_setverbose(verbose);
 
@@ -320,13 +1022,23 @@ player(int debug, int verbose)
 		fatal("audio_nfds: invalid number of file descriptors: %d",
 		    player_nfds);
 
-	/* allocate one extra for imsg */
+	/* allocate one extra for the output thread socket */
 	player_pfds = calloc(player_nfds + 1, sizeof(*player_pfds));
 	if (player_pfds == NULL)
 		fatal("calloc");
 
+	if (ring_init(&ring, AMUSED_RINGSIZ) == -1)
+		fatal("ring_init");
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, output_sp) == -1)
+		fatal("socketpair");
+
 	player_pfds[0].events = POLLIN;
-	player_pfds[0].fd = 3;
+	player_pfds[0].fd = output_sp[1];
+
+	if ((errno = pthread_create(&output_tid, NULL, output_thread,
+	    NULL)) != 0)
+		fatal("pthread_create");
 
 	imsgbuf = xmalloc(sizeof(*imsgbuf));
 	if (imsgbuf_init(imsgbuf, 3) == -1)
@@ -343,16 +1055,13 @@ player(int debug, int verbose)
 		fatal("pledge");
 
 	while (!halted) {
-		const char *errstr = NULL;
-
-		while (nextfd == -1)
+		if (nqueue != 0 && nxt == NULL &&
+		    (cur == NULL || cur->end != -1))
+			player_playnext();
+		else if (cur != NULL)
+			player_drain();
+		else
 			player_dispatch(NULL, 1);
-
-		r = player_playnext(&errstr);
-		if (r == -1)
-			player_senderr(errstr);
-		if (r == 0)
-			player_sendeof();
 	}
 
 	return 0;
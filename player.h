@@ -18,8 +18,32 @@
 #define AMUSED_BUFSIZ (16 * 1024)
 #endif
 
+/* size of the ring between the decoders and the output thread */
+#ifndef AMUSED_RINGSIZ
+#define AMUSED_RINGSIZ (4 * 1024 * 1024)
+#endif
+
+/* but don't buffer more than these seconds of audio */
+#ifndef AMUSED_RINGSEC
+#define AMUSED_RINGSEC 3
+#endif
+
+/* bytes needed by player_format */
+#define PLAYER_MAGICSIZ	512
+
+#define FORMAT_FLAC		1
+#define FORMAT_MP3		2
+#define FORMAT_WAV		3
+#define FORMAT_OPUS		4
+#define FORMAT_OGGVORBIS	5
+
+struct seekidx;
+
+int	player_format(const char *, size_t);
 int	player_setup(unsigned int, unsigned int, unsigned int);
 void	player_setduration(int64_t);
+struct seekidx	*player_getidx(int, int);
+void	player_putidx(struct seekidx *);
 void	player_setpos(int64_t);
 int	play(const void *, size_t, int64_t *);
 int	player(int, int);
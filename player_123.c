@@ -17,14 +17,206 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <mpg123.h>
 
 #include "log.h"
 #include "player.h"
+#include "seekidx.h"
+
+/*
+ * Computing the exact length of an mp3 file means reading all of it,
+ * which may take a while for long files on slow disks.  Unless there
+ * is a header with the number of frames, the duration is estimated
+ * and refined later by a scan done on a separate handle by another
+ * thread.  It reads the file with pread() so it doesn't interfere with
+ * the decoder.
+ */
+struct scan {
+	pthread_t	 tid;
+	int		 fd;
+	off_t		 off;
+	off_t		 size;
+	off_t		 length;
+	atomic_int	 stop;
+	atomic_int	 done;
+};
+
+static ssize_t
+scan_read(void *arg, void *buf, size_t len)
+{
+	struct scan	*scan = arg;
+	ssize_t		 r;
+
+	if (atomic_load(&scan->stop)) {
+		errno = EINTR;
+		return -1;
+	}
+
+	if ((r = pread(scan->fd, buf, len, scan->off)) > 0)
+		scan->off += r;
+	return r;
+}
+
+static off_t
+scan_lseek(void *arg, off_t off, int whence)
+{
+	struct scan	*scan = arg;
+
+	switch (whence) {
+	case SEEK_SET:
+		break;
+	case SEEK_CUR:
+		off += scan->off;
+		break;
+	case SEEK_END:
+		off += scan->size;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (off < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return scan->off = off;
+}
+
+static void *
+scan_thread(void *arg)
+{
+	struct scan	*scan = arg;
+	mpg123_handle	*mh;
+
+	scan->length = -1;
+	if ((mh = mpg123_new(NULL, NULL)) == NULL)
+		goto done;
+
+	if (mpg123_replace_reader_handle(mh, scan_read, scan_lseek,
+	    NULL) == MPG123_OK &&
+	    mpg123_open_handle(mh, scan) == MPG123_OK &&
+	    mpg123_scan(mh) == MPG123_OK)
+		scan->length = mpg123_length(mh);
+	mpg123_delete(mh);
+
+done:
+	atomic_store(&scan->done, 1);
+	return NULL;
+}
+
+static int
+scan_start(struct scan *scan, int fd)
+{
+	struct stat	 sb;
+	sigset_t	 set, oset;
+
+	memset(scan, 0, sizeof(*scan));
+	scan->fd = fd;
+
+	if (fstat(fd, &sb) == -1)
+		return -1;
+	scan->size = sb.st_size;
+
+	/* signals are for the player */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oset);
+	errno = pthread_create(&scan->tid, NULL, scan_thread, scan);
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+	if (errno != 0) {
+		log_warn("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+scan_stop(struct scan *scan)
+{
+	atomic_store(&scan->stop, 1);
+	if ((errno = pthread_join(scan->tid, NULL)) != 0)
+		fatal("pthread_join");
+}
+
+static inline uint32_t
+be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/*
+ * Look for a Xing, Info or VBRI header in the first frame and return
+ * the number of samples it declares, or -1.  *vbri is set for the
+ * latter, since libmpg123 only knows about the former two.
+ */
+static int64_t
+header_length(int fd, int *vbri)
+{
+	static uint8_t	 buf[4096];
+	const uint8_t	*h, *x;
+	ssize_t		 r;
+	off_t		 off = 0;
+	int		 mpeg1, mono, layer, spf;
+
+	*vbri = 0;
+
+	if ((r = pread(fd, buf, 10, 0)) != 10)
+		return -1;
+
+	/* skip the ID3v2 tag */
+	if (memcmp(buf, "ID3", 3) == 0) {
+		off = 10 + ((buf[6] & 0x7f) << 21 | (buf[7] & 0x7f) << 14 |
+		    (buf[8] & 0x7f) << 7 | (buf[9] & 0x7f));
+		if (buf[5] & 0x10)
+			off += 10;	/* footer */
+	}
+
+	if ((r = pread(fd, buf, sizeof(buf), off)) < 4)
+		return -1;
+
+	for (h = buf; h + 4 <= buf + r; ++h)
+		if (h[0] == 0xff && (h[1] & 0xe0) == 0xe0)
+			break;
+	if (h + 4 > buf + r)
+		return -1;
+
+	mpeg1 = ((h[1] >> 3) & 3) == 3;
+	layer = 4 - ((h[1] >> 1) & 3);
+	mono = ((h[3] >> 6) & 3) == 3;
+
+	if (layer != 3)
+		return -1;
+	spf = mpeg1 ? 1152 : 576;
+
+	x = h + 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+	if (x + 12 <= buf + r &&
+	    (!memcmp(x, "Xing", 4) || !memcmp(x, "Info", 4))) {
+		if ((be32(x + 4) & 1) == 0)
+			return -1;
+		return (int64_t)be32(x + 8) * spf;
+	}
+
+	x = h + 4 + 32;
+	if (x + 18 <= buf + r && !memcmp(x, "VBRI", 4)) {
+		*vbri = 1;
+		return (int64_t)be32(x + 14) * spf;
+	}
+
+	return -1;
+}
 
 static int
 setup(mpg123_handle *mh)
@@ -43,14 +235,55 @@ setup(mpg123_handle *mh)
 	return 1;
 }
 
+/* give libmpg123 the frame index we got from the cache */
+static void
+index_load(mpg123_handle *mh, struct seekidx *idx)
+{
+	static off_t	 offs[SEEKIDX_NENT];
+	int		 i;
+
+	if (idx->nent == 0)
+		return;
+
+	for (i = 0; i < idx->nent; ++i)
+		offs[i] = idx->ent[i].off;
+
+	if (mpg123_set_index(mh, offs, idx->step, idx->nent) != MPG123_OK)
+		log_warnx("mpg123_set_index: %s", mpg123_strerror(mh));
+}
+
+/* save the frame index libmpg123 has built, if it's bigger */
+static void
+index_save(mpg123_handle *mh, struct seekidx *idx)
+{
+	off_t		*offs, step;
+	size_t		 fill, i, n, k;
+
+	if (mpg123_index(mh, &offs, &step, &fill) != MPG123_OK)
+		return;
+
+	k = (fill + SEEKIDX_NENT - 1) / SEEKIDX_NENT;
+	if (k == 0 || (n = (fill + k - 1) / k) <= (size_t)idx->nent)
+		return;
+
+	for (i = 0; i < n; ++i) {
+		idx->ent[i].pcm = 0;
+		idx->ent[i].off = offs[i * k];
+	}
+	idx->nent = n;
+	idx->step = step * k;
+}
+
 int
 play_mp3(int fd, const char **errstr)
 {
 	static char	 buf[AMUSED_BUFSIZ];
 	size_t		 len;
 	mpg123_handle	*mh;
-	int64_t		 seek = -1;
-	int		 err, ret = -1;
+	struct seekidx	*idx;
+	struct scan	 scan;
+	int64_t		 seek = -1, length;
+	int		 err, vbri, scanning = 0, ret = -1;
 
 	if ((mh = mpg123_new(NULL, NULL)) == NULL)
 		fatal("mpg123_new");
@@ -61,15 +294,36 @@ play_mp3(int fd, const char **errstr)
 		return -1;
 	}
 
+	idx = player_getidx(fd, SEEKIDX_MP3);
+
 	if (!setup(mh))
 		goto done;
 
-	if (mpg123_scan(mh) != MPG123_OK)
-		goto done;
+	index_load(mh, idx);
 
-	player_setduration(mpg123_length(mh));
+	if ((length = idx->length) > 0) {
+		/* we've already played it until the end */
+	} else if ((length = header_length(fd, &vbri)) == -1) {
+		/* refine the estimate done by libmpg123 later */
+		if (scan_start(&scan, fd) == 0)
+			scanning = 1;
+		length = mpg123_length(mh);
+	} else if (!vbri) {
+		/* it also accounts for the encoder delay and padding */
+		length = mpg123_length(mh);
+	}
+	player_setduration(length);
 
 	for (;;) {
+		if (scanning && atomic_load(&scan.done)) {
+			scan_stop(&scan);
+			scanning = 0;
+			if (scan.length > 0 && scan.length != length) {
+				idx->length = scan.length;
+				player_setduration(scan.length);
+			}
+		}
+
 		if (seek != -1) {
 			seek = mpg123_seek(mh, seek, SEEK_SET);
 			if (seek < 0) {
@@ -82,6 +336,8 @@ play_mp3(int fd, const char **errstr)
 		err = mpg123_read(mh, buf, sizeof(buf), &len);
 		switch (err) {
 		case MPG123_DONE:
+			if ((length = mpg123_tell(mh)) > 0)
+				idx->length = length;
 			ret = 0;
 			goto done;
 		case MPG123_NEW_FORMAT:
@@ -101,6 +357,10 @@ play_mp3(int fd, const char **errstr)
 	}
 
 done:
+	if (scanning)
+		scan_stop(&scan);
+	index_save(mh, idx);
+	player_putidx(idx);
 	mpg123_delete(mh);
 	close(fd);
 	return ret;
@@ -25,6 +25,7 @@
 #include <FLAC/stream_decoder.h>
 
 #include "log.h"
+#include "pcm.h"
 #include "player.h"
 
 struct write_args {
@@ -50,52 +51,41 @@ writecb(const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame,
     const int32_t * const *src, void *data)
 {
 	struct write_args *wa = data;
-	static uint8_t buf[AMUSED_BUFSIZ];
-	int64_t seek;
-	int c, i, bps, chans;
-	size_t len;
+	static int32_t buf[AMUSED_BUFSIZ / 4];
+	int64_t seek = -1;
+	size_t i, n, fs, step, blocksize;
+	int bps, chans;
 
 	bps = frame->header.bits_per_sample;
 	chans = frame->header.channels;
-
-	for (i = 0, len = 0; i < frame->header.blocksize; ++i) {
-		if (len + 4*chans >= sizeof(buf)) {
-			if (!play(buf, len, &seek))
-				goto quit;
-			if (seek != -1) {
-				if (sample_seek(wa, seek))
-					break;
-				else
-					goto quit;
-			}
-			len = 0;
-		}
-
-		for (c = 0; c < chans; ++c) {
-			switch (bps) {
-			case 8:
-				buf[len++] = src[c][i] & 0xff;
-				break;
-			case 16:
-				buf[len++] = src[c][i] & 0xff;
-				buf[len++] = (src[c][i] >> 8) & 0xff;
-				break;
-			case 24:
-			case 32:
-				buf[len++] = src[c][i] & 0xff;
-				buf[len++] = (src[c][i] >> 8) & 0xff;
-				buf[len++] = (src[c][i] >> 16) & 0xff;
-				buf[len++] = (src[c][i] >> 24) & 0xff;
-				break;
-			default:
-				log_warnx("unsupported flac bps=%d", bps);
-				goto quit;
-			}
-		}
+	blocksize = frame->header.blocksize;
+
+	switch (bps) {
+	case 8:
+	case 16:
+	case 24:
+	case 32:
+		break;
+	default:
+		log_warnx("unsupported flac bps=%d", bps);
+		goto quit;
 	}
 
-	if (len != 0 && !play(buf, len, &seek))
-		goto quit;
+	fs = pcm_bps(bps) * chans;
+	step = sizeof(buf) / fs;
+
+	for (i = 0; i < blocksize; i += n) {
+		if ((n = blocksize - i) > step)
+			n = step;
+
+		pcm_planar32(buf, src, i, n, chans, bps);
+		if (!play(buf, n * fs, &seek))
+			goto quit;
+
+		/* the rest of the frame is stale after a seek */
+		if (seek != -1)
+			break;
+	}
 
 	if (seek != -1 && !sample_seek(wa, seek))
 		goto quit;
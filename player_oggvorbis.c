@@ -18,6 +18,7 @@
 #include <math.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -27,20 +28,49 @@
 
 #include "log.h"
 #include "player.h"
+#include "pcm.h"
+#include "seekidx.h"
 
 #ifndef nitems
 #define nitems(x) (sizeof(x)/sizeof(x[0]))
 #endif
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+/*
+ * Jump to the page the index says is before seek and let the caller
+ * skip what's left, or bisect the file.
+ */
+static int
+vorbis_seek(OggVorbis_File *vf, struct seekidx *idx, int64_t seek,
+    int64_t *skip)
+{
+	int64_t	 off, pcm;
+
+	*skip = 0;
+	if (seekidx_find(idx, seek, &off) == 0 &&
+	    ov_raw_seek(vf, off) == 0 &&
+	    (pcm = ov_pcm_tell(vf)) >= 0 && pcm <= seek) {
+		*skip = seek - pcm;
+		return 0;
+	}
+
+	return ov_pcm_seek(vf, seek);
+}
+
 int
 play_oggvorbis(int fd, const char **errstr)
 {
-	static char pcmout[AMUSED_BUFSIZ];
+	static int16_t pcmout[AMUSED_BUFSIZ / 2];
 	FILE *f;
 	OggVorbis_File vf;
 	vorbis_info *vi;
-	int64_t seek = -1;
-	int current_section, ret = 0;
+	struct seekidx *idx;
+	float **pcm;
+	int64_t seek = -1, skip = 0, n;
+	int current_section, chans, ret = 0;
 
 	if ((f = fdopen(fd, "r")) == NULL) {
 		*errstr = "fdopen failed";
@@ -65,29 +95,50 @@ play_oggvorbis(int fd, const char **errstr)
 
 	player_setduration(ov_time_total(&vf, -1) * vi->rate);
 
+	idx = player_getidx(fd, SEEKIDX_OGG);
+	if (idx->step == 0)
+		idx->step = vi->rate;
+	chans = vi->channels;
+
 	for (;;) {
 		long r;
 
 		if (seek != -1) {
-			r = ov_pcm_seek(&vf, seek);
+			r = vorbis_seek(&vf, idx, seek, &skip);
 			if (r != 0)
 				break;
 			player_setpos(seek);
 		}
 
-		r = ov_read(&vf, pcmout, sizeof(pcmout), 0, 2, 1,
+		r = ov_read_float(&vf, &pcm, nitems(pcmout) / chans,
 		    &current_section);
 		if (r == 0)
 			break;
 		else if (r > 0) {
-			/* TODO: deal with sample rate changes */
-			if (!play(pcmout, r, &seek)) {
+			seekidx_add(idx, ov_pcm_tell(&vf), ov_raw_tell(&vf));
+
+			/* drop what's before the seek target */
+			n = 0;
+			if (skip > 0) {
+				n = MIN(skip, r);
+				skip -= n;
+				r -= n;
+			}
+
+			/* TODO: deal with sample rate and channels changes */
+			if (ov_info(&vf, -1)->channels != chans)
+				break;
+			if (r == 0)
+				continue;
+			pcm_float16(pcmout, pcm, n, r, chans);
+			if (!play(pcmout, r * 2 * chans, &seek)) {
 				ret = 1;
 				break;
 			}
 		}
 	}
 
+	player_putidx(idx);
 	ov_clear(&vf);
 	fclose(f);
 	return ret;
@@ -18,6 +18,7 @@
 #include <math.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -26,22 +27,48 @@
 
 #include "log.h"
 #include "player.h"
+#include "seekidx.h"
 
 #ifndef nitems
 #define nitems(x) (sizeof(x)/sizeof(x[0]))
 #endif
 
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+/*
+ * Jump to the page the index says is before seek and let the caller
+ * skip what's left, or bisect the file.
+ */
+static int
+opus_seek(OggOpusFile *of, struct seekidx *idx, int64_t seek,
+    int64_t *skip)
+{
+	int64_t	 off, pcm;
+
+	*skip = 0;
+	if (seekidx_find(idx, seek, &off) == 0 &&
+	    op_raw_seek(of, off) == 0 &&
+	    (pcm = op_pcm_tell(of)) >= 0 && pcm <= seek) {
+		*skip = seek - pcm;
+		return 0;
+	}
+
+	return op_pcm_seek(of, seek);
+}
+
 int
 play_opus(int fd, const char **errstr)
 {
 	static int16_t pcm[AMUSED_BUFSIZ / 2];
-	static uint8_t out[AMUSED_BUFSIZ];
 	OggOpusFile *of;
+	struct seekidx *idx;
 	void *f;
-	int64_t seek = -1;
-	int r, ret = 0;
+	int64_t seek = -1, skip = 0;
+	int r, n, ret = 0;
 	OpusFileCallbacks cb = {NULL, NULL, NULL, NULL};
-	int i, li, prev_li = -1, duration_set = 0;
+	int li, prev_li = -1, duration_set = 0;
 
 	if ((f = op_fdopen(&cb, fd, "r")) == NULL) {
 		*errstr = "fdopen failed";
@@ -55,9 +82,14 @@ play_opus(int fd, const char **errstr)
 		return -1;
 	}
 
+	/* opusfile always decodes at 48kHz */
+	idx = player_getidx(fd, SEEKIDX_OGG);
+	if (idx->step == 0)
+		idx->step = 48000;
+
 	for (;;) {
 		if (seek != -1) {
-			r = op_pcm_seek(of, seek);
+			r = opus_seek(of, idx, seek, &skip);
 			if (r != 0)
 				break;
 			player_setpos(seek);
@@ -75,6 +107,8 @@ play_opus(int fd, const char **errstr)
 		if (r == 0)
 			break; /* eof */
 
+		seekidx_add(idx, op_pcm_tell(of), op_raw_tell(of));
+
 		li = op_current_link(of);
 		if (li != prev_li) {
 			const OpusHead *head;
@@ -91,17 +125,23 @@ play_opus(int fd, const char **errstr)
 			}
 		}
 
-		for (i = 0; i < 2*r; ++i) {
-			out[2*i+0] = pcm[i] & 0xFF;
-			out[2*i+1] = (pcm[i] >> 8) & 0xFF;
+		/* drop what's before the seek target */
+		n = 0;
+		if (skip > 0) {
+			n = MIN(skip, r);
+			skip -= n;
+			if ((r -= n) == 0)
+				continue;
 		}
 
-		if (!play(out, 4*r, &seek)) {
+		/* already interleaved and in native byte order */
+		if (!play(pcm + 2*n, 4*r, &seek)) {
 			ret = 1;
 			break;
 		}
 	}
 
+	player_putidx(idx);
 	op_free(of);
 	return ret;
 }
@@ -25,18 +25,20 @@
 #include <unistd.h>
 
 #include "log.h"
+#include "pcm.h"
 #include "player.h"
 
 int
 play_wav(int fd, const char **errstr)
 {
 	static uint8_t buf[AMUSED_BUFSIZ];
+	static int32_t out[AMUSED_BUFSIZ / 4];
 	char hdr[36], tag[8];
-	size_t toread;
+	size_t toread, maxread;
 	ssize_t r, start, pos, tot;
 	int64_t seek = -1;
 	uint32_t freq;
-	int audiofmt, nchan, bps, frame;
+	int audiofmt, nchan, bps, frame, ofs;
 
 	if ((r = read(fd, hdr, sizeof(hdr))) == -1) {
 		*errstr = "read failed";
@@ -71,6 +73,11 @@ play_wav(int fd, const char **errstr)
 	freq = le32toh(freq);
 
 	bps = ((hdr[35] << 8) | hdr[34]);
+	if (bps != 8 && bps != 16 && bps != 24 && bps != 32) {
+		*errstr = "unsupported bits per sample";
+		close(fd);
+		return -1;
+	}
 
 	if (player_setup(bps, freq, nchan) == -1)
 		fatal("player_setup");
@@ -104,14 +111,19 @@ play_wav(int fd, const char **errstr)
 
 	player_setduration(tot / frame);
 
+	/* 24 bits samples grow to 32 bits in the output */
+	ofs = nchan * pcm_bps(bps);
+	maxread = sizeof(out) / ofs * frame;
+
 	if ((start = lseek(fd, 0, SEEK_CUR)) == -1) {
 		*errstr = "lseek failed";
 		close(fd);
 		return -1;
 	}
 
+	/* a trailing partial frame is ignored */
 	pos = 0;
-	while (pos < tot) {
+	while (tot - pos >= frame) {
 		if (seek != -1) {
 			ssize_t dest = seek * frame;
 			if (dest >= tot) {
@@ -128,8 +140,8 @@ play_wav(int fd, const char **errstr)
 			pos = seek * frame;
 		}
 
-		if ((toread = tot - pos) > sizeof(buf))
-			toread = sizeof(buf);
+		if ((toread = tot - pos) > maxread)
+			toread = maxread;
 
 		if ((r = read(fd, buf, toread)) == -1) {
 			*errstr = "read failed";
@@ -143,8 +155,21 @@ play_wav(int fd, const char **errstr)
 			return -1;
 		}
 
+		/* only whole frames, read the rest the next time */
+		if (r % frame != 0) {
+			if (lseek(fd, -(r % frame), SEEK_CUR) == -1) {
+				*errstr = "lseek failed";
+				close(fd);
+				return -1;
+			}
+			r -= r % frame;
+			if (r == 0)
+				continue;
+		}
+
 		pos += r;
-		if (!play(buf, r, &seek)) {
+		pcm_le(out, buf, r / frame * nchan, bps);
+		if (!play(out, r / frame * ofs, &seek)) {
 			close(fd);
 			return 1;
 		}
@@ -14,138 +14,1221 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/mman.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <imsg.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <syslog.h>
+#include <unistd.h>
 
+#include "amused.h"
 #include "log.h"
 #include "xmalloc.h"
 #include "playlist.h"
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+/* size of the chunks of the string arena */
+#define PL_CHUNKSIZ	(256 * 1024)
+
+/* size of the buffer used to read the playlist files */
+#define PL_READSIZ	(64 * 1024)
+
+/* don't bother compacting less than this many dead entries */
+#define PL_MINDEAD	64
+
 struct playlist	 playlist;
 enum play_state	 play_state;
 int		 repeat_one;
 int		 repeat_all = 1;
 int		 consume;
+int		 random_mode;
 ssize_t		 play_off = -1;
 const char	*current_song;
 
+/* where the random walk starts from, or -1: see playlist_step() */
+static ssize_t	 random_anchor = -1;
+
 static void
 setsong(ssize_t i)
 {
+	char	 path[PATH_MAX];
+
 	free((char *)current_song);
 	if (i == -1)
 		current_song = NULL;
+	else if (playlist_get(&playlist, i, path, sizeof(path)) == NULL)
+		fatalx("%s: path too long", __func__);
 	else
-		current_song = xstrdup(playlist.songs[i]);
+		current_song = xstrdup(path);
+}
+
+static inline const char *
+arena_str(const struct playlist *p, uint32_t chunk, uint32_t off)
+{
+	return p->chunks[chunk] + off;
+}
+
+/*
+ * Rebuild the path of the i-th entry from the directory trie in buf.
+ * Returns NULL if it doesn't fit, but the paths are never longer than
+ * PATH_MAX, so a buffer of that size is always enough.
+ */
+const char *
+playlist_get(const struct playlist *p, size_t i, char *buf, size_t size)
+{
+	const struct plent	*e = &p->ents[i];
+	const struct pldir	*d;
+	const char		*base;
+	size_t			 len, pos;
+	uint32_t		 id;
+
+	base = arena_str(p, e->chunk, e->off);
+	len = strlen(base) + 1;
+	for (id = e->dir; id != PL_NODIR; id = d->parent) {
+		d = &p->dirs[id];
+		len += d->len + 1;
+	}
+
+	if (len > size)
+		return NULL;
+
+	pos = len - strlen(base) - 1;
+	memcpy(buf + pos, base, len - pos);
+	for (id = e->dir; id != PL_NODIR; id = d->parent) {
+		d = &p->dirs[id];
+		buf[--pos] = '/';
+		pos -= d->len;
+		memcpy(buf + pos, arena_str(p, d->chunk, d->off), d->len);
+	}
+
+	return buf;
+}
+
+int
+playlist_isdead(const struct playlist *p, size_t i)
+{
+	return p->ents[i].chunk == PL_DEAD;
+}
+
+static inline size_t
+playlist_live(const struct playlist *p)
+{
+	return p->len - p->ndead;
+}
+
+/*
+ * Once there are dead entries, the position of an entry among the live
+ * ones is found with a Fenwick tree of the live counts.  It's built on
+ * the first lookup, kept up to date by playlist_push() and
+ * playlist_drop() and thrown away when the entries are moved around.
+ */
+static void
+live_free(struct playlist *p)
+{
+	free(p->live);
+	p->live = NULL;
+	p->livecap = 0;
+}
+
+static void
+live_build(struct playlist *p)
+{
+	size_t	 i, j;
+
+	p->livecap = MAX(16, p->cap);
+	p->live = xcalloc(p->livecap + 1, sizeof(*p->live));
+	for (i = 1; i <= p->len; ++i)
+		p->live[i] = !playlist_isdead(p, i - 1);
+	for (i = 1; i <= p->len; ++i)
+		if ((j = i + (i & -i)) <= p->len)
+			p->live[j] += p->live[i];
+}
+
+/* live entries among the first n */
+static size_t
+live_sum(const struct playlist *p, size_t n)
+{
+	size_t	 sum = 0;
+
+	for (; n > 0; n -= n & -n)
+		sum += p->live[n];
+	return sum;
+}
+
+/* the last entry was just pushed */
+static void
+live_push(struct playlist *p)
+{
+	size_t	 n = p->len;
+
+	if (n > p->livecap) {
+		p->live = xrecallocarray(p->live, p->livecap + 1,
+		    p->cap + 1, sizeof(*p->live));
+		p->livecap = p->cap;
+	}
+	p->live[n] = 1 + live_sum(p, n - 1) - live_sum(p, n - (n & -n));
+}
+
+/* the i-th entry was just removed */
+static void
+live_drop(struct playlist *p, size_t i)
+{
+	for (i++; i <= p->len; i += i & -i)
+		p->live[i]--;
+}
+
+/* the number of live entries before the i-th one */
+size_t
+playlist_pos(struct playlist *p, size_t i)
+{
+	if (p->ndead == 0)
+		return i;
+	if (p->live == NULL)
+		live_build(p);
+	return live_sum(p, i);
+}
+
+/* the index of the live entry at the given position, or -1 */
+ssize_t
+playlist_offset(struct playlist *p, size_t pos)
+{
+	size_t	 i = 0, bit;
+
+	if (pos >= playlist_live(p))
+		return -1;
+	if (p->ndead == 0)
+		return pos;
+	if (p->live == NULL)
+		live_build(p);
+
+	for (bit = 1; bit * 2 <= p->len; bit *= 2)
+		/* nop */ ;
+	for (; bit != 0; bit /= 2) {
+		if (i + bit <= p->len && p->live[i + bit] <= pos) {
+			i += bit;
+			pos -= p->live[i];
+		}
+	}
+	return i;
+}
+
+/* add a new chunk to the arena, big enough for at least len bytes */
+static void
+arena_grow(struct playlist *p, size_t len)
+{
+	size_t	 newcap;
+
+	if (p->nchunks == p->chunkcap) {
+		newcap = MAX(8, p->chunkcap * 2);
+		p->chunks = xrecallocarray(p->chunks, p->chunkcap, newcap,
+		    sizeof(*p->chunks));
+		p->chunkcap = newcap;
+	}
+
+	p->size = MAX(PL_CHUNKSIZ, len);
+	p->chunks[p->nchunks++] = xmalloc(p->size);
+	p->used = 0;
+}
+
+/* copy len bytes of s and a NUL in the arena */
+static void
+arena_put(struct playlist *p, const char *s, size_t len, uint32_t *chunk,
+    uint32_t *off)
+{
+	if (p->nchunks == 0 || p->size - p->used < len + 1)
+		arena_grow(p, len + 1);
+
+	*chunk = p->nchunks - 1;
+	*off = p->used;
+	memcpy(p->chunks[*chunk] + *off, s, len);
+	p->chunks[*chunk][*off + len] = '\0';
+	p->used += len + 1;
+	p->bytes += len + 1;
+}
+
+static inline uint32_t
+dir_hash(uint32_t parent, const char *name, size_t len)
+{
+	uint32_t	 h = 2166136261U ^ parent;
+	size_t		 i;
+
+	for (i = 0; i < len; ++i) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void
+dir_rehash(struct playlist *p)
+{
+	const struct pldir	*d;
+	size_t			 i, newsize, mask;
+	uint32_t		 h;
+
+	newsize = MAX(64, p->dirhashsz * 2);
+	free(p->dirhash);
+	p->dirhash = xcalloc(newsize, sizeof(*p->dirhash));
+	p->dirhashsz = newsize;
+	mask = newsize - 1;
+
+	for (i = 0; i < p->ndirs; ++i) {
+		d = &p->dirs[i];
+		h = dir_hash(d->parent, arena_str(p, d->chunk, d->off),
+		    d->len) & mask;
+		while (p->dirhash[h] != 0)
+			h = (h + 1) & mask;
+		p->dirhash[h] = i + 1;
+	}
+}
+
+/*
+ * Look up the directory name under parent.  Returns its id, or
+ * PL_NODIR if it's not there; *slot is then where it would go.
+ */
+static uint32_t
+dir_find(const struct playlist *p, uint32_t parent, const char *name,
+    size_t len, uint32_t *slot)
+{
+	const struct pldir	*d;
+	size_t			 mask;
+	uint32_t		 h, id;
+
+	if (p->dirhashsz == 0)
+		return PL_NODIR;
+
+	mask = p->dirhashsz - 1;
+	h = dir_hash(parent, name, len) & mask;
+	while ((id = p->dirhash[h]) != 0) {
+		d = &p->dirs[id - 1];
+		if (d->parent == parent && d->len == len &&
+		    !memcmp(arena_str(p, d->chunk, d->off), name, len))
+			return id - 1;
+		h = (h + 1) & mask;
+	}
+
+	*slot = h;
+	return PL_NODIR;
+}
+
+/* return the id of the directory name under parent, adding it if new */
+static uint32_t
+dir_intern(struct playlist *p, uint32_t parent, const char *name,
+    size_t len)
+{
+	struct pldir	*d;
+	size_t		 newcap;
+	uint32_t	 h, id;
+
+	if ((p->ndirs + 1) * 2 > p->dirhashsz)
+		dir_rehash(p);
+
+	if ((id = dir_find(p, parent, name, len, &h)) != PL_NODIR)
+		return id;
+
+	if (p->ndirs == p->dircap) {
+		newcap = MAX(16, p->dircap * 2);
+		p->dirs = xrecallocarray(p->dirs, p->dircap, newcap,
+		    sizeof(*p->dirs));
+		p->dircap = newcap;
+	}
+
+	id = p->ndirs++;
+	d = &p->dirs[id];
+	d->parent = parent;
+	d->len = len;
+	arena_put(p, name, len, &d->chunk, &d->off);
+	p->dirhash[h] = id + 1;
+	return id;
+}
+
+static void
+ents_grow(struct playlist *p, size_t n)
+{
+	size_t	 newcap;
+
+	if (p->cap - p->len >= n)
+		return;
+
+	newcap = MAX(16, p->cap * 1.5);
+	if (newcap - p->len < n)
+		newcap = p->len + n;
+	p->ents = xrecallocarray(p->ents, p->cap, newcap, sizeof(*p->ents));
+	p->cap = newcap;
+}
+
+/*
+ * The entries are also hashed by directory and basename, to find a
+ * path without walking the whole playlist.  The removed ones are left
+ * in the table until the next rehash and skipped by the lookups.
+ */
+static inline uint32_t
+ent_hash(const struct playlist *p, const struct plent *e)
+{
+	const char	*base;
+
+	base = arena_str(p, e->chunk, e->off);
+	return dir_hash(e->dir, base, strlen(base));
+}
+
+static void
+ent_insert(struct playlist *p, size_t i)
+{
+	size_t		 mask = p->enthashsz - 1;
+	uint32_t	 h;
+
+	h = ent_hash(p, &p->ents[i]) & mask;
+	while (p->enthash[h] != 0)
+		h = (h + 1) & mask;
+	p->enthash[h] = i + 1;
+}
+
+/* rebuild the table, big enough for at least n entries */
+static void
+ent_rehash(struct playlist *p, size_t n)
+{
+	size_t	 i, newsize;
+
+	for (newsize = 64; newsize < n * 2; newsize *= 2)
+		/* nop */ ;
+
+	free(p->enthash);
+	p->enthash = xcalloc(newsize, sizeof(*p->enthash));
+	p->enthashsz = newsize;
+
+	for (i = 0; i < p->len; ++i)
+		if (!playlist_isdead(p, i))
+			ent_insert(p, i);
+}
+
+/*
+ * Returns the index of the first live entry with the given path, or
+ * -1 if there's none.
+ */
+ssize_t
+playlist_find(const struct playlist *p, const char *path)
+{
+	const struct plent	*e;
+	const char		*base, *s, *t;
+	size_t			 len, mask;
+	ssize_t			 found = -1;
+	uint32_t		 dir = PL_NODIR, h, id;
+
+	if (p->enthashsz == 0)
+		return -1;
+
+	if ((base = strrchr(path, '/')) != NULL) {
+		for (s = path; ; s = t + 1) {
+			t = strchr(s, '/');
+			dir = dir_find(p, dir, s, t - s, &h);
+			if (dir == PL_NODIR)
+				return -1;
+			if (t == base)
+				break;
+		}
+		base++;
+	} else
+		base = path;
+
+	len = strlen(base);
+	mask = p->enthashsz - 1;
+	h = dir_hash(dir, base, len) & mask;
+	for (; (id = p->enthash[h]) != 0; h = (h + 1) & mask) {
+		e = &p->ents[id - 1];
+		if (e->chunk == PL_DEAD || e->dir != dir ||
+		    strcmp(arena_str(p, e->chunk, e->off), base) != 0)
+			continue;
+		if (found == -1 || id - 1 < (size_t)found)
+			found = id - 1;
+	}
+
+	return found;
+}
+
+/*
+ * The search index maps every trigram of the names, lowercased, to the
+ * sorted list of the directories and of the entries that contain it.
+ * The lists are delta-encoded as varints, since they're only read in
+ * order.  It also keeps the list of entries in each directory.  It's
+ * built the first time the playlist is searched and then kept up to
+ * date by playlist_push and across playlist_swap.
+ */
+struct plpost {
+	uint8_t		*buf;
+	uint32_t	 len;
+	uint32_t	 cap;
+	uint32_t	 n;		/* number of ids */
+	uint32_t	 last;		/* last id added */
+};
+
+struct plgram {
+	uint32_t	 key;		/* the trigram, or 0 if empty */
+	struct plpost	 post;
+};
+
+struct plgrams {
+	struct plgram	*tab;
+	size_t		 size;
+	size_t		 n;
+};
+
+struct plindex {
+	struct plgrams	 dgrams;	/* trigrams of the directories */
+	struct plgrams	 egrams;	/* trigrams of the basenames */
+	struct plpost	*dirents;	/* entries in each directory */
+	struct plpost	*children;	/* subdirectories of each one */
+	uint32_t	*under;		/* entries in each dir and below */
+	size_t		 dircap;
+	size_t		 ndirs;		/* directories indexed so far */
+	size_t		 nents;		/* entries indexed so far */
+
+	uint32_t	*ids;		/* scratch space for the searches */
+	size_t		 idscap;
+};
+
+static void
+post_add(struct plpost *pp, uint32_t id)
+{
+	uint32_t	 d;
+	size_t		 newcap;
+
+	if (pp->n != 0 && pp->last == id)
+		return;
+
+	if (pp->cap - pp->len < 5) {
+		newcap = MAX(8, pp->cap * 2);
+		pp->buf = xreallocarray(pp->buf, newcap, 1);
+		pp->cap = newcap;
+	}
+
+	d = pp->n == 0 ? id : id - pp->last;
+	while (d >= 0x80) {
+		pp->buf[pp->len++] = (d & 0x7f) | 0x80;
+		d >>= 7;
+	}
+	pp->buf[pp->len++] = d;
+	pp->last = id;
+	pp->n++;
+}
+
+/* store in id the next one of the list; returns 0 at the end */
+static inline int
+post_next(const struct plpost *pp, size_t *pos, uint32_t *id)
+{
+	uint32_t	 d = 0;
+	int		 shift = 0, first = *pos == 0;
+
+	if (*pos == pp->len)
+		return 0;
+
+	do {
+		d |= (uint32_t)(pp->buf[*pos] & 0x7f) << shift;
+		shift += 7;
+	} while (pp->buf[(*pos)++] & 0x80);
+
+	*id = first ? d : *id + d;
+	return 1;
+}
+
+static inline uint32_t
+gram_key(const char *s)
+{
+	return (uint32_t)tolower((unsigned char)s[0]) << 16 |
+	    (uint32_t)tolower((unsigned char)s[1]) << 8 |
+	    (uint32_t)tolower((unsigned char)s[2]);
+}
+
+static inline size_t
+gram_hash(uint32_t key, size_t mask)
+{
+	return (key * 2654435761U) & mask;
+}
+
+static void
+grams_rehash(struct plgrams *g)
+{
+	struct plgram	*tab;
+	size_t		 i, h, mask, newsize;
+
+	newsize = MAX(256, g->size * 2);
+	tab = xcalloc(newsize, sizeof(*tab));
+	mask = newsize - 1;
+
+	for (i = 0; i < g->size; ++i) {
+		if (g->tab[i].key == 0)
+			continue;
+		h = gram_hash(g->tab[i].key, mask);
+		while (tab[h].key != 0)
+			h = (h + 1) & mask;
+		tab[h] = g->tab[i];
+	}
+
+	free(g->tab);
+	g->tab = tab;
+	g->size = newsize;
+}
+
+/* the list of the trigram key, or NULL if it's not there and !create */
+static struct plpost *
+grams_get(struct plgrams *g, uint32_t key, int create)
+{
+	size_t		 h, mask;
+
+	if (create && (g->n + 1) * 2 > g->size)
+		grams_rehash(g);
+	if (g->size == 0)
+		return NULL;
+
+	mask = g->size - 1;
+	h = gram_hash(key, mask);
+	while (g->tab[h].key != 0) {
+		if (g->tab[h].key == key)
+			return &g->tab[h].post;
+		h = (h + 1) & mask;
+	}
+
+	if (!create)
+		return NULL;
+	g->tab[h].key = key;
+	g->n++;
+	return &g->tab[h].post;
+}
+
+static void
+grams_add(struct plgrams *g, const char *s, size_t len, uint32_t id)
+{
+	size_t		 i;
+
+	for (i = 0; i + 3 <= len; ++i)
+		post_add(grams_get(g, gram_key(s + i), 1), id);
+}
+
+/*
+ * The shortest list among the trigrams of s, or NULL if one of them
+ * is missing and so nothing can match.  s must be at least 3 bytes.
+ */
+static const struct plpost *
+grams_rarest(struct plgrams *g, const char *s, size_t len)
+{
+	const struct plpost	*pp, *best = NULL;
+	size_t			 i;
+
+	for (i = 0; i + 3 <= len; ++i) {
+		if ((pp = grams_get(g, gram_key(s + i), 0)) == NULL)
+			return NULL;
+		if (best == NULL || pp->n < best->n)
+			best = pp;
+	}
+	return best;
+}
+
+/*
+ * Keep only the ids that are also in the lists of the trigrams of s.
+ * The lists much longer than ids aren't worth going through, so they
+ * are skipped.  Returns how many are left.
+ */
+static size_t
+grams_filter(struct plgrams *g, const char *s, size_t len, uint32_t *ids,
+    size_t n)
+{
+	const struct plpost	*pp;
+	size_t			 i, j, k, pos;
+	uint32_t		 id;
+
+	for (i = 0; n != 0 && i + 3 <= len; ++i) {
+		if ((pp = grams_get(g, gram_key(s + i), 0)) == NULL)
+			return 0;
+		if (pp->n > n * 8)
+			continue;
+
+		pos = 0;
+		if (!post_next(pp, &pos, &id))
+			return 0;
+		for (j = 0, k = 0; j < n; ++j) {
+			while (id < ids[j] && post_next(pp, &pos, &id))
+				;	/* nop */
+			if (id == ids[j])
+				ids[k++] = ids[j];
+			else if (id < ids[j])
+				break;	/* the list is over */
+		}
+		n = k;
+	}
+	return n;
+}
+
+static void
+grams_free(struct plgrams *g)
+{
+	size_t		 i;
+
+	for (i = 0; i < g->size; ++i)
+		free(g->tab[i].post.buf);
+	free(g->tab);
+}
+
+/* index the directories and entries added since the last call */
+static void
+index_update(struct playlist *p)
+{
+	struct plindex		*ix = p->idx;
+	const struct pldir	*d;
+	const struct plent	*e;
+	const char		*base;
+	uint32_t		 id;
+
+	if (ix->dircap < p->ndirs) {
+		ix->dirents = xrecallocarray(ix->dirents, ix->dircap,
+		    p->dircap, sizeof(*ix->dirents));
+		ix->children = xrecallocarray(ix->children, ix->dircap,
+		    p->dircap, sizeof(*ix->children));
+		ix->under = xrecallocarray(ix->under, ix->dircap,
+		    p->dircap, sizeof(*ix->under));
+		ix->dircap = p->dircap;
+	}
+
+	for (; ix->ndirs < p->ndirs; ix->ndirs++) {
+		d = &p->dirs[ix->ndirs];
+		if (d->parent != PL_NODIR)
+			post_add(&ix->children[d->parent], ix->ndirs);
+		grams_add(&ix->dgrams, arena_str(p, d->chunk, d->off),
+		    d->len, ix->ndirs);
+	}
+
+	for (; ix->nents < p->len; ix->nents++) {
+		e = &p->ents[ix->nents];
+		if (e->chunk == PL_DEAD)
+			continue;
+		if (e->dir != PL_NODIR)
+			post_add(&ix->dirents[e->dir], ix->nents);
+		for (id = e->dir; id != PL_NODIR; id = p->dirs[id].parent)
+			ix->under[id]++;
+		base = arena_str(p, e->chunk, e->off);
+		grams_add(&ix->egrams, base, strlen(base), ix->nents);
+	}
+}
+
+static void
+index_init(struct playlist *p)
+{
+	p->idx = xcalloc(1, sizeof(*p->idx));
+	index_update(p);
+}
+
+static void
+index_free(struct playlist *p)
+{
+	struct plindex	*ix = p->idx;
+	size_t		 i;
+
+	if (ix == NULL)
+		return;
+
+	grams_free(&ix->dgrams);
+	grams_free(&ix->egrams);
+	for (i = 0; i < ix->dircap; ++i) {
+		free(ix->dirents[i].buf);
+		free(ix->children[i].buf);
+	}
+	free(ix->dirents);
+	free(ix->children);
+	free(ix->ids);
+	free(ix->under);
+	free(ix);
+	p->idx = NULL;
+}
+
+/* rebuild the arena without the removed paths */
+static void
+arena_compact(struct playlist *p)
+{
+	struct playlist	 np;
+	size_t		 i;
+	char		 path[PATH_MAX];
+
+	memset(&np, 0, sizeof(np));
+	ents_grow(&np, playlist_live(p));
+	for (i = 0; i < p->len; ++i) {
+		if (playlist_isdead(p, i))
+			continue;
+		if (playlist_get(p, i, path, sizeof(path)) == NULL)
+			fatalx("%s: path too long", __func__);
+		playlist_push(&np, path);
+	}
+	playlist_free(p);
+	*p = np;
+}
+
+/*
+ * Drop the dead entries of the current playlist.  If the current song
+ * was removed, play_off is left just before the entry that followed it.
+ * The random anchor moves to the entry that follows it, if removed.
+ */
+void
+playlist_compact(void)
+{
+	size_t		 i, j;
+	ssize_t		 off = -1;
+
+	/* the next search rebuilds the index */
+	index_free(&playlist);
+	live_free(&playlist);
+	for (i = 0, j = 0; i < playlist.len; ++i) {
+		if (play_off == (ssize_t)i)
+			off = playlist_isdead(&playlist, i) ? (ssize_t)j - 1 : j;
+		if (random_anchor == (ssize_t)i)
+			random_anchor = j;
+		if (!playlist_isdead(&playlist, i))
+			playlist.ents[j++] = playlist.ents[i];
+	}
+
+	playlist.len = j;
+	playlist.ndead = 0;
+	play_off = off;
+
+	if (playlist.waste > PL_CHUNKSIZ &&
+	    playlist.waste > playlist.bytes / 2)
+		arena_compact(&playlist);
+	else
+		ent_rehash(&playlist, playlist.len);
+}
+
+/*
+ * Compact once the dead entries are the most.  Not in random mode:
+ * the permutation depends on the length of the playlist, compacting
+ * would change it halfway and skip tracks not yet played.  It's done
+ * when random is turned off, the playlist replaced or shuffled.
+ */
+static void
+maybe_compact(void)
+{
+	if (!random_mode && playlist.ndead > PL_MINDEAD &&
+	    playlist.ndead > playlist.len / 2)
+		playlist_compact();
+}
+
+void
+playlist_swap(struct playlist *p, ssize_t off)
+{
+	ssize_t i = -1;
+
+	if (off > p->len)
+		off = -1;
+
+	/* try to match the currently played song */
+	if (current_song != NULL && off < 0)
+		i = playlist_find(p, current_song);
+
+	playlist_truncate();
+
+	if (i != -1)
+		play_off = i;
+	else if (off >= 0)
+		play_off = off;
+	random_anchor = play_off;
+
+	/* the search index, if any, is built by the next search */
+	playlist = *p;
+
+	if (play_state == STATE_STOPPED)
+		setsong(play_off);
+}
+
+void
+playlist_push(struct playlist *p, const char *path)
+{
+	struct plent	*e;
+	const char	*base, *s, *t;
+	uint32_t	 dir = PL_NODIR;
+
+	/* intern every component of the directory, even empty ones */
+	if ((base = strrchr(path, '/')) != NULL) {
+		for (s = path; ; s = t + 1) {
+			t = strchr(s, '/');
+			dir = dir_intern(p, dir, s, t - s);
+			if (t == base)
+				break;
+		}
+		base++;
+	} else
+		base = path;
+
+	ents_grow(p, 1);
+	e = &p->ents[p->len++];
+	e->dir = dir;
+	arena_put(p, base, strlen(base), &e->chunk, &e->off);
+
+	if (p->len * 2 > p->enthashsz)
+		ent_rehash(p, p->len);
+	else
+		ent_insert(p, p->len - 1);
+
+	if (p->live != NULL)
+		live_push(p);
+	if (p->idx != NULL)
+		index_update(p);
+}
+
+/*
+ * Fill p with the paths in buf, each one terminated by a NUL.
+ * Returns -1 if the data is malformed, leaving p untouched.
+ */
+int
+playlist_decode(struct playlist *p, const char *buf, size_t len)
+{
+	const char	*s, *end = buf + len;
+	size_t		 n = 0, l;
+
+	if (len != 0 && buf[len - 1] != '\0')
+		return -1;
+
+	for (s = buf; s < end; s += l + 1) {
+		l = strlen(s);
+		if (l == 0 || l >= PATH_MAX)
+			return -1;
+		n++;
+	}
+
+	memset(p, 0, sizeof(*p));
+	if (n == 0)
+		return 0;
+
+	ents_grow(p, n);
+	for (s = buf; s < end; s += strlen(s) + 1)
+		playlist_push(p, s);
+	return 0;
+}
+
+/*
+ * Based on canonpath from kern_pledge.c.  Relative paths are resolved
+ * against dir.
+ */
+int
+canonpath(const char *dir, const char *input, char *buf, size_t bufsize)
+{
+	const char *p;
+	char *q, path[PATH_MAX];
+	int r;
+
+	if (input[0] != '/') {
+		r = snprintf(path, sizeof(path), "%s/%s", dir, input);
+		if (r < 0 || (size_t)r >= sizeof(path)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		input = path;
+	}
+
+	p = input;
+	q = buf;
+	while (*p && (q - buf < bufsize)) {
+		if (p[0] == '/' && (p[1] == '/' || p[1] == '\0')) {
+			p += 1;
+
+		} else if (p[0] == '/' && p[1] == '.' &&
+		    (p[2] == '/' || p[2] == '\0')) {
+			p += 2;
+
+		} else if (p[0] == '/' && p[1] == '.' && p[2] == '.' &&
+		    (p[3] == '/' || p[3] == '\0')) {
+			p += 3;
+			if (q != buf)	/* "/../" at start of buf */
+				while (*--q != '/')
+					continue;
+
+		} else {
+			*q++ = *p++;
+		}
+	}
+	if ((*p == '\0') && (q - buf < bufsize)) {
+		*q = 0;
+		return 0;
+	} else {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+}
+
+/*
+ * Whether path names a file descriptor rather than a file: opened by
+ * another process it would give that process' own descriptor.
+ */
+int
+isfdpath(const char *path)
+{
+	return (!strncmp(path, "/dev/fd/", 8) ||
+	    !strncmp(path, "/dev/std", 8) ||
+	    !strncmp(path, "/proc/", 6));
+}
+
+static void
+parse_line(struct playlist *p, char *line, const char *dir, ssize_t *curr,
+    size_t *skipped)
+{
+	char	 path[PATH_MAX];
+	size_t	 len;
+	int	 current = 0;
+
+	if (!strncmp(line, "> ", 2)) {
+		line += 2;
+		current = 1;
+	} else if (!strncmp(line, "  ", 2))
+		line += 2;
+
+	len = strlen(line);
+	if (len > 0 && line[len - 1] == '\r')
+		line[--len] = '\0';
+	if (len == 0 || *line == '#')
+		return;
+
+	if (canonpath(dir, line, path, sizeof(path)) == -1) {
+		(*skipped)++;
+		return;
+	}
+
+	if (current)
+		*curr = p->len;
+	playlist_push(p, path);
+}
+
+/*
+ * Fill p with the entries of the playlist file in fd, as saved by show
+ * or as a m3u file, reading it in chunks.  The entry prefixed by "> ",
+ * if any, is stored in curr.  Empty lines and the ones starting with a
+ * '#' are skipped, and relative paths are resolved against dir.
+ * Returns -1 on error, leaving p empty.
+ */
+int
+playlist_parse(struct playlist *p, int fd, const char *dir, ssize_t *curr)
+{
+	char	*buf, *s, *nl;
+	size_t	 len = 0, skipped = 0;
+	ssize_t	 r;
+	int	 toolong = 0;
+
+	memset(p, 0, sizeof(*p));
+	*curr = -1;
+	buf = xmalloc(PL_READSIZ + 1);
+
+	for (;;) {
+		if ((r = read(fd, buf + len, PL_READSIZ - len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			playlist_free(p);
+			return -1;
+		}
+		if (r == 0)
+			break;
+		len += r;
+
+		s = buf;
+		while ((nl = memchr(s, '\n', buf + len - s)) != NULL) {
+			*nl = '\0';
+			if (toolong)
+				skipped++;
+			else
+				parse_line(p, s, dir, curr, &skipped);
+			toolong = 0;
+			s = nl + 1;
+		}
+
+		len -= s - buf;
+		memmove(buf, s, len);
+		if (len == PL_READSIZ) {
+			/* way longer than PATH_MAX, drop it */
+			toolong = 1;
+			len = 0;
+		}
+	}
+
+	if (len != 0 && !toolong) {
+		buf[len] = '\0';
+		parse_line(p, buf, dir, curr, &skipped);
+	}
+
+	if (skipped != 0)
+		log_warnx("skipped %zu entries with a too long path", skipped);
+	free(buf);
+	return 0;
 }
 
 void
-playlist_swap(struct playlist *p, ssize_t off)
+playlist_enqueue(const char *path)
 {
-	ssize_t i = -1;
+	playlist_push(&playlist, path);
+}
 
-	if (off > p->len)
-		off = -1;
+/*
+ * In random mode the entries are played in the order given by a keyed
+ * permutation of [0, len): a Feistel network over the smallest even
+ * number of bits that covers len, walking again over the values that
+ * fall out of range.  It needs no memory and leaves the playlist as it
+ * was loaded; picking a new key gives a new order.
+ *
+ * The walk starts from the anchor, the track that was playing when
+ * random was turned on or that was jumped to, and goes around the
+ * permutation from there: it's over when it gets back to the anchor.
+ */
+#define PL_ROUNDS	4
 
-	if (current_song != NULL && off < 0) {
-		/* try to match the currently played song */
-		for (i = 0; i < p->len; ++i) {
-			if (!strcmp(current_song, p->songs[i]))
-				break;
+static uint32_t	 random_key[PL_ROUNDS];
+
+static inline uint32_t
+feistel_round(uint32_t x, uint32_t k)
+{
+	x ^= k;
+	x *= 0x9e3779b1U;
+	x ^= x >> 15;
+	x *= 0x85ebca6bU;
+	x ^= x >> 13;
+	return x;
+}
+
+/* one pass of the network, with halves of the given bits */
+static uint64_t
+feistel(uint64_t x, int bits, int inverse)
+{
+	uint32_t	 l, r, t, mask = (1ULL << bits) - 1;
+	int		 i;
+
+	l = x >> bits;
+	r = x & mask;
+	if (!inverse) {
+		for (i = 0; i < PL_ROUNDS; ++i) {
+			t = r;
+			r = l ^ (feistel_round(r, random_key[i]) & mask);
+			l = t;
+		}
+	} else {
+		for (i = PL_ROUNDS - 1; i >= 0; --i) {
+			t = l;
+			l = r ^ (feistel_round(l, random_key[i]) & mask);
+			r = t;
 		}
-		if (i == p->len)
-			i = -1;
 	}
+	return ((uint64_t)l << bits) | r;
+}
 
-	playlist_truncate();
-
-	if (i != -1)
-		play_off = i;
-	else if (off >= 0)
-		play_off = off;
+/* map the n-th position in the playing order to an offset, or back */
+static size_t
+random_map(size_t n, int inverse)
+{
+	uint64_t	 x = n;
+	int		 bits = 1;
 
-	playlist.len = p->len;
-	playlist.cap = p->cap;
-	playlist.songs = p->songs;
+	while ((1ULL << (2 * bits)) < playlist.len)
+		bits++;
 
-	if (play_state == STATE_STOPPED)
-		setsong(play_off);
+	do {
+		x = feistel(x, bits, inverse);
+	} while (x >= playlist.len);
+	return x;
 }
 
 void
-playlist_push(struct playlist *playlist, const char *path)
+playlist_setrandom(int on)
 {
-	size_t newcap;
-
-	if (playlist->len == playlist->cap) {
-		newcap = MAX(16, playlist->cap * 1.5);
-		playlist->songs = xrecallocarray(playlist->songs,
-		    playlist->cap, newcap, sizeof(*playlist->songs));
-		playlist->cap = newcap;
+	if (on && !random_mode) {
+		arc4random_buf(random_key, sizeof(random_key));
+		random_anchor = play_off;
 	}
+	random_mode = on;
 
-	playlist->songs[playlist->len++] = xstrdup(path);
+	/* catch up with what playlist_dropcurrent() deferred */
+	if (!random_mode)
+		maybe_compact();
 }
 
-void
-playlist_enqueue(const char *path)
+/*
+ * Returns the offset of the entry that follows (or precedes, if step
+ * is -1) off in the playing order, skipping the removed ones.  Returns
+ * -1 at the end of the playlist, unless repeat_all is set.
+ */
+static ssize_t
+playlist_step(ssize_t off, int step)
 {
-	playlist_push(&playlist, path);
+	ssize_t	 n, len = playlist.len;
+	size_t	 base = 0;
+
+	if (playlist_live(&playlist) == 0)
+		return -1;
+
+	/* positions are relative to the anchor in random mode */
+	if (random_mode && random_anchor >= 0 && random_anchor < len)
+		base = random_map(random_anchor, 1);
+
+	n = off;
+	if (random_mode && off != -1)
+		n = (random_map(off, 1) + len - base) % len;
+
+	do {
+		n += step;
+		if (n < 0 || n >= len) {
+			if (!repeat_all)
+				return -1;
+			n = n < 0 ? len - 1 : 0;
+		}
+		off = random_mode ? (ssize_t)random_map((n + base) % len, 0) : n;
+	} while (playlist_isdead(&playlist, off));
+
+	return off;
 }
 
 const char *
 playlist_advance(void)
 {
-	if (playlist.len == 0) {
+	play_off = playlist_step(play_off, 1);
+	setsong(play_off);
+	if (play_off == -1) {
 		play_state = STATE_STOPPED;
 		return NULL;
 	}
 
-	play_off++;
-	if (play_off == playlist.len) {
-		if (repeat_all)
-			play_off = 0;
-		else {
-			play_state = STATE_STOPPED;
-			play_off = -1;
-			setsong(play_off);
-			return NULL;
-		}
-	}
-
-	setsong(play_off);
 	play_state = STATE_PLAYING;
-	return playlist.songs[play_off];
+	return current_song;
+}
+
+/* what playlist_advance() would return, without moving */
+const char *
+playlist_peek(char *buf, size_t size)
+{
+	ssize_t off;
+
+	if ((off = playlist_step(play_off, 1)) == -1)
+		return NULL;
+
+	/* the current song is going to be removed */
+	if (consume && off == play_off)
+		return NULL;
+
+	return playlist_get(&playlist, off, buf, size);
 }
 
 const char *
 playlist_previous(void)
 {
-	if (playlist.len == 0) {
+	play_off = playlist_step(play_off, -1);
+	setsong(play_off);
+	if (play_off == -1) {
 		play_state = STATE_STOPPED;
 		return NULL;
 	}
 
-	play_off--;
-	if (play_off < 0) {
-		if (repeat_all)
-			play_off = playlist.len - 1;
-		else {
-			play_state = STATE_STOPPED;
-			play_off = -1;
-			setsong(play_off);
-			return NULL;
-		}
-	}
-
-	setsong(play_off);
 	play_state = STATE_PLAYING;
-	return playlist.songs[play_off];
+	return current_song;
 }
 
 void
@@ -155,17 +1238,20 @@ playlist_reset(void)
 }
 
 void
-playlist_free(struct playlist *playlist)
+playlist_free(struct playlist *p)
 {
 	size_t i;
 
-	for (i = 0; i < playlist->len; ++i)
-		free(playlist->songs[i]);
-	free(playlist->songs);
-	playlist->songs = NULL;
-
-	playlist->len = 0;
-	playlist->cap = 0;
+	for (i = 0; i < p->nchunks; ++i)
+		free(p->chunks[i]);
+	free(p->chunks);
+	free(p->ents);
+	free(p->dirs);
+	free(p->dirhash);
+	free(p->enthash);
+	free(p->live);
+	index_free(p);
+	memset(p, 0, sizeof(*p));
 }
 
 void
@@ -173,54 +1259,479 @@ playlist_truncate(void)
 {
 	playlist_free(&playlist);
 	play_off = -1;
+	random_anchor = -1;
 }
 
+/* mark the i-th entry as removed */
 void
-playlist_dropcurrent(void)
+playlist_drop(struct playlist *p, size_t i)
 {
-	size_t i;
+	struct plent	*e;
+
+	if (playlist_isdead(p, i))
+		return;
+
+	e = &p->ents[i];
+	p->waste += strlen(arena_str(p, e->chunk, e->off)) + 1;
+	e->chunk = PL_DEAD;
+	p->ndead++;
+	if (p->live != NULL)
+		live_drop(p, i);
+}
 
-	if (play_off == -1 || playlist.len == 0)
+void
+playlist_dropcurrent(void)
+{
+	if (play_off == -1 || playlist_isdead(&playlist, play_off))
 		return;
 
-	free(playlist.songs[play_off]);
+	playlist_drop(&playlist, play_off);
 	setsong(-1);
+	maybe_compact();
+}
+
+/*
+ * Searching: the pattern is split in words that must all appear in the
+ * path, ignoring the case.  A word without slashes must be within a
+ * single directory name or in the basename, so it can be looked up in
+ * the index.  The others are matched against the whole path, after
+ * filtering with their longest part without slashes (the key).
+ *
+ * The candidates are taken from the word that matches the fewest
+ * entries, and filtered with the lists of the words that can only be
+ * in the basename before being checked one by one.
+ */
+#define PL_EXACT	1000	/* bonus when the whole path matches */
 
-	playlist.len--;
-	for (i = play_off; i < playlist.len; ++i)
-		playlist.songs[i] = playlist.songs[i+1];
-	play_off--;
+struct plword {
+	char		*word;
+	char		*key;
+	size_t		 keylen;
+	int		 slow;		/* the word has slashes */
+	int		 indirs;	/* the key may be in a directory */
+	uint8_t		*dirs;		/* the dir or a parent has the key */
+	size_t		 cost;		/* estimated number of candidates */
+};
 
-	playlist.songs[playlist.len] = NULL;
+static inline const char *
+dir_name(const struct playlist *p, uint32_t id)
+{
+	return arena_str(p, p->dirs[id].chunk, p->dirs[id].off);
 }
 
-const char *
-playlist_jump(const char *arg)
+/* like strcasestr, but the key is already lowercase */
+static inline const char *
+word_find(const char *s, const struct plword *w)
 {
-	size_t i;
+	for (; *s != '\0'; ++s) {
+		if (tolower((unsigned char)*s) == w->key[0] &&
+		    !strncasecmp(s + 1, w->key + 1, w->keylen - 1))
+			return s;
+	}
+	return NULL;
+}
 
-	for (i = 0; i < playlist.len; ++i) {
-		if (strcasestr(playlist.songs[i], arg) != NULL)
+/* whether the key is in the directory id or in one of its parents */
+static int
+word_indir(const struct playlist *p, const struct plword *w, uint32_t id)
+{
+	for (; id != PL_NODIR; id = p->dirs[id].parent)
+		if (word_find(dir_name(p, id), w) != NULL)
+			return 1;
+	return 0;
+}
+
+static void
+word_init(struct playlist *p, struct plword *w, char *word)
+{
+	const struct plpost	*pp;
+	char			*s, *t;
+	size_t			 i, len, pos = 0;
+	uint32_t		 id = 0;
+
+	memset(w, 0, sizeof(*w));
+	w->word = word;
+	w->slow = strchr(word, '/') != NULL;
+
+	/* the key is the longest part without slashes */
+	for (s = word; *s != '\0'; s = t + (*t == '/')) {
+		t = s + strcspn(s, "/");
+		if ((len = t - s) > w->keylen) {
+			w->key = s;
+			w->keylen = len;
+		}
+	}
+	if (w->keylen != 0)
+		xasprintf(&w->key, "%.*s", (int)w->keylen, w->key);
+	for (i = 0; i < w->keylen; ++i)
+		w->key[i] = tolower((unsigned char)w->key[i]);
+
+	if (w->keylen < 3) {
+		w->indirs = w->keylen != 0;
+		w->cost = p->len;
+		return;
+	}
+
+	if ((pp = grams_rarest(&p->idx->egrams, w->key, w->keylen)) != NULL)
+		w->cost = pp->n;
+
+	pp = grams_rarest(&p->idx->dgrams, w->key, w->keylen);
+	while (pp != NULL && post_next(pp, &pos, &id)) {
+		if (word_find(dir_name(p, id), w) != NULL) {
+			w->indirs = 1;
+			w->cost += p->idx->under[id];
+		}
+	}
+}
+
+static int
+word_cmp(const void *a, const void *b)
+{
+	const struct plword	*wa = a, *wb = b;
+
+	return (wa->cost > wb->cost) - (wa->cost < wb->cost);
+}
+
+/* mark the directories that have the key, or whose parents do */
+static void
+word_dirs(struct playlist *p, struct plword *w)
+{
+	const struct plpost	*pp;
+	const struct pldir	*d;
+	size_t			 i, pos = 0;
+	uint32_t		 id = 0;
+
+	if (!w->indirs || p->ndirs == 0)
+		return;
+
+	w->dirs = xcalloc(p->ndirs, 1);
+	if (w->keylen >= 3) {
+		pp = grams_rarest(&p->idx->dgrams, w->key, w->keylen);
+		while (pp != NULL && post_next(pp, &pos, &id))
+			if (word_find(dir_name(p, id), w) != NULL)
+				w->dirs[id] = 1;
+	} else {
+		for (i = 0; i < p->ndirs; ++i)
+			if (word_find(dir_name(p, i), w) != NULL)
+				w->dirs[i] = 1;
+	}
+
+	/* the parents are always interned before their children */
+	for (i = 0; i < p->ndirs; ++i) {
+		d = &p->dirs[i];
+		if (!w->dirs[i] && d->parent != PL_NODIR &&
+		    w->dirs[d->parent])
+			w->dirs[i] = 1;
+	}
+}
+
+/* a is a better match than b */
+static inline int
+match_better(const struct plmatch *a, const struct plmatch *b)
+{
+	if (a->score != b->score)
+		return a->score > b->score;
+	if (a->len != b->len)
+		return a->len < b->len;
+	return a->off < b->off;
+}
+
+static int
+match_cmp(const void *a, const void *b)
+{
+	return match_better(b, a) - match_better(a, b);
+}
+
+/* min-heap of the best n matches, with the worst one on top */
+static void
+heap_push(struct plmatch *h, size_t *len, size_t n, struct plmatch *m)
+{
+	struct plmatch	 tmp;
+	size_t		 i, c;
+
+	if (*len == n) {
+		if (!match_better(m, &h[0]))
+			return;
+		h[0] = *m;
+		for (i = 0; (c = 2 * i + 1) < n; i = c) {
+			if (c + 1 < n && match_better(&h[c], &h[c + 1]))
+				c++;
+			if (!match_better(&h[i], &h[c]))
+				break;
+			tmp = h[i];
+			h[i] = h[c];
+			h[c] = tmp;
+		}
+		return;
+	}
+
+	h[i = (*len)++] = *m;
+	for (; i > 0 && match_better(&h[(i - 1) / 2], &h[i]); i = (i - 1) / 2) {
+		tmp = h[i];
+		h[i] = h[(i - 1) / 2];
+		h[(i - 1) / 2] = tmp;
+	}
+}
+
+static inline int
+word_start(const char *base, const char *s)
+{
+	return s == base || !isalnum((unsigned char)s[-1]);
+}
+
+struct plsearch {
+	struct playlist	*p;
+	const char	*query;
+	struct plword	*w;
+	size_t		 nw;
+	struct plmatch	*heap;
+	size_t		 len;
+	size_t		 n;
+	uint8_t		*seen;		/* bitmap of the dirs already done */
+};
+
+/* check the i-th entry against the words and score it */
+static void
+search_check(struct plsearch *ps, size_t i)
+{
+	const struct playlist	*p = ps->p;
+	const struct plent	*e = &p->ents[i];
+	const struct plword	*w;
+	struct plmatch		 m;
+	const char		*base, *s;
+	size_t			 k;
+	int			 slow = 0;
+	char			 path[PATH_MAX];
+
+	if (e->chunk == PL_DEAD)
+		return;
+	base = arena_str(p, e->chunk, e->off);
+
+	memset(&m, 0, sizeof(m));
+	for (k = 0; k < ps->nw; ++k) {
+		w = &ps->w[k];
+		slow |= w->slow;
+		if (w->keylen == 0)
+			continue;
+		if ((s = word_find(base, w)) != NULL)
+			m.score += word_start(base, s) ? 6 : 4;
+		else if (!w->indirs || e->dir == PL_NODIR)
+			return;
+		else if (w->dirs != NULL ? w->dirs[e->dir] :
+		    word_indir(p, w, e->dir))
+			m.score += 1;
+		else
+			return;
+	}
+
+	if (slow) {
+		if (playlist_get(p, i, path, sizeof(path)) == NULL)
+			return;
+		for (k = 0; k < ps->nw; ++k)
+			if (ps->w[k].slow &&
+			    strcasestr(path, ps->w[k].word) == NULL)
+				return;
+		if (!strcasecmp(path, ps->query))
+			m.score += PL_EXACT;
+	} else if (e->dir == PL_NODIR && !strcasecmp(base, ps->query))
+		m.score += PL_EXACT;
+	else if (ps->nw > 1 && strcasestr(base, ps->query) != NULL)
+		m.score += 4;
+
+	m.off = i;
+	m.len = strlen(base);
+	heap_push(ps->heap, &ps->len, ps->n, &m);
+}
+
+static void
+ids_push(uint32_t **ids, size_t *len, size_t *cap, uint32_t id)
+{
+	if (*len == *cap) {
+		*cap = MAX(64, *cap * 2);
+		*ids = xreallocarray(*ids, *cap, sizeof(**ids));
+	}
+	(*ids)[(*len)++] = id;
+}
+
+/* check the entries below the directories that have the key of w */
+static void
+search_dirs(struct plsearch *ps, const struct plword *w)
+{
+	const struct playlist	*p = ps->p;
+	struct plindex		*ix = p->idx;
+	const struct plpost	*pp, *lp;
+	size_t			 pos, epos, len = 0, cap = 0;
+	uint32_t		 id, d, eid, *stack = NULL;
+
+	pp = grams_rarest(&ix->dgrams, w->key, w->keylen);
+	for (pos = 0; pp != NULL && post_next(pp, &pos, &id); ) {
+		/* skip those below another match, they're done with it */
+		if (word_find(dir_name(p, id), w) == NULL ||
+		    word_indir(p, w, p->dirs[id].parent))
+			continue;
+
+		if (ps->seen == NULL)
+			ps->seen = xcalloc(p->ndirs / 8 + 1, 1);
+
+		ids_push(&stack, &len, &cap, id);
+		while (len != 0) {
+			d = stack[--len];
+			ps->seen[d / 8] |= 1 << (d % 8);
+			lp = &ix->dirents[d];
+			for (epos = 0; post_next(lp, &epos, &eid); )
+				search_check(ps, eid);
+			lp = &ix->children[d];
+			for (epos = 0; post_next(lp, &epos, &eid); )
+				ids_push(&stack, &len, &cap, eid);
+		}
+	}
+	free(stack);
+}
+
+/* check the entries that have the key of w in the basename */
+static void
+search_base(struct plsearch *ps, const struct plword *w)
+{
+	const struct playlist	*p = ps->p;
+	struct plindex		*ix = p->idx;
+	const struct plpost	*pp;
+	const struct plent	*e;
+	size_t			 i, k, pos, n = 0;
+	uint32_t		 id, *ids;
+
+	if ((pp = grams_rarest(&ix->egrams, w->key, w->keylen)) == NULL)
+		return;
+
+	if (ix->idscap < pp->n) {
+		free(ix->ids);
+		ix->ids = xreallocarray(NULL, pp->n, sizeof(*ix->ids));
+		ix->idscap = pp->n;
+	}
+
+	ids = ix->ids;
+	for (pos = 0; post_next(pp, &pos, &id); )
+		ids[n++] = id;
+
+	/* the other words that can't be in a directory must be there too */
+	for (k = 0; k < ps->nw; ++k) {
+		if (&ps->w[k] == w || !ps->w[k].indirs)
+			n = grams_filter(&ix->egrams, ps->w[k].key,
+			    ps->w[k].keylen, ids, n);
+	}
+
+	for (i = 0; i < n; ++i) {
+		e = &p->ents[ids[i]];
+		if (ps->seen != NULL && e->dir != PL_NODIR &&
+		    ps->seen[e->dir / 8] & (1 << (e->dir % 8)))
+			continue;	/* done by search_dirs */
+		search_check(ps, ids[i]);
+	}
+}
+
+/*
+ * Find the n entries that best match the query and store them in m,
+ * best first.  Returns how many were found.
+ */
+size_t
+playlist_search(struct playlist *p, const char *query, struct plmatch *m,
+    size_t n)
+{
+	struct plsearch		 ps;
+	struct plword		*best;
+	char			*q, *s, *t;
+	size_t			 i, k, wcap = 0;
+
+	if (n == 0 || playlist_live(p) == 0)
+		return 0;
+
+	if (p->idx == NULL)
+		index_init(p);
+
+	memset(&ps, 0, sizeof(ps));
+	ps.p = p;
+	ps.query = query;
+	ps.heap = m;
+	ps.n = n;
+
+	q = xstrdup(query);
+	for (s = q; *s != '\0'; s = t) {
+		s += strspn(s, " \t\n");
+		if (*s == '\0')
 			break;
+		t = s + strcspn(s, " \t\n");
+		if (*t != '\0')
+			*t++ = '\0';
+
+		for (k = 0; k < ps.nw; ++k)
+			if (!strcasecmp(ps.w[k].word, s))
+				break;
+		if (k != ps.nw)
+			continue;
+
+		if (ps.nw == wcap) {
+			wcap = MAX(4, wcap * 2);
+			ps.w = xreallocarray(ps.w, wcap, sizeof(*ps.w));
+		}
+		word_init(p, &ps.w[ps.nw++], s);
+	}
+
+	if (ps.nw == 0)
+		goto done;
+
+	/* the most selective first, to discard the candidates earlier */
+	qsort(ps.w, ps.nw, sizeof(*ps.w), word_cmp);
+	best = &ps.w[0];
+
+	if (best->keylen >= 3 && best->cost < playlist_live(p)) {
+		if (best->indirs)
+			search_dirs(&ps, best);
+		search_base(&ps, best);
+	} else {
+		for (k = 0; k < ps.nw; ++k)
+			word_dirs(p, &ps.w[k]);
+		for (i = 0; i < p->len; ++i)
+			search_check(&ps, i);
+	}
+
+ done:
+	for (k = 0; k < ps.nw; ++k) {
+		free(ps.w[k].key);
+		free(ps.w[k].dirs);
 	}
+	free(ps.w);
+	free(ps.seen);
+	free(q);
+
+	for (k = 0; k < ps.len; ++k)
+		m[k].pos = playlist_pos(p, m[k].off);
 
-	if (i == playlist.len)
+	qsort(m, ps.len, sizeof(*m), match_cmp);
+	return ps.len;
+}
+
+const char *
+playlist_jump(const char *arg)
+{
+	struct plmatch	 m;
+
+	if (playlist_search(&playlist, arg, &m, 1) == 0)
 		return NULL;
 
 	play_state = STATE_PLAYING;
-	play_off = i;
+	play_off = m.off;
+	random_anchor = play_off;
 	setsong(play_off);
-	return playlist.songs[i];
+	return current_song;
 }
 
 static inline void
 swap(size_t a, size_t b)
 {
-	char		*tmp;
+	struct plent	 tmp;
 
-	tmp = playlist.songs[a];
-	playlist.songs[a] = playlist.songs[b];
-	playlist.songs[b] = tmp;
+	tmp = playlist.ents[a];
+	playlist.ents[a] = playlist.ents[b];
+	playlist.ents[b] = tmp;
 }
 
 void
@@ -228,9 +1739,15 @@ playlist_shuffle(int all)
 {
 	size_t		 i, j, start = 0;
 
+	if (playlist.ndead != 0)
+		playlist_compact();
+
 	if (playlist.len == 0)
 		return;
 
+	/* the entries are moved around: the next search reindexes */
+	index_free(&playlist);
+
 	if (play_off >= 0 && !all)
 		start = play_off;
 
@@ -244,4 +1761,185 @@ playlist_shuffle(int all)
 		j = start + arc4random_uniform(i - start);
 		swap(i, j);
 	}
+
+	ent_rehash(&playlist, playlist.len);
+	random_anchor = play_off;
+}
+
+/*
+ * Write the live entries of the playlist in fp, in the format of
+ * struct playlist_snapshot.  Returns -1 on failure.
+ */
+int
+playlist_dump(FILE *fp)
+{
+	struct playlist_snapshot	 hdr;
+	size_t				 i;
+	char				 path[PATH_MAX];
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.current = -1;
+	hdr.len = playlist_live(&playlist);
+	if (play_off != -1 && !playlist_isdead(&playlist, play_off))
+		hdr.current = playlist_pos(&playlist, play_off);
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		return -1;
+
+	for (i = 0; i < playlist.len; ++i) {
+		if (playlist_isdead(&playlist, i))
+			continue;
+		if (playlist_get(&playlist, i, path, sizeof(path)) == NULL ||
+		    fputs(path, fp) == EOF ||
+		    putc('\0', fp) == EOF)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Fill p with the entries of the snapshot in buf.  The offset of the
+ * current song, or -1, is stored in curr.
+ */
+int
+playlist_loadbuf(struct playlist *p, const char *buf, size_t len,
+    ssize_t *curr)
+{
+	struct playlist_snapshot	 hdr;
+
+	if (len < sizeof(hdr))
+		return -1;
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.version != SNAPSHOT_VERSION ||
+	    playlist_decode(p, buf + sizeof(hdr), len - sizeof(hdr)) == -1)
+		return -1;
+
+	if (p->len != hdr.len || hdr.current < -1 ||
+	    hdr.current >= (int64_t)p->len) {
+		playlist_free(p);
+		return -1;
+	}
+
+	*curr = hdr.current;
+	return 0;
+}
+
+#if HAVE_MEMFD_CREATE
+/*
+ * Dump the playlist into a sealed memfd, see struct playlist_snapshot.
+ * Returns the fd, or -1 on failure.
+ */
+int
+playlist_snapshot(void)
+{
+	FILE				*fp;
+	int				 fd, dfd;
+
+	fd = memfd_create("amused-snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1)
+		return -1;
+
+	if ((dfd = dup(fd)) == -1) {
+		close(fd);
+		return -1;
+	}
+	if ((fp = fdopen(dfd, "w")) == NULL) {
+		close(dfd);
+		close(fd);
+		return -1;
+	}
+
+	if (playlist_dump(fp) == -1)
+		goto err;
+
+	if (fclose(fp) == EOF) {
+		fp = NULL;
+		goto err;
+	}
+
+#ifdef F_ADD_SEALS
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+	    F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+		close(fd);
+		return -1;
+	}
+#endif
+
+	return fd;
+
+ err:
+	if (fp != NULL)
+		fclose(fp);
+	close(fd);
+	return -1;
+}
+#else
+int
+playlist_snapshot(void)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+/*
+ * Map the snapshot in fd and fill p with its entries.  The offset of
+ * the current song, or -1, is stored in curr.
+ */
+int
+playlist_loadsnapshot(int fd, struct playlist *p, ssize_t *curr)
+{
+	struct stat	 sb;
+	char		*m;
+	size_t		 len;
+	int		 r;
+
+	if (fstat(fd, &sb) == -1)
+		return -1;
+	if (sb.st_size < (off_t)sizeof(struct playlist_snapshot) ||
+	    (uintmax_t)sb.st_size > SIZE_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	len = sb.st_size;
+
+	m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED)
+		return -1;
+
+	r = playlist_loadbuf(p, m, len, curr);
+	munmap(m, len);
+	if (r == -1)
+		errno = EINVAL;
+	return r;
+}
+
+/*
+ * Parse an entry of IMSG_CTL_SHOW, for ctl and amused-web.  Older
+ * daemons ignore SHOW_VARLEN and send a whole struct player_status.
+ */
+int
+playlist_showentry(struct imsg *imsg, struct player_status *ps)
+{
+	struct player_entry	 e;
+	struct ibuf		 ibuf;
+	size_t			 len;
+
+	if (imsg_get_len(imsg) == sizeof(*ps)) {
+		if (imsg_get_data(imsg, ps, sizeof(*ps)) == -1 ||
+		    ps->path[sizeof(ps->path) - 1] != '\0')
+			return -1;
+		return 0;
+	}
+
+	if (imsg_get_ibuf(imsg, &ibuf) == -1 ||
+	    ibuf_get(&ibuf, &e, sizeof(e)) == -1 ||
+	    (len = ibuf_size(&ibuf)) == 0 || len > sizeof(ps->path) ||
+	    ibuf_get(&ibuf, ps->path, len) == -1 ||
+	    ps->path[len - 1] != '\0')
+		return -1;
+	ps->status = e.status;
+	return 0;
 }
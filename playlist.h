@@ -17,10 +17,93 @@
 #ifndef PLAYLIST_H
 #define PLAYLIST_H
 
+/*
+ * The directories are interned in a trie: each one is stored once as
+ * its last component and a link to its parent.  An entry is just its
+ * directory and its basename.  All the names are stored back to back
+ * in a few big chunks; removed ones aren't reclaimed until the arena
+ * is compacted.
+ *
+ * Removing an entry only marks it as dead, so the following entries
+ * keep their index.  The dead ones are skipped and dropped for good
+ * once they're half of the playlist.
+ *
+ * The indexes, play_off included, are only meaningful within the
+ * process that owns the playlist: playlist_compact() is the only place
+ * that renumbers them.  Whatever goes out, to the clients or to
+ * the state file, uses the position among the live entries instead,
+ * see playlist_pos() and playlist_offset().
+ */
+#define PL_NODIR	UINT32_MAX
+#define PL_DEAD		UINT32_MAX
+
+struct pldir {
+	uint32_t	 parent;	/* or PL_NODIR */
+	uint32_t	 len;
+	uint32_t	 chunk;
+	uint32_t	 off;
+};
+
+struct plent {
+	uint32_t	 dir;		/* or PL_NODIR */
+	uint32_t	 chunk;		/* or PL_DEAD */
+	uint32_t	 off;
+};
+
+struct imsg;
+struct player_status;
+struct plindex;
+
 struct playlist {
-	size_t	 len;
-	size_t	 cap;
-	char	**songs;
+	size_t		 len;
+	size_t		 cap;
+	size_t		 ndead;
+	struct plent	*ents;
+
+	struct pldir	*dirs;
+	size_t		 ndirs;
+	size_t		 dircap;
+	uint32_t	*dirhash;	/* dir id + 1, or 0 if empty */
+	size_t		 dirhashsz;
+	uint32_t	*enthash;	/* entry + 1, or 0 if empty */
+	size_t		 enthashsz;
+
+	char		**chunks;
+	size_t		 nchunks;
+	size_t		 chunkcap;
+	size_t		 used;		/* bytes used in the last chunk */
+	size_t		 size;		/* size of the last chunk */
+	size_t		 bytes;		/* total size of the names */
+	size_t		 waste;		/* of which are of removed entries */
+
+	struct plindex	*idx;		/* for playlist_search, or NULL */
+
+	uint32_t	*live;		/* Fenwick tree, or NULL */
+	size_t		 livecap;
+};
+
+/*
+ * A result of playlist_search: off is the index of the entry, pos its
+ * position counting only the live entries, as seen by show.
+ */
+struct plmatch {
+	size_t		 off;
+	size_t		 pos;
+	int		 score;
+	size_t		 len;		/* of the basename, to break ties */
+};
+
+/*
+ * A snapshot of the playlist, as sent with IMSG_CTL_SHOW: this header
+ * is followed by the paths, each one NUL-terminated.
+ */
+#define SNAPSHOT_VERSION	1
+
+struct playlist_snapshot {
+	uint32_t	version;
+	uint32_t	flags;		/* unused for now */
+	int64_t		current;	/* offset of the current song */
+	uint64_t	len;		/* number of entries */
 };
 
 enum play_state {
@@ -35,19 +118,44 @@ extern enum play_state	 play_state;
 extern int		 repeat_one;
 extern int		 repeat_all;
 extern int		 consume;
+extern int		 random_mode;
 extern ssize_t		 play_off;
 extern const char	*current_song;
 
+int			 canonpath(const char *, const char *, char *, size_t);
+int			 isfdpath(const char *);
+const char		*playlist_get(const struct playlist *, size_t, char *,
+			    size_t);
+int			 playlist_isdead(const struct playlist *, size_t);
+size_t			 playlist_pos(struct playlist *, size_t);
+ssize_t			 playlist_offset(struct playlist *, size_t);
+ssize_t			 playlist_find(const struct playlist *, const char *);
 void			 playlist_swap(struct playlist *, ssize_t);
 void			 playlist_push(struct playlist *, const char *);
+void			 playlist_drop(struct playlist *, size_t);
+void			 playlist_compact(void);
+int			 playlist_decode(struct playlist *, const char *, size_t);
+int			 playlist_parse(struct playlist *, int, const char *,
+			    ssize_t *);
+int			 playlist_dump(FILE *);
+int			 playlist_loadbuf(struct playlist *, const char *, size_t,
+			    ssize_t *);
+int			 playlist_snapshot(void);
+int			 playlist_loadsnapshot(int, struct playlist *, ssize_t *);
 void			 playlist_enqueue(const char *);
 const char		*playlist_advance(void);
+const char		*playlist_peek(char *, size_t);
 const char		*playlist_previous(void);
 void			 playlist_reset(void);
 void			 playlist_free(struct playlist *);
 void			 playlist_truncate(void);
 void			 playlist_dropcurrent(void);
 const char		*playlist_jump(const char *);
+size_t			 playlist_search(struct playlist *, const char *,
+			    struct plmatch *, size_t);
 void			 playlist_shuffle(int);
+void			 playlist_setrandom(int);
+int			 playlist_showentry(struct imsg *,
+			    struct player_status *);
 
 #endif
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+int
+ring_init(struct ring *r, size_t cap)
+{
+	memset(r, 0, sizeof(*r));
+	if ((r->buf = malloc(cap)) == NULL)
+		return -1;
+
+	r->cap = cap;
+	r->size = cap;
+	r->frame = 1;
+	return 0;
+}
+
+/*
+ * Change the frame size and limit the usable part of the buffer to
+ * at most size bytes.  The size is rounded down to a multiple of the
+ * frame size so that a frame is never split when wrapping around.
+ */
+void
+ring_setup(struct ring *r, size_t frame, size_t size)
+{
+	if (frame == 0 || frame > r->cap)
+		frame = 1;
+	if (size < frame || size > r->cap)
+		size = r->cap;
+
+	r->frame = frame;
+	r->size = size - size % frame;
+	ring_reset(r);
+}
+
+void
+ring_reset(struct ring *r)
+{
+	atomic_store(&r->head, 0);
+	atomic_store(&r->tail, 0);
+}
+
+size_t
+ring_used(struct ring *r)
+{
+	return atomic_load(&r->head) - atomic_load(&r->tail);
+}
+
+size_t
+ring_space(struct ring *r)
+{
+	size_t	 space;
+
+	space = r->size - ring_used(r);
+	return space - space % r->frame;
+}
+
+/*
+ * Append up to len bytes, rounded down to whole frames.  Only the
+ * producer may call this.
+ */
+size_t
+ring_write(struct ring *r, const void *buf, size_t len)
+{
+	size_t	 head, off, n, space;
+
+	head = atomic_load(&r->head);
+	space = r->size - (head - atomic_load(&r->tail));
+
+	if (len > space)
+		len = space;
+	len -= len % r->frame;
+	if (len == 0)
+		return 0;
+
+	off = head % r->size;
+	if ((n = r->size - off) > len)
+		n = len;
+
+	memcpy(r->buf + off, buf, n);
+	memcpy(r->buf, (const uint8_t *)buf + n, len - n);
+
+	atomic_store(&r->head, head + len);
+	return len;
+}
+
+/*
+ * Return the number of bytes that can be read contiguously starting
+ * at *p.  Only the consumer may call this.
+ */
+size_t
+ring_peek(struct ring *r, const void **p)
+{
+	size_t	 tail, off, n;
+
+	tail = atomic_load(&r->tail);
+	n = atomic_load(&r->head) - tail;
+
+	off = tail % r->size;
+	if (n > r->size - off)
+		n = r->size - off;
+
+	*p = r->buf + off;
+	return n;
+}
+
+void
+ring_consume(struct ring *r, size_t n)
+{
+	atomic_fetch_add(&r->tail, n);
+}
+
+/*
+ * Drop what was appended after the given head, unless the consumer
+ * already went past it.  Only the consumer may call this, while the
+ * producer is idle.
+ */
+int
+ring_truncate(struct ring *r, size_t head)
+{
+	if (head < atomic_load(&r->tail) || head > atomic_load(&r->head))
+		return -1;
+	atomic_store(&r->head, head);
+	return 0;
+}
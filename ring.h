@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Single-producer single-consumer ring of PCM frames.  head is only
+ * moved by the producer and tail only by the consumer, so neither
+ * needs a lock.  ring_setup() and ring_reset() may be called only
+ * while the other side is known to be idle.
+ */
+struct ring {
+	uint8_t			*buf;
+	size_t			 cap;	/* allocated size */
+	size_t			 size;	/* usable size, multiple of frame */
+	size_t			 frame;
+	_Atomic size_t		 head;
+	_Atomic size_t		 tail;
+};
+
+int	ring_init(struct ring *, size_t);
+void	ring_setup(struct ring *, size_t, size_t);
+void	ring_reset(struct ring *);
+size_t	ring_used(struct ring *);
+size_t	ring_space(struct ring *);
+size_t	ring_write(struct ring *, const void *, size_t);
+size_t	ring_peek(struct ring *, const void **);
+void	ring_consume(struct ring *, size_t);
+int	ring_truncate(struct ring *, size_t);
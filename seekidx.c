@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/stat.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "seekidx.h"
+#include "xmalloc.h"
+
+/*
+ * The cache file is the magic followed by the records, which are
+ * appended as they're updated.  It's compacted when there are too
+ * many stale records.  The most recently used entries are at the end
+ * of the cache array.
+ */
+static const char	 magic[8] = "AMSEEK01";
+static struct seekidx	*cache[SEEKIDX_FILES];
+static size_t		 ncache;
+static size_t		 ondisk;
+static int		 cachefd = -1;
+
+static int
+samefile(const struct seekidx *a, const struct seekidx *b)
+{
+	return a->dev == b->dev && a->ino == b->ino &&
+	    a->size == b->size && a->mtime == b->mtime;
+}
+
+static void
+cache_put(const struct seekidx *idx)
+{
+	struct seekidx	*copy;
+	size_t		 i, len;
+
+	for (i = 0; i < ncache; ++i)
+		if (samefile(cache[i], idx))
+			break;
+
+	if (i == ncache && ncache == SEEKIDX_FILES)
+		i = 0;		/* drop the least recently used */
+
+	if (i != ncache) {
+		free(cache[i]);
+		ncache--;
+		memmove(&cache[i], &cache[i + 1],
+		    (ncache - i) * sizeof(*cache));
+	}
+
+	len = SEEKIDX_SIZE(idx->nent);
+	copy = xmalloc(len);
+	memcpy(copy, idx, len);
+	cache[ncache++] = copy;
+}
+
+static int
+seekidx_rewrite(void)
+{
+	size_t	 i, len;
+	off_t	 off;
+
+	if (lseek(cachefd, 0, SEEK_SET) == -1 ||
+	    write(cachefd, magic, sizeof(magic)) != sizeof(magic))
+		goto err;
+
+	off = sizeof(magic);
+	for (i = 0; i < ncache; ++i) {
+		len = SEEKIDX_SIZE(cache[i]->nent);
+		if (write(cachefd, cache[i], len) != (ssize_t)len)
+			goto err;
+		off += len;
+	}
+
+	if (ftruncate(cachefd, off) == -1)
+		goto err;
+
+	ondisk = ncache;
+	return 0;
+
+err:
+	log_warn("can't write the seek index cache");
+	close(cachefd);
+	cachefd = -1;
+	return -1;
+}
+
+int
+seekidx_init(int fd)
+{
+	struct seekidx	 idx;
+	char		 buf[sizeof(magic)];
+	ssize_t		 r, len;
+
+	cachefd = fd;
+
+	r = read(fd, buf, sizeof(buf));
+	if (r != sizeof(buf) || memcmp(buf, magic, sizeof(buf)) != 0)
+		return seekidx_rewrite();
+
+	for (;;) {
+		if ((r = read(fd, &idx, SEEKIDX_SIZE(0))) == 0)
+			break;
+		if (r != SEEKIDX_SIZE(0) || idx.nent < 0 ||
+		    idx.nent > SEEKIDX_NENT)
+			goto bad;
+
+		len = idx.nent * sizeof(*idx.ent);
+		if (read(fd, idx.ent, len) != len ||
+		    !seekidx_valid(&idx, SEEKIDX_SIZE(idx.nent)))
+			goto bad;
+
+		cache_put(&idx);
+		ondisk++;
+	}
+
+	if (ondisk > ncache * 2)
+		return seekidx_rewrite();
+	return 0;
+
+bad:
+	log_warnx("the seek index cache is corrupted, discarding the rest");
+	return seekidx_rewrite();
+}
+
+const struct seekidx *
+seekidx_lookup(const struct stat *sb)
+{
+	struct seekidx	 key;
+	size_t		 i;
+
+	key.dev = sb->st_dev;
+	key.ino = sb->st_ino;
+	key.size = sb->st_size;
+	key.mtime = sb->st_mtime;
+
+	for (i = 0; i < ncache; ++i)
+		if (samefile(cache[i], &key))
+			return cache[i];
+	return NULL;
+}
+
+void
+seekidx_store(const struct seekidx *idx)
+{
+	size_t	 len;
+
+	cache_put(idx);
+
+	if (cachefd == -1)
+		return;
+
+	if (ondisk >= SEEKIDX_FILES * 2) {
+		seekidx_rewrite();
+		return;
+	}
+
+	len = SEEKIDX_SIZE(idx->nent);
+	if (lseek(cachefd, 0, SEEK_END) == -1 ||
+	    write(cachefd, idx, len) != (ssize_t)len) {
+		log_warn("can't write the seek index cache");
+		close(cachefd);
+		cachefd = -1;
+		return;
+	}
+	ondisk++;
+}
+
+int
+seekidx_valid(const struct seekidx *idx, size_t len)
+{
+	if (len < SEEKIDX_SIZE(0) || idx->nent < 0 ||
+	    idx->nent > SEEKIDX_NENT || len != SEEKIDX_SIZE(idx->nent))
+		return 0;
+	if (idx->type != SEEKIDX_MP3 && idx->type != SEEKIDX_OGG)
+		return 0;
+	if (idx->nent > 0 && idx->step <= 0)
+		return 0;
+	return 1;
+}
+
+/*
+ * Add an entry if it's step samples after the last one.  Entries that
+ * would leave a hole, like after a seek, are ignored so that the index
+ * always covers the file from the start.  When it's full, every other
+ * entry is dropped and the step doubled.
+ */
+void
+seekidx_add(struct seekidx *idx, int64_t pcm, int64_t off)
+{
+	struct seekidx_ent	*last;
+	int			 i;
+
+	if (idx->nent == 0) {
+		if (pcm > idx->step)
+			return;
+	} else {
+		last = &idx->ent[idx->nent - 1];
+		if (pcm < last->pcm + idx->step ||
+		    pcm > last->pcm + 2 * idx->step)
+			return;
+	}
+
+	if (idx->nent == SEEKIDX_NENT) {
+		for (i = 0; i < SEEKIDX_NENT / 2; ++i)
+			idx->ent[i] = idx->ent[i * 2];
+		idx->nent = SEEKIDX_NENT / 2;
+		idx->step *= 2;
+
+		if (pcm < idx->ent[idx->nent - 1].pcm + idx->step)
+			return;
+	}
+
+	idx->ent[idx->nent].pcm = pcm;
+	idx->ent[idx->nent].off = off;
+	idx->nent++;
+}
+
+/*
+ * Find the offset to start from to reach pcm.  It's taken from the
+ * entry before the closest one since the offsets of the pages and the
+ * positions recorded don't match exactly.  The caller still has to
+ * check where it landed.
+ */
+int
+seekidx_find(const struct seekidx *idx, int64_t pcm, int64_t *off)
+{
+	int	 lo, hi, mid;
+
+	if (idx == NULL || idx->nent == 0 || pcm < idx->ent[0].pcm ||
+	    pcm > idx->ent[idx->nent - 1].pcm + idx->step)
+		return -1;
+
+	lo = 0;
+	hi = idx->nent - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (idx->ent[mid].pcm <= pcm)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	if (lo > 0)
+		lo--;
+	*off = idx->ent[lo].off;
+	return 0;
+}
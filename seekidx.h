@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Seek index of a file, built by the decoders while playing and kept
+ * by the main process across restarts.  For mp3 files it's the frame
+ * index of libmpg123 (an offset every step frames), for Ogg files a
+ * list of pcm positions and the byte offset of the page they're in.
+ */
+
+#define SEEKIDX_NENT	512	/* max entries per file */
+#define SEEKIDX_FILES	256	/* max files in the cache */
+
+#define SEEKIDX_MP3	1
+#define SEEKIDX_OGG	2
+
+struct seekidx_ent {
+	int64_t		 pcm;
+	int64_t		 off;
+};
+
+struct seekidx {
+	uint64_t	 dev;
+	uint64_t	 ino;
+	int64_t		 size;
+	int64_t		 mtime;
+	int32_t		 type;
+	int32_t		 nent;
+	int64_t		 step;
+	int64_t		 length;	/* in samples, or -1 */
+	struct seekidx_ent ent[SEEKIDX_NENT];
+};
+
+#define SEEKIDX_SIZE(n)	(offsetof(struct seekidx, ent) + \
+			    (n) * sizeof(struct seekidx_ent))
+
+struct stat;
+
+int			 seekidx_init(int);
+const struct seekidx	*seekidx_lookup(const struct stat *);
+void			 seekidx_store(const struct seekidx *);
+int			 seekidx_valid(const struct seekidx *, size_t);
+void			 seekidx_add(struct seekidx *, int64_t, int64_t);
+int			 seekidx_find(const struct seekidx *, int64_t, int64_t *);
@@ -107,7 +107,7 @@ flac_dump(FILE *fp, const char *name, const char *filter)
 			}
 
 			*v++ = '\0';
-			printf("%s = %s\n", m, v);
+			printcomment(m, filter, v);
 
 			free(m);
 		}
@@ -105,7 +105,7 @@ opus_dump(struct ogg *ogg, const char *name, const char *filter)
 		 * R128_ALBUM_GAIN.
 		 */
 
-		printf("%s = %s\n", buf, v);
+		printcomment(buf, filter, v);
 	}
 
 
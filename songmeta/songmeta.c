@@ -118,6 +118,13 @@ readprintfield(const char *field, const char *filter, const char *fname,
 	return (0);
 }
 
+/* a vorbis comment: field name and value */
+void
+printcomment(const char *name, const char *filter, const char *value)
+{
+	printf("%s = %s\n", name, value);
+}
+
 static int
 dofile(FILE *fp, const char *name, const char *filter)
 {
@@ -49,12 +49,18 @@ int	 opus_dump(struct ogg *, const char *, const char *);
 int	 vorbis_match(struct ogg *);
 int	 vorbis_dump(struct ogg *, const char *, const char *);
 
-/* songmeta.c */
+/*
+ * songmeta.c
+ *
+ * The parsers hand out what they find through these; amused links
+ * them with its own versions in tags.c to fill the library.
+ */
 int	 matchfield(const char *, const char *);
 int	 printfield(const char *, const char *, const char *, int,
 	    const char *);
 int	 readprintfield(const char *, const char *, const char *,
 	    int, int, off_t);
+void	 printcomment(const char *, const char *, const char *);
 
 /* text.c */
 void	 mlprint(const char *);
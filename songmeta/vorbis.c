@@ -105,7 +105,7 @@ vorbis_dump(struct ogg *ogg, const char *name, const char *filter)
 			return (-1);
 		*v++ = '\0';
 
-		printf("%s = %s\n", buf, v);
+		printcomment(buf, filter, v);
 	}
 			
 	return (0);
@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <imsg.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "amused.h"
+#include "ev.h"
+#include "log.h"
+#include "playlist.h"
+#include "state.h"
+
+/*
+ * The state file is a header and a snapshot of the playlist, as in
+ * struct playlist_snapshot, followed by a journal of the changes made
+ * since.  The tracks are referred to by their position among the live
+ * entries, which doesn't change when the playlist is compacted, so
+ * it's rewritten only when the entries are moved around or replaced,
+ * and when the journal grows bigger than the snapshot.  The current
+ * track, its position and the modes are appended every few seconds if
+ * they changed.  If the current track was removed, the following one
+ * is saved instead, without a position.
+ *
+ * There are two files, used in turn: a new snapshot is written in the
+ * one that isn't current, synced, and only then given a header with a
+ * sequence number higher than the other one's, and synced again.  A
+ * crash in the middle leaves the previous file as it was.  The
+ * journal isn't synced: a torn write leaves an incomplete record at
+ * the end, which is dropped.
+ */
+#define STATE_INTERVAL	10		/* seconds between two syncs */
+#define STATE_MINJOURNAL (64 * 1024)	/* don't bother rewriting before */
+
+#define STATE_ADD	1	/* path */
+#define STATE_DROP	2	/* int64_t position */
+#define STATE_POS	3	/* struct state_pos */
+
+#define STATE_REPEAT_ONE	0x1
+#define STATE_REPEAT_ALL	0x2
+#define STATE_CONSUME		0x4
+#define STATE_RANDOM		0x8
+
+struct state_hdr {
+	char		 magic[8];
+	uint64_t	 seq;
+	uint64_t	 snaplen;
+};
+
+struct state_rec {
+	uint32_t	 type;
+	uint32_t	 len;
+};
+
+struct state_pos {
+	int64_t		 current;
+	int64_t		 position;	/* in seconds, or -1 */
+	int32_t		 modes;
+	int32_t		 pad;
+};
+
+static const char	 magic[8] = "AMSTATE3";
+static int		 statefds[2] = { -1, -1 };
+static int		 statefd = -1;	/* the current one */
+static int		 cur;
+static uint64_t		 seq;
+static off_t		 snaplen;
+static off_t		 journal;
+static struct state_pos	 last;
+
+static void
+state_fail(void)
+{
+	log_warn("can't write the state file");
+	close(statefds[0]);
+	close(statefds[1]);
+	statefds[0] = statefds[1] = statefd = -1;
+}
+
+static void
+state_get(struct state_pos *sp)
+{
+	memset(sp, 0, sizeof(*sp));
+	sp->current = -1;
+	sp->position = -1;
+	if (play_off != -1)
+		sp->current = playlist_pos(&playlist, play_off);
+	if (play_off != -1 && !playlist_isdead(&playlist, play_off) &&
+	    play_state != STATE_STOPPED)
+		sp->position = current_status.position;
+	if (repeat_one)
+		sp->modes |= STATE_REPEAT_ONE;
+	if (repeat_all)
+		sp->modes |= STATE_REPEAT_ALL;
+	if (consume)
+		sp->modes |= STATE_CONSUME;
+	if (random_mode)
+		sp->modes |= STATE_RANDOM;
+}
+
+static void
+state_append(uint32_t type, const void *data, size_t len)
+{
+	struct state_rec	 rec;
+	struct iovec		 iov[2];
+
+	if (statefd == -1)
+		return;
+
+	rec.type = type;
+	rec.len = len;
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(rec);
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = len;
+	if (writev(statefd, iov, 2) != (ssize_t)(sizeof(rec) + len)) {
+		state_fail();
+		return;
+	}
+	journal += sizeof(rec) + len;
+}
+
+/* append the current position, if it changed */
+static void
+state_sync(void)
+{
+	struct state_pos	 sp;
+
+	state_get(&sp);
+	if (!memcmp(&sp, &last, sizeof(sp)))
+		return;
+	state_append(STATE_POS, &sp, sizeof(sp));
+	memcpy(&last, &sp, sizeof(last));
+}
+
+static void
+state_tick(int fd, int event, void *arg)
+{
+	struct timeval	 tv = { STATE_INTERVAL, 0 };
+
+	if (journal > snaplen && journal > STATE_MINJOURNAL)
+		state_save();
+	else
+		state_sync();
+
+	if (statefd != -1 && ev_timer(&tv, state_tick, NULL) == 0)
+		fatal("ev_timer");
+}
+
+void
+state_save(void)
+{
+	struct state_hdr	 hdr;
+	FILE			*fp;
+	off_t			 end;
+	int			 fd, next = !cur;
+
+	if (statefd == -1)
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (ftruncate(statefds[next], 0) == -1 ||
+	    lseek(statefds[next], 0, SEEK_SET) == -1 ||
+	    write(statefds[next], &hdr, sizeof(hdr)) != sizeof(hdr))
+		goto err;
+
+	if ((fd = dup(statefds[next])) == -1)
+		goto err;
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		goto err;
+	}
+	if (playlist_dump(fp) == -1) {
+		fclose(fp);
+		goto err;
+	}
+	if (fclose(fp) == EOF)
+		goto err;
+
+	if ((end = lseek(statefds[next], 0, SEEK_END)) == -1 ||
+	    fsync(statefds[next]) == -1)
+		goto err;
+
+	memcpy(hdr.magic, magic, sizeof(hdr.magic));
+	hdr.seq = seq + 1;
+	hdr.snaplen = end - sizeof(hdr);
+	if (pwrite(statefds[next], &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    fsync(statefds[next]) == -1)
+		goto err;
+
+	seq = hdr.seq;
+	cur = next;
+	statefd = statefds[cur];
+	snaplen = hdr.snaplen;
+	journal = 0;
+	memset(&last, 0xff, sizeof(last));
+	state_sync();
+	return;
+
+err:
+	state_fail();
+}
+
+/* replay the journal in buf on p; returns the bytes used */
+static size_t
+state_replay(struct playlist *p, struct state_pos *sp, const char *buf,
+    size_t len)
+{
+	struct state_rec	 rec;
+	const char		*data;
+	int64_t			 n;
+	ssize_t			 off;
+	size_t			 pos = 0;
+
+	while (len - pos >= sizeof(rec)) {
+		memcpy(&rec, buf + pos, sizeof(rec));
+		if (rec.len > len - pos - sizeof(rec))
+			break;
+		data = buf + pos + sizeof(rec);
+
+		switch (rec.type) {
+		case STATE_ADD:
+			if (rec.len < 2 || rec.len > PATH_MAX ||
+			    memchr(data, '\0', rec.len) != data + rec.len - 1)
+				goto bad;
+			playlist_push(p, data);
+			break;
+		case STATE_DROP:
+			if (rec.len != sizeof(n))
+				goto bad;
+			memcpy(&n, data, sizeof(n));
+			if (n < 0 || (off = playlist_offset(p, n)) == -1)
+				goto bad;
+			playlist_drop(p, off);
+
+			/* the following entries moved back by one */
+			if (sp->current > n)
+				sp->current--;
+			else if (sp->current == n)
+				sp->position = -1;
+			break;
+		case STATE_POS:
+			if (rec.len != sizeof(*sp))
+				goto bad;
+			memcpy(sp, data, sizeof(*sp));
+			break;
+		default:
+			goto bad;
+		}
+
+		pos += sizeof(rec) + rec.len;
+	}
+
+	return pos;
+
+bad:
+	log_warnx("the state file is corrupted, discarding the rest");
+	return pos;
+}
+
+/*
+ * Read the sequence number of the state file in fd.  Returns 0 if it's
+ * empty, -1 if it's not valid.
+ */
+static int
+state_seq(int fd, uint64_t *n)
+{
+	struct state_hdr	 hdr;
+	ssize_t			 r;
+
+	if ((r = pread(fd, &hdr, sizeof(hdr), 0)) == 0)
+		return 0;
+	if (r != sizeof(hdr) || memcmp(hdr.magic, magic, sizeof(magic)) != 0)
+		return -1;
+	*n = hdr.seq;
+	return 1;
+}
+
+/*
+ * Load the snapshot in the state file in fd on p and replay the
+ * journal.  Returns -1 if it's corrupted, 0 if the journal has to be
+ * rewritten, 1 otherwise.
+ */
+static int
+state_load(int fd, struct playlist *p, struct state_pos *sp)
+{
+	struct state_hdr	 hdr;
+	struct stat		 sb;
+	char			*m;
+	size_t			 len, jlen, used;
+	ssize_t			 curr;
+
+	if (fstat(fd, &sb) == -1 || (uintmax_t)sb.st_size > SIZE_MAX ||
+	    (size_t)sb.st_size < sizeof(hdr))
+		return -1;
+
+	len = sb.st_size;
+	m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED)
+		return -1;
+
+	memcpy(&hdr, m, sizeof(hdr));
+	if (memcmp(hdr.magic, magic, sizeof(magic)) != 0 ||
+	    hdr.snaplen > len - sizeof(hdr) ||
+	    playlist_loadbuf(p, m + sizeof(hdr), hdr.snaplen, &curr) == -1) {
+		munmap(m, len);
+		return -1;
+	}
+
+	state_get(sp);
+	sp->current = curr;
+	jlen = len - sizeof(hdr) - hdr.snaplen;
+	used = state_replay(p, sp, m + sizeof(hdr) + hdr.snaplen, jlen);
+	munmap(m, len);
+
+	seq = hdr.seq;
+	snaplen = hdr.snaplen;
+	journal = used;
+	if (used != jlen || (journal > snaplen && journal > STATE_MINJOURNAL))
+		return 0;
+	return 1;
+}
+
+/*
+ * Restore the playlist from the most recent of the two state files,
+ * which are then kept up to date.  The position in the current track,
+ * or -1, is stored in pos.  Returns -1 if the files couldn't be used.
+ */
+int
+state_init(int fd0, int fd1, int64_t *pos)
+{
+	struct timeval		 tv = { STATE_INTERVAL, 0 };
+	struct state_pos	 sp;
+	struct playlist		 p;
+	uint64_t		 n[2] = { 0, 0 };
+	ssize_t			 curr;
+	int			 valid[2], i, r = -1, empty;
+
+	statefds[0] = fd0;
+	statefds[1] = fd1;
+	*pos = -1;
+
+	if (ev_timer(&tv, state_tick, NULL) == 0)
+		fatal("ev_timer");
+
+	valid[0] = state_seq(fd0, &n[0]);
+	valid[1] = state_seq(fd1, &n[1]);
+	empty = valid[0] == 0 && valid[1] == 0;
+
+	/* the newest first, the other one if it's unusable */
+	cur = valid[1] == 1 && (valid[0] != 1 || n[1] > n[0]);
+	for (i = 0; i < 2; ++i, cur = !cur) {
+		if (valid[cur] != 1)
+			continue;
+		if ((r = state_load(statefds[cur], &p, &sp)) != -1)
+			break;
+		log_warnx("the state file is corrupted, using the previous");
+	}
+
+	if (r == -1) {
+		if (!empty)
+			log_warnx("the state files are corrupted, "
+			    "starting afresh");
+		cur = 0;
+		seq = n[0] > n[1] ? n[0] : n[1];
+		statefd = statefds[cur];
+		state_save();
+		return empty ? 0 : -1;
+	}
+
+	curr = -1;
+	if (sp.current >= 0)
+		curr = playlist_offset(&p, sp.current);
+	if (curr != -1)
+		*pos = sp.position;
+
+	repeat_one = !!(sp.modes & STATE_REPEAT_ONE);
+	repeat_all = !!(sp.modes & STATE_REPEAT_ALL);
+	consume = !!(sp.modes & STATE_CONSUME);
+	playlist_setrandom(!!(sp.modes & STATE_RANDOM));
+	playlist_swap(&p, curr);
+
+	log_debug("restored %zu tracks", p.len - p.ndead);
+
+	statefd = statefds[cur];
+	if (r == 0) {
+		state_save();
+		return 0;
+	}
+
+	if (lseek(statefd, 0, SEEK_END) == -1) {
+		state_fail();
+		return -1;
+	}
+	memcpy(&last, &sp, sizeof(last));
+	return 0;
+}
+
+/* called by control_notify for every change */
+void
+state_notify(int type)
+{
+	char		 path[PATH_MAX];
+
+	switch (type) {
+	case IMSG_CTL_ADD:
+		if (playlist_get(&playlist, playlist.len - 1, path,
+		    sizeof(path)) == NULL)
+			fatalx("%s: path too long", __func__);
+		state_append(STATE_ADD, path, strlen(path) + 1);
+		break;
+	case IMSG_CTL_COMMIT:
+	case IMSG_CTL_SHUFFLE:
+		state_save();
+		break;
+	case IMSG_CTL_MODE:
+		state_sync();
+		break;
+	}
+}
+
+/* the entry at the given position was removed */
+void
+state_drop(size_t off)
+{
+	int64_t	 n = off;
+
+	state_append(STATE_DROP, &n, sizeof(n));
+}
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "player.h"
+#include "tags.h"
+
+#include "songmeta/ogg.h"
+#include "songmeta/songmeta.h"
+
+/*
+ * The songmeta parsers are linked as they are; these replace the
+ * functions in songmeta.c that would print the fields and store them
+ * in the struct tags being read instead.  The parsers keep some state
+ * in static buffers, so this is not thread-safe.
+ */
+
+#define TAGS_TAILSIZ	(64 * 1024)	/* to find the last ogg page */
+
+int		 printraw;
+static struct tags *cur;
+
+static void
+store(const char *field, const char *str)
+{
+	char	*dst = NULL;
+
+	if (!strcasecmp(field, "title"))
+		dst = cur->title;
+	else if (!strcasecmp(field, "artist") ||
+	    !strcasecmp(field, "lead-performer") ||
+	    (!strcasecmp(field, "band") && cur->artist[0] == '\0'))
+		dst = cur->artist;
+	else if (!strcasecmp(field, "album"))
+		dst = cur->album;
+	else if (!strcasecmp(field, "track") ||
+	    !strcasecmp(field, "tracknumber")) {
+		cur->track = strtoul(str, NULL, 10);
+		return;
+	}
+
+	if (dst != NULL)
+		strlcpy(dst, str, TAGS_MAXLEN);
+}
+
+int
+matchfield(const char *field, const char *filter)
+{
+	return (1);
+}
+
+int
+printfield(const char *field, const char *filter, const char *fname,
+    int enc, const char *str)
+{
+	store(field, str);
+	return (0);
+}
+
+/*
+ * The ID3v2 text frames, mostly UTF-16 in the wild.  A code unit takes
+ * up to three bytes in UTF-8, so out should be at least 3/2 len + 1;
+ * whatever doesn't fit is dropped.
+ */
+static void
+utf16(const char *in, size_t len, char *out, size_t outsz)
+{
+	size_t		 i, o = 0, n;
+	unsigned int	 c, d;
+	int		 be;
+
+	if (outsz == 0)
+		return;
+
+	be = (uint8_t)in[0] == 0xFE;
+	for (i = 2; i + 1 < len; i += 2) {
+		if (be)
+			c = (uint8_t)in[i] << 8 | (uint8_t)in[i + 1];
+		else
+			c = (uint8_t)in[i + 1] << 8 | (uint8_t)in[i];
+		if (c == 0)
+			break;
+
+		if (c >= 0xD800 && c < 0xDC00 && i + 3 < len) {
+			if (be)
+				d = (uint8_t)in[i + 2] << 8 |
+				    (uint8_t)in[i + 3];
+			else
+				d = (uint8_t)in[i + 3] << 8 |
+				    (uint8_t)in[i + 2];
+			if (d >= 0xDC00 && d < 0xE000) {
+				c = 0x10000 + ((c - 0xD800) << 10) +
+				    (d - 0xDC00);
+				i += 2;
+			}
+		}
+		if (c >= 0xD800 && c < 0xE000)
+			c = '?';	/* unpaired surrogate */
+
+		n = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+		if (o + n >= outsz)
+			break;
+
+		switch (n) {
+		case 1:
+			out[o++] = c;
+			break;
+		case 2:
+			out[o++] = 0xC0 | (c >> 6);
+			out[o++] = 0x80 | (c & 0x3F);
+			break;
+		case 3:
+			out[o++] = 0xE0 | (c >> 12);
+			out[o++] = 0x80 | ((c >> 6) & 0x3F);
+			out[o++] = 0x80 | (c & 0x3F);
+			break;
+		case 4:
+			out[o++] = 0xF0 | (c >> 18);
+			out[o++] = 0x80 | ((c >> 12) & 0x3F);
+			out[o++] = 0x80 | ((c >> 6) & 0x3F);
+			out[o++] = 0x80 | (c & 0x3F);
+			break;
+		}
+	}
+	out[o] = '\0';
+}
+
+int
+readprintfield(const char *field, const char *filter, const char *fname,
+    int enc, int fd, off_t len)
+{
+	char	 buf[TAGS_MAXLEN * 2];
+	char	 str[sizeof(buf) / 2 * 3 + 1];
+	size_t	 n;
+	ssize_t	 r;
+
+	if ((n = len) > sizeof(buf) - 1)
+		n = sizeof(buf) - 1;
+	if ((r = read(fd, buf, n)) != (ssize_t)n)
+		return (-1);
+	if (len > (off_t)n && lseek(fd, len - n, SEEK_CUR) == -1)
+		return (-1);
+	buf[n] = '\0';
+
+	if (n >= 2 && (((uint8_t)buf[0] == 0xFF && (uint8_t)buf[1] == 0xFE) ||
+	    ((uint8_t)buf[0] == 0xFE && (uint8_t)buf[1] == 0xFF))) {
+		utf16(buf, n, str, sizeof(str));
+		store(field, str);
+	} else
+		store(field, buf);
+	return (0);
+}
+
+void
+printcomment(const char *name, const char *filter, const char *value)
+{
+	store(name, value);
+}
+
+static uint32_t
+le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void
+flac_info(const uint8_t *buf, size_t len, struct tags *t)
+{
+	const uint8_t	*d = buf + 8;
+	uint64_t	 samples;
+
+	/* STREAMINFO is always the first block */
+	if (len < 8 + 18 || (buf[4] & 0x7F) != 0)
+		return;
+
+	t->rate = d[10] << 12 | d[11] << 4 | d[12] >> 4;
+	samples = (uint64_t)(d[13] & 0x0F) << 32 | (uint32_t)d[14] << 24 |
+	    d[15] << 16 | d[16] << 8 | d[17];
+	if (t->rate != 0)
+		t->duration = samples / t->rate;
+}
+
+static void
+wav_info(const uint8_t *buf, size_t len, off_t size, struct tags *t)
+{
+	uint32_t	 clen, byterate = 0;
+	size_t		 off = 12;
+
+	while (off + 8 <= len) {
+		clen = le32(buf + off + 4);
+		if (!memcmp(buf + off, "fmt ", 4) && off + 8 + 12 <= len) {
+			t->rate = le32(buf + off + 8 + 4);
+			byterate = le32(buf + off + 8 + 8);
+		} else if (!memcmp(buf + off, "data", 4)) {
+			if (clen > size - off - 8)
+				clen = size - off - 8;
+			if (byterate != 0)
+				t->duration = clen / byterate;
+			return;
+		}
+		if (clen > len)
+			break;
+		off += 8 + clen + (clen & 1);
+	}
+}
+
+static void
+mp3_info(int fd, const uint8_t *buf, size_t len, off_t size, struct tags *t)
+{
+	static const unsigned int rates[3] = { 44100, 48000, 32000 };
+	static const unsigned int kbps[16] = {
+		0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+		320, 0
+	};
+	uint8_t		 hdr[4];
+	off_t		 off = 0;
+	int		 version;
+
+	if (len >= 10 && !memcmp(buf, "ID3", 3))
+		off = 10 + ((buf[6] & 0x7F) << 21 | (buf[7] & 0x7F) << 14 |
+		    (buf[8] & 0x7F) << 7 | (buf[9] & 0x7F));
+	if (pread(fd, hdr, sizeof(hdr), off) != sizeof(hdr) ||
+	    hdr[0] != 0xFF || (hdr[1] & 0xE0) != 0xE0 ||
+	    (hdr[2] >> 2 & 3) == 3)
+		return;
+
+	/* 3: MPEG 1, 2: MPEG 2, 0: MPEG 2.5 */
+	version = hdr[1] >> 3 & 3;
+	t->rate = rates[hdr[2] >> 2 & 3];
+	if (version == 2)
+		t->rate /= 2;
+	else if (version == 0)
+		t->rate /= 4;
+
+	/* a guess, right only for constant bitrate layer III */
+	if (version == 3 && kbps[hdr[2] >> 4] != 0)
+		t->duration = (size - off) * 8 / (kbps[hdr[2] >> 4] * 1000);
+}
+
+static void
+ogg_info(int fd, const uint8_t *buf, size_t len, off_t size, struct tags *t)
+{
+	static uint8_t	 tail[TAGS_TAILSIZ];
+	const uint8_t	*p;
+	uint64_t	 granule;
+	unsigned int	 preskip = 0;
+	off_t		 off;
+	ssize_t		 r;
+
+	/* the identification header is the first packet */
+	if (len < 27 || (size_t)27 + buf[26] + 16 > len)
+		return;
+	p = buf + 27 + buf[26];
+	if (!memcmp(p, "\x01vorbis", 7))
+		t->rate = le32(p + 12);
+	else if (!memcmp(p, "OpusHead", 8)) {
+		t->rate = 48000;
+		preskip = p[10] | p[11] << 8;
+	}
+	if (t->rate == 0)
+		return;
+
+	off = size > TAGS_TAILSIZ ? size - TAGS_TAILSIZ : 0;
+	if ((r = pread(fd, tail, sizeof(tail), off)) < 27)
+		return;
+	for (p = tail + r - 27; p >= tail; --p) {
+		if (memcmp(p, "OggS", 4) != 0 || p[4] != 0)
+			continue;
+		granule = le32(p + 6) | (uint64_t)le32(p + 10) << 32;
+		if (granule > preskip)
+			t->duration = (granule - preskip) / t->rate;
+		break;
+	}
+}
+
+static void
+read_tags(FILE *fp, const char *path, const uint8_t *buf, size_t len,
+    off_t size)
+{
+	struct ogg	*ogg;
+	char		 id3[3];
+	int		 fd = fileno(fp);
+
+	switch (cur->codec) {
+	case FORMAT_FLAC:
+		flac_dump(fp, path, NULL);
+		break;
+	case FORMAT_MP3:
+		if (!memcmp(buf, "ID3", 3))
+			id3v2_dump(fd, path, NULL);
+		if (cur->title[0] == '\0' && size > 128 &&
+		    pread(fd, id3, 3, size - 128) == 3 &&
+		    !memcmp(id3, "TAG", 3))
+			id3v1_dump(fd, path, NULL);
+		break;
+	case FORMAT_OPUS:
+	case FORMAT_OGGVORBIS:
+		if ((ogg = ogg_open(fp, path)) == NULL)
+			break;
+		if (vorbis_match(ogg) != -1)
+			vorbis_dump(ogg, path, NULL);
+		else if (ogg_rewind(ogg) != -1 && opus_match(ogg) != -1)
+			opus_dump(ogg, path, NULL);
+		ogg_close(ogg);
+		break;
+	}
+}
+
+/*
+ * Fill t with the tags and the stream parameters of the file at path.
+ * What couldn't be found is left empty.
+ */
+int
+tags_read(const char *path, struct tags *t)
+{
+	uint8_t		 buf[PLAYER_MAGICSIZ];
+	struct stat	 sb;
+	FILE		*fp;
+	ssize_t		 r;
+	int		 fd;
+
+	memset(t, 0, sizeof(*t));
+	t->codec = -1;
+
+	if ((fp = fopen(path, "re")) == NULL)
+		return (-1);
+	fd = fileno(fp);
+	if (fstat(fd, &sb) == -1 ||
+	    (r = pread(fd, buf, sizeof(buf), 0)) == -1) {
+		fclose(fp);
+		return (-1);
+	}
+
+	t->codec = player_format(buf, r);
+	switch (t->codec) {
+	case FORMAT_FLAC:
+		flac_info(buf, r, t);
+		break;
+	case FORMAT_WAV:
+		wav_info(buf, r, sb.st_size, t);
+		break;
+	case FORMAT_MP3:
+		mp3_info(fd, buf, r, sb.st_size, t);
+		break;
+	case FORMAT_OPUS:
+	case FORMAT_OGGVORBIS:
+		ogg_info(fd, buf, r, sb.st_size, t);
+		break;
+	}
+
+	cur = t;
+	read_tags(fp, path, buf, r, sb.st_size);
+	cur = NULL;
+
+	fclose(fp);
+	return (0);
+}
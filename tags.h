@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The metadata of a track, as read by the songmeta parsers.
+ */
+
+#define TAGS_MAXLEN	256
+
+struct tags {
+	char		 title[TAGS_MAXLEN];
+	char		 artist[TAGS_MAXLEN];
+	char		 album[TAGS_MAXLEN];
+	unsigned int	 track;
+	unsigned int	 duration;	/* in seconds, 0 if unknown */
+	unsigned int	 rate;
+	int		 codec;		/* FORMAT_* or -1 */
+};
+
+int	tags_read(const char *, struct tags *);
@@ -100,6 +100,20 @@ main(void)
 	return !htole32(23);
 }
 #endif /* TEST_ENDIAN_H */
+#if TEST_EPOLL
+#include <sys/epoll.h>
+
+int
+main(void)
+{
+	struct epoll_event	 ev;
+	int			 fd;
+
+	if ((fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		return 1;
+	return epoll_wait(fd, &ev, 1, 0) == -1;
+}
+#endif /* TEST_EPOLL */
 #if TEST_ERR
 /*
  * Copyright (c) 2015 Ingo Schwarze <schwarze@openbsd.org>
@@ -276,6 +290,19 @@ main(void)
 	return 0;
 }
 #endif /* TEST_INFTIM */
+#if TEST_INOTIFY
+#include <sys/inotify.h>
+
+int
+main(void)
+{
+	int	 fd;
+
+	if ((fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) == -1)
+		return 1;
+	return inotify_add_watch(fd, "/", IN_CREATE|IN_ONLYDIR) == -1;
+}
+#endif /* TEST_INOTIFY */
 #if TEST_LANDLOCK
 #include <linux/landlock.h>
 #include <stdlib.h>
@@ -342,6 +369,16 @@ int main(void)
 	return 0;
 }
 #endif /* TEST_MD5 */
+#if TEST_MEMFD_CREATE
+#define _GNU_SOURCE
+#include <sys/mman.h>
+
+int
+main(void)
+{
+	return memfd_create("test", MFD_CLOEXEC | MFD_ALLOW_SEALING) == -1;
+}
+#endif /* TEST_MEMFD_CREATE */
 #if TEST_MEMMEM
 #define _GNU_SOURCE
 #include <string.h>
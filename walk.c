@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "player.h"
+#include "walk.h"
+#include "xmalloc.h"
+
+/*
+ * Most of the time is spent opening the files to look at their first
+ * bytes, so the directories are scanned by a pool of threads.  The
+ * pending ones are kept in a stack, pushed in reverse order, so that
+ * the threads roughly follow the order in which the main thread walks
+ * the tree and hands out the results: each directory is sorted once
+ * scanned, and its files emitted as soon as all the directories before
+ * it are done.  The directories are reported too, before what they
+ * contain.
+ *
+ * Hidden files and directories are skipped, as well as the symbolic
+ * links to directories to avoid loops.
+ */
+#define WALK_MAXTHREADS	16
+
+struct wdir;
+
+struct wentry {
+	char		*name;
+	struct wdir	*dir;		/* if it's a directory */
+};
+
+struct wdir {
+	char		*path;
+	struct wentry	*ents;
+	size_t		 nents;
+	int		 done;
+	struct wdir	*next;		/* in the pending stack */
+};
+
+static pthread_mutex_t	 mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 todo = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	 scanned = PTHREAD_COND_INITIALIZER;
+static struct wdir	*pending;
+static int		 quit;
+
+static int
+entcmp(const void *a, const void *b)
+{
+	const struct wentry	*ea = a, *eb = b;
+
+	return strcmp(ea->name, eb->name);
+}
+
+static int
+sniff(int dirfd, const char *name)
+{
+	char	 buf[PLAYER_MAGICSIZ];
+	ssize_t	 r;
+	int	 fd;
+
+	if ((fd = openat(dirfd, name, O_RDONLY|O_NONBLOCK|O_CLOEXEC)) == -1)
+		return 0;
+	r = pread(fd, buf, sizeof(buf), 0);
+	close(fd);
+	return r > 0 && player_format(buf, r) != -1;
+}
+
+static struct wdir *
+wdir_new(const char *parent, const char *name)
+{
+	struct wdir	*d;
+
+	d = xcalloc(1, sizeof(*d));
+	if (parent == NULL)
+		d->path = xstrdup(name);
+	else
+		xasprintf(&d->path, "%s/%s", parent, name);
+	return d;
+}
+
+/* read and sort the directory d; called without the lock held */
+static int
+scan(struct wdir *d)
+{
+	struct wentry	*ents = NULL;
+	struct dirent	*dp;
+	struct stat	 sb;
+	DIR		*dir;
+	size_t		 n = 0, cap = 0;
+	int		 fd, isdir;
+
+	if ((fd = open(d->path, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) == -1) {
+		log_warn("can't open %s", d->path);
+		return -1;
+	}
+	if ((dir = fdopendir(fd)) == NULL) {
+		log_warn("fdopendir %s", d->path);
+		close(fd);
+		return -1;
+	}
+
+	while ((dp = readdir(dir)) != NULL) {
+		if (dp->d_name[0] == '.')
+			continue;
+
+		isdir = dp->d_type == DT_DIR;
+		if (dp->d_type == DT_UNKNOWN || dp->d_type == DT_LNK) {
+			if (fstatat(fd, dp->d_name, &sb, 0) == -1)
+				continue;
+			if (S_ISDIR(sb.st_mode)) {
+				if (dp->d_type == DT_LNK)
+					continue;
+				isdir = 1;
+			} else if (!S_ISREG(sb.st_mode))
+				continue;
+		} else if (dp->d_type != DT_DIR && dp->d_type != DT_REG)
+			continue;
+
+		if (!isdir && !sniff(fd, dp->d_name))
+			continue;
+
+		if (n == cap) {
+			cap = cap ? cap * 2 : 16;
+			ents = xreallocarray(ents, cap, sizeof(*ents));
+		}
+		ents[n].name = xstrdup(dp->d_name);
+		ents[n].dir = NULL;
+		if (isdir)
+			ents[n].dir = wdir_new(d->path, dp->d_name);
+		n++;
+	}
+	closedir(dir);
+
+	qsort(ents, n, sizeof(*ents), entcmp);
+	d->ents = ents;
+	d->nents = n;
+	return 0;
+}
+
+static void *
+worker(void *arg)
+{
+	struct wdir	*d;
+	size_t		 i;
+
+	pthread_mutex_lock(&mtx);
+	for (;;) {
+		while (pending == NULL && !quit)
+			pthread_cond_wait(&todo, &mtx);
+		if (quit)
+			break;
+
+		d = pending;
+		pending = d->next;
+		pthread_mutex_unlock(&mtx);
+		scan(d);
+		pthread_mutex_lock(&mtx);
+
+		for (i = d->nents; i > 0; --i) {
+			if (d->ents[i - 1].dir == NULL)
+				continue;
+			d->ents[i - 1].dir->next = pending;
+			pending = d->ents[i - 1].dir;
+		}
+		d->done = 1;
+		pthread_cond_broadcast(&todo);
+		pthread_cond_broadcast(&scanned);
+	}
+	pthread_mutex_unlock(&mtx);
+	return NULL;
+}
+
+static void
+wdir_free(struct wdir *d)
+{
+	size_t	 i;
+
+	for (i = 0; i < d->nents; ++i)
+		free(d->ents[i].name);
+	free(d->ents);
+	free(d->path);
+	free(d);
+}
+
+static void
+emit(struct wdir *d, void (*cb)(const char *, int, void *), void *arg)
+{
+	char	*path;
+	size_t	 i;
+
+	cb(d->path, 1, arg);
+
+	pthread_mutex_lock(&mtx);
+	while (!d->done)
+		pthread_cond_wait(&scanned, &mtx);
+	pthread_mutex_unlock(&mtx);
+
+	for (i = 0; i < d->nents; ++i) {
+		if (d->ents[i].dir != NULL)
+			emit(d->ents[i].dir, cb, arg);
+		else {
+			xasprintf(&path, "%s/%s", d->path, d->ents[i].name);
+			cb(path, 0, arg);
+			free(path);
+		}
+	}
+	wdir_free(d);
+}
+
+/*
+ * Call cb for the entries of the given directory only, in the same
+ * order as walk() and with the same ones skipped.  Returns -1 if it
+ * can't be read.
+ */
+int
+walk_list(const char *path, void (*cb)(const char *, int, void *), void *arg)
+{
+	struct wdir	*d;
+	char		*p;
+	size_t		 i;
+	int		 ret;
+
+	d = wdir_new(NULL, path);
+	if ((ret = scan(d)) == 0) {
+		for (i = 0; i < d->nents; ++i) {
+			xasprintf(&p, "%s/%s", d->path, d->ents[i].name);
+			cb(p, d->ents[i].dir != NULL, arg);
+			free(p);
+			if (d->ents[i].dir != NULL)
+				wdir_free(d->ents[i].dir);
+		}
+	}
+	wdir_free(d);
+	return ret;
+}
+
+void
+walk(const char *root, void (*cb)(const char *, int, void *), void *arg)
+{
+	pthread_t	 threads[WALK_MAXTHREADS];
+	struct wdir	*d;
+	long		 ncpu;
+	int		 i, n;
+
+	/* it's mostly waiting on the disk, so be generous */
+	if ((ncpu = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		ncpu = 1;
+	n = ncpu * 2;
+	if (n < 4)
+		n = 4;
+	if (n > WALK_MAXTHREADS)
+		n = WALK_MAXTHREADS;
+
+	d = wdir_new(NULL, root);
+	pending = d;
+	quit = 0;
+
+	for (i = 0; i < n; ++i)
+		if ((errno = pthread_create(&threads[i], NULL, worker,
+		    NULL)) != 0)
+			fatal("pthread_create");
+
+	emit(d, cb, arg);
+
+	pthread_mutex_lock(&mtx);
+	quit = 1;
+	pthread_cond_broadcast(&todo);
+	pthread_mutex_unlock(&mtx);
+
+	for (i = 0; i < n; ++i)
+		pthread_join(threads[i], NULL);
+}
@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2026 Omar Polo <op@omarpolo.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#if HAVE_INOTIFY
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#endif
+
+#include <errno.h>
+#include <imsg.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "amused.h"
+#include "ev.h"
+#include "library.h"
+#include "log.h"
+#include "watch.h"
+#include "xmalloc.h"
+
+/*
+ * Every directory in the library is watched with inotify(7), when
+ * available.  The ones that see a change are collected for a couple of
+ * seconds, as copying an album touches them many times, and then the
+ * library reads them again, without descending in the subdirectories
+ * it already knows, and only reads the tags of the files whose mtime
+ * or size changed.
+ *
+ * inotify can't see the changes made by other hosts on a network
+ * filesystem and the watches may run out, so in these cases, or when
+ * it's not available at all, every few minutes the library compares
+ * the mtime of all the directories and files instead.
+ *
+ * The watch folders are kept one per line in a file in the cache
+ * directory.
+ */
+#define WATCH_DELAY	2	/* seconds to wait for more changes */
+#define WATCH_POLL	300	/* seconds between two checks */
+#define WATCH_MAXLEN	(MAX_IMSGSIZE - IMSG_HEADER_SIZE)
+
+#define WATCH_MASK	(IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_DELETE_SELF| \
+			    IN_MOVED_FROM|IN_MOVED_TO|IN_MOVE_SELF|IN_ONLYDIR)
+
+struct wnode {
+	int		 wd;
+	unsigned int	 gen;
+	char		*path;
+};
+
+static int		 inofd = -1;
+static struct wnode	*nodes;		/* sorted by wd */
+static size_t		 nnodes;
+static size_t		 nodecap;
+static unsigned int	 gen;
+
+static char		**dirty;
+static size_t		 ndirty;
+static int		 pollall;	/* check everything */
+static int		 polling;	/* every WATCH_POLL seconds */
+static unsigned int	 delay_id;
+static unsigned int	 poll_id;
+
+static int		 foldfd = -1;
+static char		**folders;
+static size_t		 nfolders;
+
+static void	watch_flush(int, int, void *);
+static void	watch_poll(int, int, void *);
+
+/* check the library every now and then */
+static void
+watch_setpoll(int on)
+{
+	struct timeval	 tv = { WATCH_POLL, 0 };
+
+	if (on && !polling) {
+		log_debug("checking the library every %d seconds",
+		    WATCH_POLL);
+		if ((poll_id = ev_timer(&tv, watch_poll, NULL)) == 0)
+			fatal("ev_timer");
+	} else if (!on && polling)
+		ev_timer_cancel(poll_id);
+	polling = on;
+}
+
+static void
+watch_schedule(void)
+{
+	struct timeval	 tv = { WATCH_DELAY, 0 };
+
+	if (delay_id != 0 && ev_timer_pending(delay_id))
+		return;
+	if ((delay_id = ev_timer(&tv, watch_flush, NULL)) == 0)
+		fatal("ev_timer");
+}
+
+static void
+watch_flush(int fd, int event, void *arg)
+{
+	if (ndirty == 0 && !pollall)
+		return;
+
+	/* retry once the scan in progress is done */
+	if (library_update(dirty, ndirty, pollall) == -1) {
+		watch_schedule();
+		return;
+	}
+
+	dirty = NULL;
+	ndirty = 0;
+	pollall = 0;
+}
+
+static void
+watch_poll(int fd, int event, void *arg)
+{
+	struct timeval	 tv = { WATCH_POLL, 0 };
+
+	pollall = 1;
+	watch_flush(-1, 0, NULL);
+
+	if ((poll_id = ev_timer(&tv, watch_poll, NULL)) == 0)
+		fatal("ev_timer");
+}
+
+static void
+watch_dirty(const char *path)
+{
+	/* the events usually come in bursts for the same directory */
+	if (ndirty != 0 && !strcmp(dirty[ndirty - 1], path))
+		return;
+
+	dirty = xreallocarray(dirty, ndirty + 1, sizeof(*dirty));
+	dirty[ndirty++] = xstrdup(path);
+	watch_schedule();
+}
+
+#if HAVE_INOTIFY
+static struct wnode *
+wnode_find(int wd)
+{
+	size_t		 lo = 0, hi = nnodes, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (nodes[mid].wd == wd)
+			return &nodes[mid];
+		if (nodes[mid].wd < wd)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+static void
+wnode_del(struct wnode *n)
+{
+	size_t		 i = n - nodes;
+
+	free(n->path);
+	memmove(n, n + 1, (nnodes - i - 1) * sizeof(*n));
+	nnodes--;
+}
+
+/* the watch descriptors are handed out in increasing order */
+static void
+wnode_add(int wd, const char *path)
+{
+	struct wnode	*n;
+	size_t		 i;
+
+	if ((n = wnode_find(wd)) != NULL) {
+		/* the directory was moved */
+		if (strcmp(n->path, path) != 0) {
+			free(n->path);
+			n->path = xstrdup(path);
+		}
+		n->gen = gen;
+		return;
+	}
+
+	if (nnodes == nodecap) {
+		nodecap = nodecap ? nodecap * 2 : 256;
+		nodes = xreallocarray(nodes, nodecap, sizeof(*nodes));
+	}
+	for (i = nnodes; i > 0 && nodes[i - 1].wd > wd; --i)
+		/* nop */ ;
+	memmove(&nodes[i + 1], &nodes[i], (nnodes - i) * sizeof(*nodes));
+	nodes[i].wd = wd;
+	nodes[i].gen = gen;
+	nodes[i].path = xstrdup(path);
+	nnodes++;
+}
+
+/* whether the changes may come from other hosts */
+static int
+remotefs(const char *path)
+{
+	struct statfs	 sfs;
+
+	if (statfs(path, &sfs) == -1)
+		return 0;
+
+	switch ((unsigned long)sfs.f_type) {
+	case 0x6969:		/* NFS */
+	case 0x517b:		/* SMB */
+	case 0xff534d42:	/* CIFS */
+	case 0xfe534d42:	/* SMB2 */
+	case 0x01021997:	/* 9P */
+	case 0x00c36400:	/* Ceph */
+	case 0x5346414f:	/* AFS */
+	case 0x65735546:	/* FUSE, i.e. sshfs */
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void
+watch_read(int fd, int event, void *arg)
+{
+	char				 buf[4096]
+	    __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event	*ie;
+	struct wnode			*n;
+	ssize_t				 r;
+	char				*p;
+
+	/* drain it, as it's edge-triggered */
+	for (;;) {
+		if ((r = read(fd, buf, sizeof(buf))) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return;
+			fatal("read inotify");
+		}
+
+		for (p = buf; p < buf + r; p += sizeof(*ie) + ie->len) {
+			ie = (const struct inotify_event *)p;
+
+			if (ie->mask & IN_Q_OVERFLOW) {
+				log_debug("inotify queue overflow");
+				pollall = 1;
+				watch_schedule();
+				continue;
+			}
+			if ((n = wnode_find(ie->wd)) == NULL)
+				continue;
+			if (ie->mask & IN_IGNORED) {
+				wnode_del(n);
+				continue;
+			}
+
+			/* a new file is worth looking at only once written */
+			if ((ie->mask & IN_CREATE) && !(ie->mask & IN_ISDIR))
+				continue;
+			if (ie->len != 0 && ie->name[0] == '.')
+				continue;
+
+			/* watched again from the new place, if still here */
+			if (ie->mask & IN_MOVE_SELF)
+				inotify_rm_watch(inofd, ie->wd);
+
+			watch_dirty(n->path);
+		}
+	}
+}
+
+/* returns whether the library has to be checked periodically */
+static int
+watch_inotify(const char **dirs, size_t ndirs, const char **roots,
+    size_t nroots)
+{
+	size_t		 i;
+	int		 dopoll = 0;
+
+	if (inofd == -1)
+		return 1;
+
+	for (i = 0; i < nroots; ++i)
+		if (remotefs(roots[i]))
+			dopoll = 1;
+
+	gen++;
+	for (i = 0; i < ndirs; ++i)
+		watch_add(dirs[i]);
+	for (i = nnodes; i > 0; --i) {
+		if (nodes[i - 1].gen == gen)
+			continue;
+		inotify_rm_watch(inofd, nodes[i - 1].wd);
+		wnode_del(&nodes[i - 1]);
+	}
+
+	/* some couldn't be added */
+	if (nnodes < ndirs)
+		dopoll = 1;
+	return dopoll;
+}
+#endif
+
+static void
+folders_load(void)
+{
+	struct stat	 sb;
+	char		*buf, *p, *nl;
+	ssize_t		 r;
+
+	if (fstat(foldfd, &sb) == -1 || sb.st_size == 0 ||
+	    sb.st_size > 1024 * 1024)
+		return;
+
+	buf = xmalloc(sb.st_size + 1);
+	if ((r = pread(foldfd, buf, sb.st_size, 0)) == -1) {
+		log_warn("can't read the watch folders");
+		free(buf);
+		return;
+	}
+	buf[r] = '\0';
+
+	for (p = buf; *p != '\0'; p = nl + 1) {
+		if ((nl = strchr(p, '\n')) == NULL)
+			break;
+		*nl = '\0';
+		if (*p != '/')
+			continue;
+		folders = xreallocarray(folders, nfolders + 1,
+		    sizeof(*folders));
+		folders[nfolders++] = xstrdup(p);
+	}
+	free(buf);
+}
+
+static void
+folders_save(void)
+{
+	size_t		 i;
+	off_t		 off = 0;
+
+	if (foldfd == -1)
+		return;
+
+	if (ftruncate(foldfd, 0) == -1)
+		goto err;
+	for (i = 0; i < nfolders; ++i) {
+		if (pwrite(foldfd, folders[i], strlen(folders[i]), off) == -1 ||
+		    pwrite(foldfd, "\n", 1, off + strlen(folders[i])) == -1)
+			goto err;
+		off += strlen(folders[i]) + 1;
+	}
+	return;
+
+err:
+	log_warn("can't write the watch folders");
+	close(foldfd);
+	foldfd = -1;
+}
+
+/*
+ * Start watching; fd is the file with the watch folders, or -1.
+ */
+void
+watch_init(int fd)
+{
+	foldfd = fd;
+	if (foldfd != -1)
+		folders_load();
+
+#if HAVE_INOTIFY
+	if ((inofd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) == -1) {
+		log_warn("inotify_init1");
+		return;
+	}
+	ev_add(inofd, EV_READ|EV_EDGE, watch_read, NULL);
+#endif
+}
+
+/*
+ * Watch the given directories of the library, and only those; roots
+ * are the top-level ones.
+ */
+void
+watch_sync(const char **dirs, size_t ndirs, const char **roots,
+    size_t nroots)
+{
+#if HAVE_INOTIFY
+	watch_setpoll(watch_inotify(dirs, ndirs, roots, nroots));
+#else
+	watch_setpoll(1);
+#endif
+}
+
+/* watch a new directory of the library */
+void
+watch_add(const char *path)
+{
+#if HAVE_INOTIFY
+	static int	 warned;
+	int		 wd;
+
+	if (inofd == -1)
+		return;
+
+	if ((wd = inotify_add_watch(inofd, path, WATCH_MASK)) == -1) {
+		if (errno != ENOSPC) {
+			if (errno != ENOENT)
+				log_warn("inotify_add_watch %s", path);
+			return;
+		}
+		if (!warned)
+			log_warnx("out of inotify watches, see "
+			    "fs.inotify.max_user_watches");
+		warned = 1;
+		watch_setpoll(1);
+		return;
+	}
+	wnode_add(wd, path);
+#endif
+}
+
+/* whether the new track at path has to be enqueued */
+int
+watch_folder(const char *path)
+{
+	size_t		 i, len;
+
+	for (i = 0; i < nfolders; ++i) {
+		len = strlen(folders[i]);
+		if (!strncmp(path, folders[i], len) && path[len] == '/')
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Handle an IMSG_CTL_WATCH: change the watch folders if requested,
+ * then reply with the current ones.
+ */
+void
+watch_ctl(struct imsgev *iev, struct imsg *imsg)
+{
+	struct player_watch	 pw;
+	struct ibuf		 ibuf, *wbuf;
+	const char		*p, *end;
+	size_t			 i, len, tot = 0;
+	int			 change = 0;
+
+	if (imsg_get_ibuf(imsg, &ibuf) == -1 ||
+	    ibuf_get(&ibuf, &pw, sizeof(pw)) == -1 ||
+	    ((len = ibuf_size(&ibuf)) != 0 &&
+	    ((const char *)ibuf_data(&ibuf))[len - 1] != '\0')) {
+		main_senderr(iev, "malformed request");
+		return;
+	}
+	p = ibuf_data(&ibuf);
+	end = p + len;
+
+	for (i = 0; !pw.clear && i < nfolders; ++i)
+		tot += strlen(folders[i]) + 1;
+	for (; p < end; p += strlen(p) + 1) {
+		if (*p != '/' || !library_covers(p)) {
+			main_senderr(iev, "not in the library");
+			return;
+		}
+		tot += strlen(p) + 1;
+	}
+
+	/* they have to fit in the reply */
+	if (tot > WATCH_MAXLEN) {
+		main_senderr(iev, "too many watch folders");
+		return;
+	}
+
+	if (pw.clear) {
+		for (i = 0; i < nfolders; ++i)
+			free(folders[i]);
+		free(folders);
+		folders = NULL;
+		nfolders = 0;
+		change = 1;
+	}
+
+	for (p = ibuf_data(&ibuf); p < end; p += strlen(p) + 1) {
+		for (i = 0; i < nfolders; ++i)
+			if (!strcmp(folders[i], p))
+				break;
+		if (i != nfolders)
+			continue;
+		folders = xreallocarray(folders, nfolders + 1,
+		    sizeof(*folders));
+		folders[nfolders++] = xstrdup(p);
+		change = 1;
+	}
+
+	if (change)
+		folders_save();
+
+	if ((wbuf = imsg_create(&iev->imsgbuf, IMSG_CTL_WATCH, 0, 0, 0))
+	    == NULL)
+		fatal("imsg_create");
+	for (i = 0; i < nfolders; ++i)
+		if (imsg_add(wbuf, folders[i], strlen(folders[i]) + 1) == -1)
+			fatal("imsg_add");
+	imsg_close(&iev->imsgbuf, wbuf);
+}
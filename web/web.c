@@ -265,13 +265,28 @@ const char *js =
 	"sb.append(filter);"
 	"document.querySelector('main').prepend(sb);"
 	"function dofilt() {"
-	" let t = filter.value.toLowerCase();"
-	" document.querySelectorAll('.playlist li').forEach(e => {"
-	"  if (e.querySelector('button').value.toLowerCase().indexOf(t) == -1)"
-	"    e.setAttribute('hidden', 'true');"
-	"  else"
+	" const t = filter.value.trim();"
+	" const li = document.querySelectorAll('.playlist li');"
+	" if (t == '') {"
+	"  li.forEach(e => e.removeAttribute('hidden'));"
+	"  return;"
+	" }"
+	" fetch('/a/search', {"
+	"  method:'POST',"
+	"  body: new URLSearchParams({q: t})"
+	" })"
+	" .then(r => r.text())"
+	" .then(r => {"
+	"  const m = new Set(r.split('\\n')"
+	"   .filter(x => x != '').map(Number));"
+	"  li.forEach((e, i) => {"
+	"   if (m.has(i))"
 	"    e.removeAttribute('hidden');"
-	" });"
+	"   else"
+	"    e.setAttribute('hidden', 'true');"
+	"  });"
+	" })"
+	" .catch(x => console.log('failed to search:', x));"
 	"};"
 	"function dbc(fn, wait) {"
 	" let tout;"
@@ -285,7 +300,7 @@ const char *js =
 	"filter.addEventListener('input', dbc(dofilt, 400));"
 	;
 
-const char *foot = "<script src='/app.js?v=0'></script></body></html>";
+const char *foot = "<script src='/app.js?v=1'></script></body></html>";
 
 static inline int
 bio_ev(struct bufio *bio)
@@ -384,7 +399,7 @@ dispatch_event(const char *msg)
 		if (ws_compose(clt, WST_TEXT, msg, len) == -1)
 			ret = -1;
 
-		ev_add(clt->bio.fd, EV_READ|EV_WRITE, client_ev, clt);
+		ev_mod(clt->bio.fd, EV_READ|EV_WRITE);
 	}
 
 	return (ret);
@@ -445,20 +460,50 @@ dispatch_event_status(void)
 	return 0;
 }
 
+/* ask for the playlist with the compact encoding */
+static void
+request_show(void)
+{
+	int	 flags = SHOW_VARLEN | SHOW_SNAPSHOT;
+
+	imsg_compose(&imsgbuf, IMSG_CTL_SHOW, 0, 0, -1, &flags,
+	    sizeof(flags));
+}
+
 static int
-dispatch_event_track(struct player_status *ps)
+dispatch_event_track(const char *path, int current)
 {
 	char		 p[PATH_MAX + 2];
 	int		 r;
 
-	r = snprintf(p, sizeof(p), "%c:%s",
-	    ps->status == STATE_PLAYING ? 'A' : 'a', ps->path);
+	r = snprintf(p, sizeof(p), "%c:%s", current ? 'A' : 'a', path);
 	if (r < 0 || (size_t)r >= sizeof(p))
 		return (-1);
 
 	return dispatch_event(p);
 }
 
+/* load the playlist snapshot in playlist_tmp */
+static int
+show_snapshot(int fd, ssize_t *off)
+{
+	size_t		 i;
+	char		 path[PATH_MAX];
+
+	playlist_free(&playlist_tmp);
+	if (playlist_loadsnapshot(fd, &playlist_tmp, off) == -1)
+		return (-1);
+
+	if (playlist_tmp.len != 0)
+		dispatch_event("x:");
+	for (i = 0; i < playlist_tmp.len; ++i) {
+		if (playlist_get(&playlist_tmp, i, path, sizeof(path)) == NULL)
+			return (-1);
+		dispatch_event_track(path, *off == (ssize_t)i);
+	}
+	return (0);
+}
+
 static void
 imsg_dispatch(int fd, int ev, void *d)
 {
@@ -472,7 +517,7 @@ imsg_dispatch(int fd, int ev, void *d)
 	const char		*msg;
 	ssize_t			 n;
 	size_t			 datalen;
-	int			 r;
+	int			 r, sfd;
 
 	if (ev & EV_READ) {
 		if ((n = imsgbuf_read(&imsgbuf)) == -1)
@@ -505,8 +550,7 @@ imsg_dispatch(int fd, int ev, void *d)
 
 		case IMSG_CTL_ADD:
 			playlist_free(&playlist_tmp);
-			imsg_compose(&imsgbuf, IMSG_CTL_SHOW, 0, 0, -1,
-			    NULL, 0);
+			request_show();
 			break;
 
 		case IMSG_CTL_MONITOR:
@@ -525,8 +569,7 @@ imsg_dispatch(int fd, int ev, void *d)
 			case IMSG_CTL_PREV:
 			case IMSG_CTL_JUMP:
 			case IMSG_CTL_COMMIT:
-				imsg_compose(&imsgbuf, IMSG_CTL_SHOW, 0, 0, -1,
-				    NULL, 0);
+				request_show();
 				imsg_compose(&imsgbuf, IMSG_CTL_STATUS, 0, 0,
 				    -1, NULL, 0);
 				break;
@@ -551,6 +594,14 @@ imsg_dispatch(int fd, int ev, void *d)
 			break;
 
 		case IMSG_CTL_SHOW:
+			if ((sfd = imsg_get_fd(&imsg)) != -1) {
+				r = show_snapshot(sfd, &off);
+				close(sfd);
+				if (r == -1)
+					fatal("corrupted IMSG_CTL_SHOW");
+				off_found = 1;
+				break;
+			}
 			if (imsg_get_len(&imsg) == 0) {
 				if (playlist_tmp.len == 0) {
 					dispatch_event("x:");
@@ -564,13 +615,12 @@ imsg_dispatch(int fd, int ev, void *d)
 				off_found = 0;
 				break;
 			}
-			if (imsg_get_data(&imsg, &ps, sizeof(ps)) == -1)
-				fatalx("corrupted IMSG_CTL_SHOW");
-			if (ps.path[sizeof(ps.path) - 1] != '\0')
+			if (playlist_showentry(&imsg, &ps) == -1)
 				fatalx("corrupted IMSG_CTL_SHOW");
 			if (playlist_tmp.len == 0)
 				dispatch_event("x:");
-			dispatch_event_track(&ps);
+			dispatch_event_track(ps.path,
+			    ps.status == STATE_PLAYING);
 			playlist_push(&playlist_tmp, ps.path);
 			if (ps.status == STATE_PLAYING)
 				off_found = 1;
@@ -595,7 +645,7 @@ imsg_dispatch(int fd, int ev, void *d)
 	ev = EV_READ;
 	if (imsgbuf_queuelen(&imsgbuf))
 		ev |= EV_WRITE;
-	ev_add(fd, ev, imsg_dispatch, NULL);
+	ev_mod(fd, ev);
 }
 
 static void
@@ -610,7 +660,7 @@ static void
 render_playlist(struct client *clt)
 {
 	ssize_t			 i;
-	const char		*path;
+	char			 path[PATH_MAX];
 	int			 current;
 
 	http_writes(clt, "<section class='playlist-wrapper'>");
@@ -619,9 +669,12 @@ render_playlist(struct client *clt)
 	http_writes(clt, "<ul class=playlist>");
 
 	for (i = 0; i < playlist.len; ++i) {
+		if (playlist_isdead(&playlist, i))
+			continue;
 		current = play_off == i;
 
-		path = playlist.songs[i];
+		if (playlist_get(&playlist, i, path, sizeof(path)) == NULL)
+			continue;
 
 		http_fmt(clt, "<li%s>", current ? " id=current" : "");
 		http_writes(clt, "<button type=submit name=jump value=\"");
@@ -714,13 +767,12 @@ route_jump(struct client *clt)
 		field += 5;
 		found = 1;
 
-		memset(&path, 0, sizeof(path));
 		if (strlcpy(path, field, sizeof(path)) >= sizeof(path))
 			goto badreq;
 
 		imsg_compose(&imsgbuf, IMSG_CTL_JUMP, 0, 0, -1,
-		    path, sizeof(path));
-		ev_add(imsgbuf.fd, EV_READ|EV_WRITE, imsg_dispatch, NULL);
+		    path, strlen(path) + 1);
+		ev_mod(imsgbuf.fd, EV_READ|EV_WRITE);
 		break;
 	}
 
@@ -791,7 +843,7 @@ route_mode(struct client *clt)
 	int			 found = 0;
 	struct player_mode	 pm;
 
-	pm.repeat_one = pm.repeat_all = pm.consume = MODE_UNDEF;
+	pm.repeat_one = pm.repeat_all = pm.consume = pm.random = MODE_UNDEF;
 
 	http_postdata(clt, &form, NULL);
 	while ((field = strsep(&form, "&")) != NULL) {
@@ -812,7 +864,7 @@ route_mode(struct client *clt)
 
 		imsg_compose(&imsgbuf, IMSG_CTL_MODE, 0, 0, -1,
 		    &pm, sizeof(pm));
-		ev_add(imsgbuf.fd, EV_READ|EV_WRITE, imsg_dispatch, NULL);
+		ev_mod(imsgbuf.fd, EV_READ|EV_WRITE);
 		break;
 	}
 
@@ -830,6 +882,44 @@ route_mode(struct client *clt)
 	http_writes(clt, "Bad Request.\n");
 }
 
+/*
+ * The position of every entry that matches q, one per line: it's used
+ * to filter the playlist, so none can be left out.
+ */
+static void
+route_search(struct client *clt)
+{
+	struct plmatch		*m = NULL;
+	char			*form, *field;
+	size_t			 i, n;
+
+	http_postdata(clt, &form, NULL);
+	while ((field = strsep(&form, "&")) != NULL) {
+		if (url_decode(field) == -1)
+			goto badreq;
+
+		if (strncmp(field, "q=", 2) != 0)
+			continue;
+		field += 2;
+
+		if (playlist.len != 0)
+			m = xcalloc(playlist.len, sizeof(*m));
+		n = playlist_search(&playlist, field, m, playlist.len);
+		if (http_reply(clt, 200, "OK", "text/plain") == -1)
+			goto done;
+		for (i = 0; i < n; ++i)
+			if (http_fmt(clt, "%zu\n", m[i].pos) == -1)
+				break;
+ done:
+		free(m);
+		return;
+	}
+
+ badreq:
+	http_reply(clt, 400, "Bad Request", "text/plain");
+	http_writes(clt, "Bad Request.\n");
+}
+
 static void
 route_handle_ws(struct client *clt)
 {
@@ -915,6 +1005,7 @@ route_dispatch(struct client *clt)
 		{ METHOD_POST,	"/a/jump",	&route_jump },
 		{ METHOD_POST,	"/a/ctrls",	&route_controls },
 		{ METHOD_POST,	"/a/mode",	&route_mode },
+		{ METHOD_POST,	"/a/search",	&route_search },
 
 		{ METHOD_GET,	"/ws",		&route_init_ws },
 
@@ -998,7 +1089,7 @@ client_ev(int fd, int ev, void *d)
 		goto err; /* done with this client */
 	}
 
-	ev_add(fd, ev, client_ev, clt);
+	ev_mod(fd, ev);
 	return;
 
  err:
@@ -1024,6 +1115,12 @@ web_accept(int psock, int ev, void *d)
 		close(sock);
 		return;
 	}
+	if (ev_add(sock, EV_READ, client_ev, clt) == -1) {
+		log_warn("ev_add");
+		http_free(clt);
+		free(clt);
+		return;
+	}
 
 	TAILQ_INSERT_TAIL(&clients, clt, clients);
 
@@ -1117,7 +1214,8 @@ main(int argc, char **argv)
 	amused_sock = dial(sock);
 	if (imsgbuf_init(&imsgbuf, amused_sock) == -1)
 		fatal("imsgbuf_init");
-	imsg_compose(&imsgbuf, IMSG_CTL_SHOW, 0, 0, -1, NULL, 0);
+	imsgbuf_allow_fdpass(&imsgbuf);
+	request_show();
 	imsg_compose(&imsgbuf, IMSG_CTL_STATUS, 0, 0, -1, NULL, 0);
 	imsg_compose(&imsgbuf, IMSG_CTL_MONITOR, 0, 0, -1, NULL, 0);
 	ev_add(amused_sock, EV_READ|EV_WRITE, imsg_dispatch, NULL);
@@ -1163,7 +1261,7 @@ main(int argc, char **argv)
 		fatal("%s", cause);
 	freeaddrinfo(res0);
 
-	if (pledge("stdio inet", NULL) == -1)
+	if (pledge("stdio inet recvfd", NULL) == -1)
 		fatal("pledge");
 
 	log_info("listening on %s:%s", host ? host : "*", port);